@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+
+#include "commander_cpp.hpp"
+#include "commander_cpp_generator.hpp"
+#include "commander_cpp_ipc.hpp"
+
+using namespace COMMANDER_CPP;
+
+class NullLogger : public Logger
+{
+  public:
+    virtual Logger *print(const String &) override
+    {
+        return this;
+    }
+};
+
+/*
+ * 防止编译器把被测代码当作无用代码优化掉
+ */
+template <typename T> inline void doNotOptimize(T const &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+/*
+ * 持有 argv 字符串，提供 parse 需要的 char **
+ */
+class Argv
+{
+  public:
+    Argv(std::initializer_list<String> list) : args(list)
+    {
+        refresh();
+    }
+    Argv(const Vector<String> &list) : args(list)
+    {
+        refresh();
+    }
+    int argc()
+    {
+        return static_cast<int>(ptrs.size());
+    }
+    char **argv()
+    {
+        return ptrs.data();
+    }
+
+  private:
+    void refresh()
+    {
+        ptrs.clear();
+        for (auto &arg : args)
+            ptrs.push_back(&arg[0]);
+    }
+
+    Vector<String> args;
+    Vector<char *> ptrs;
+};
+
+struct BenchResult
+{
+    String name;
+    uint64_t iterations;
+    double nsPerOp;
+    double minNs;
+    double medianNs;
+    double maxNs;
+};
+
+class Bench
+{
+  public:
+    int samples = 7;
+    std::chrono::nanoseconds sampleTime = std::chrono::milliseconds(20);
+    String filter;
+    // 有用例违反了规模断言时置位，main 据此返回非零
+    bool failed = false;
+
+    /*
+     * @brief 运行一个用例：先校准每个样本的迭代次数，再取多个样本的中位数
+     * @return 每次操作耗时的中位数（纳秒），被过滤掉时返回 0
+     */
+    double run(const String &name, const std::function<void()> &body)
+    {
+        if (!filter.empty() && name.find(filter) == String::npos)
+            return 0;
+
+        using Clock = std::chrono::steady_clock;
+        body();
+
+        uint64_t iterations = 1;
+        while (true)
+        {
+            auto begin = Clock::now();
+            for (uint64_t i = 0; i < iterations; ++i)
+                body();
+            auto elapsed = Clock::now() - begin;
+            if (elapsed >= sampleTime / 4 || iterations >= (1ULL << 30))
+            {
+                double perOp = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+                iterations = std::max<uint64_t>(1, static_cast<uint64_t>(sampleTime.count() / std::max(perOp, 1.0)));
+                break;
+            }
+            iterations *= 2;
+        }
+
+        Vector<double> perOps;
+        for (int s = 0; s < samples; ++s)
+        {
+            auto begin = Clock::now();
+            for (uint64_t i = 0; i < iterations; ++i)
+                body();
+            auto elapsed = Clock::now() - begin;
+            perOps.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+        }
+        std::sort(perOps.begin(), perOps.end());
+
+        double sum = 0;
+        for (auto v : perOps)
+            sum += v;
+        results.push_back(
+            {name, iterations * samples, sum / perOps.size(), perOps.front(), perOps[perOps.size() / 2], perOps.back()});
+        std::cerr << name << ": " << perOps[perOps.size() / 2] << " ns/op" << std::endl;
+        return perOps[perOps.size() / 2];
+    }
+
+    String json()
+    {
+        std::stringstream out;
+        out << std::fixed << std::setprecision(1) << "{\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const auto &r = results[i];
+            out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+                << ", \"ns_per_op\": " << r.nsPerOp << ", \"min_ns\": " << r.minNs << ", \"median_ns\": " << r.medianNs
+                << ", \"max_ns\": " << r.maxNs << "}";
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+  private:
+    Vector<BenchResult> results;
+};
+
+Command *buildOptions(Logger *logger, size_t count)
+{
+    Command *cmd = new Command("bench", logger);
+    for (size_t i = 0; i < count; ++i)
+        cmd->option("--opt" + GENERATOR::letters(i) + " <value>", "option " + std::to_string(i));
+    return cmd;
+}
+
+Command *buildCommands(Logger *logger, size_t count)
+{
+    Command *cmd = new Command("bench", logger);
+    for (size_t i = 0; i < count; ++i)
+        cmd->command("cmd" + std::to_string(i) + " [files...]", "command " + std::to_string(i));
+    return cmd;
+}
+
+Vector<String> valueList(size_t count)
+{
+    Vector<String> args = {"bench", "--values"};
+    for (size_t i = 0; i < count; ++i)
+        args.push_back(std::to_string(i));
+    return args;
+}
+
+void benchConstruction(Bench &bench, Logger *logger)
+{
+    for (size_t n : {10, 100, 1000})
+    {
+        bench.run("construct/options/" + std::to_string(n), [=]() {
+            Command *cmd = buildOptions(logger, n);
+            doNotOptimize(cmd);
+            delete cmd;
+        });
+        bench.run("construct/commands/" + std::to_string(n), [=]() {
+            Command *cmd = buildCommands(logger, n);
+            doNotOptimize(cmd);
+            delete cmd;
+        });
+    }
+}
+
+void benchParse(Bench &bench, Logger *logger)
+{
+    Command flags("bench", logger);
+    flags.option("-a --alpha", "a")->option("-b --beta", "b")->option("-c --gamma", "c")->option("-d --delta", "d");
+    flags.action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+
+    Argv flagArgv = {"bench", "--alpha", "--beta", "--gamma", "--delta"};
+    bench.run("parse/flags", [&]() { flags.parse(flagArgv.argc(), flagArgv.argv()); });
+
+    Argv clusterArgv = {"bench", "-abcd"};
+    bench.run("parse/cluster", [&]() { flags.parse(clusterArgv.argc(), clusterArgv.argv()); });
+
+    Command multi("bench", logger);
+    multi.option("--values <values...>", "auto values")->action([](Vector<Variant>, Map<String, Variant> opts) {
+        doNotOptimize(opts);
+    });
+    Command typed("bench", logger);
+    typed.option("--values <values...>", "typed values", ValueType::Int64)
+        ->action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+    for (size_t n : {100, 10000})
+    {
+        Argv values = valueList(n);
+        bench.run("parse/multi-value/auto/" + std::to_string(n), [&]() { multi.parse(values.argc(), values.argv()); });
+        bench.run("parse/multi-value/int64/" + std::to_string(n), [&]() { typed.parse(values.argc(), values.argv()); });
+    }
+
+    // 刚达到默认阈值的列表：串行转换与复用线程池的并行转换
+    Command serial("bench", logger);
+    serial.parallelConversion(0)
+        ->option("--values <values...>", "typed values", ValueType::Int64)
+        ->action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+    typed.parallelConversion(1 << 16);
+    Argv threshold = valueList(1 << 16);
+    bench.run("parse/multi-value/int64-serial/65536", [&]() { serial.parse(threshold.argc(), threshold.argv()); });
+    bench.run("parse/multi-value/int64-parallel/65536", [&]() { typed.parse(threshold.argc(), threshold.argv()); });
+
+    Command nested("bench", logger);
+    Vector<String> nestedArgs = {"bench"};
+    Command *cur = &nested;
+    for (int depth = 0; depth < 8; ++depth)
+    {
+        String name = "level" + std::to_string(depth);
+        cur = cur->command(name, "nested command")->option("-v --verbose", "verbose");
+        nestedArgs.push_back(name);
+    }
+    cur->action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+    nestedArgs.push_back("-v");
+    Argv nestedArgv(nestedArgs);
+    bench.run("parse/nested/8", [&]() { nested.parse(nestedArgv.argc(), nestedArgv.argv()); });
+
+    // 模拟逐个输入 200 个 token，每输入一个就查询补全：增量解析与每次从头遍历
+    Vector<String> words = {"--alpha"};
+    for (int i = 0; i < 200; ++i)
+        words.push_back(i % 10 == 0 ? "-ab" : "value" + std::to_string(i));
+    bench.run("push/incremental/200", [&]() {
+        Command::PushParser parser(flags);
+        for (const auto &word : words)
+        {
+            parser.push(word);
+            doNotOptimize(parser.complete("--"));
+        }
+    });
+    bench.run("push/rewalk/200", [&]() {
+        Vector<String> typed;
+        for (const auto &word : words)
+        {
+            typed.push_back(word);
+            typed.push_back("--");
+            doNotOptimize(flags.complete(typed));
+            typed.pop_back();
+        }
+    });
+}
+
+void benchHelp(Bench &bench, Logger *logger)
+{
+    for (size_t n : {10, 100})
+    {
+        Command *cmd = buildOptions(logger, n);
+        for (size_t i = 0; i < n; ++i)
+            cmd->command("cmd" + std::to_string(i) + " <file>", "command " + std::to_string(i));
+        bench.run("help/" + std::to_string(n), [=]() { doNotOptimize(cmd->helpText()); });
+        delete cmd;
+    }
+}
+
+void benchConversion(Bench &bench)
+{
+    Vector<String> tokens;
+    for (int i = 0; i < 1000; ++i)
+        tokens.push_back(std::to_string(i * 7919));
+    Vector<const char *> ptrs;
+    for (auto &t : tokens)
+        ptrs.push_back(t.c_str());
+
+    bench.run("convert/int64/1000", [&]() {
+        int64_t sum = 0;
+        for (auto p : ptrs)
+        {
+            int64_t v = 0;
+            TOOLS::parseElement(p, v);
+            sum += v;
+        }
+        doNotOptimize(sum);
+    });
+    bench.run("convert/double/1000", [&]() {
+        double sum = 0;
+        for (auto p : ptrs)
+        {
+            double v = 0;
+            TOOLS::parseElement(p, v);
+            sum += v;
+        }
+        doNotOptimize(sum);
+    });
+    bench.run("convert/compact-value/1000", [&]() {
+        for (auto &t : tokens)
+            doNotOptimize(CompactValue::fromVariant(Variant(t)));
+    });
+}
+
+/*
+ * 用生成器构造 nodes 个节点的扁平命令树，测量解析、子命令查找和帮助文本随规模的变化
+ */
+void benchScale(Bench &bench, Logger *logger, size_t maxNodes)
+{
+    // 默认加载只检查文件头和各表范围，耗时不应随节点数增长
+    double firstLoad = 0;
+    for (size_t nodes = 1000; nodes <= maxNodes; nodes *= 10)
+    {
+        String suffix = "/" + std::to_string(nodes);
+        auto wanted = [&](const String &name) {
+            return bench.filter.empty() || (name + suffix).find(bench.filter) != String::npos;
+        };
+        // 生成大树本身很耗时，没有用例需要时直接跳过
+        if (!wanted("scale/parse") && !wanted("scale/find-command") && !wanted("scale/help") &&
+            !wanted("scale/schema-load") && !wanted("scale/schema-parse") && !wanted("scale/json-import") &&
+            !wanted("scale/complete"))
+            continue;
+
+        GENERATOR::TreeSpec spec;
+        spec.depth = 1;
+        spec.fanOut = static_cast<int>(nodes - 1);
+        spec.maxNodes = nodes;
+        GENERATOR::GeneratedTree tree = GENERATOR::generateTree(spec, logger);
+        for (auto &node : tree.nodes)
+            node.command->action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+
+        Vector<Argv> corpus;
+        for (auto &line : GENERATOR::generateArgv(tree, 1, 256))
+            corpus.emplace_back(line);
+
+        size_t next = 0;
+        bench.run("scale/parse" + suffix, [&]() {
+            Argv &argv = corpus[next++ % corpus.size()];
+            tree.root->parse(argv.argc(), argv.argv());
+        });
+        bench.run("scale/find-command" + suffix, [&]() {
+            doNotOptimize(tree.root->findCommand(tree.nodes[1 + next++ % (tree.nodes.size() - 1)].name));
+        });
+        bench.run("scale/help" + suffix, [&]() { doNotOptimize(tree.root->helpText()); });
+        bench.run("scale/complete" + suffix, [&]() {
+            const String &name = tree.nodes[1 + next++ % (tree.nodes.size() - 1)].name;
+            doNotOptimize(tree.root->complete({name.substr(0, 2)}));
+            doNotOptimize(tree.root->complete({name, "--"}));
+        });
+
+        // 从映射的 schema 启动：加载根命令，只构造 argv 选中的路径
+        std::filesystem::path schema =
+            std::filesystem::temp_directory_path() / ("commander_bench_schema_" + std::to_string(nodes) + ".bin");
+        tree.root->saveSchema(schema.string());
+        double load = bench.run("scale/schema-load" + suffix, [&]() {
+            Command *root = Command::loadSchema(schema.string(), logger);
+            doNotOptimize(root);
+            delete root;
+        });
+        if (firstLoad == 0)
+            firstLoad = load;
+        else if (load > firstLoad * 4)
+        {
+            std::cerr << "scale/schema-load" << suffix << ": load time grew from " << firstLoad << " to " << load
+                      << " ns/op" << std::endl;
+            bench.failed = true;
+        }
+        bench.run("scale/schema-parse" + suffix, [&]() {
+            Command *root = Command::loadSchema(schema.string(), logger);
+            Argv &argv = corpus[next++ % corpus.size()];
+            root->parse(argv.argc(), argv.argv());
+            delete root;
+        });
+        std::filesystem::remove(schema);
+
+        String json = tree.root->toJson();
+        bench.run("scale/json-import" + suffix, [&]() {
+            Command root("", logger);
+            root.importJson(json);
+            doNotOptimize(root);
+        });
+    }
+}
+
+/*
+ * 批量检查生成的命令行语料文件，串行与按核数分片并行
+ */
+void benchLint(Bench &bench, Logger *logger)
+{
+    if (!bench.filter.empty() && String("lint/serial/20000 lint/parallel/20000").find(bench.filter) == String::npos)
+        return;
+    GENERATOR::TreeSpec spec;
+    GENERATOR::GeneratedTree tree = GENERATOR::generateTree(spec, logger);
+    String file = std::filesystem::temp_directory_path().string() + "/commander-bench-lint";
+    {
+        std::ofstream out(file);
+        for (const auto &argv : GENERATOR::generateArgv(tree, 7, 20000))
+        {
+            for (size_t i = 0; i < argv.size(); ++i)
+                out << (i ? " " : "") << argv[i];
+            out << "\n";
+        }
+    }
+    bench.run("lint/serial/20000", [&]() { doNotOptimize(tree.root->lint(file, 1)); });
+    bench.run("lint/parallel/20000", [&]() { doNotOptimize(tree.root->lint(file)); });
+    std::filesystem::remove(file);
+}
+
+/*
+ * 转发一次调用到常驻进程的往返耗时，包括传递文件描述符、切换工作目录和环境变量
+ */
+void benchDaemon(Bench &bench, Logger *logger)
+{
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+    if (!bench.filter.empty() && String("daemon/forward").find(bench.filter) == String::npos)
+        return;
+    Command cmd("bench", logger);
+    cmd.option("-a --alpha", "a")->action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+
+    String path = std::filesystem::temp_directory_path().string() + "/commander-bench-" + std::to_string(getpid());
+    IPC::Daemon daemon(path);
+    if (!daemon.listen())
+        return;
+    std::thread server([&] { daemon.serve(IPC::Daemon::parseHandler(cmd)); });
+    int null = ::open("/dev/null", O_RDWR);
+    const int fds[3] = {null, null, null};
+    Argv argv = {"bench", "--alpha"};
+    bench.run("daemon/forward", [&]() {
+        int status;
+        daemon.forward(argv.argc(), argv.argv(), status, fds);
+        doNotOptimize(status);
+    });
+    ::close(null);
+    daemon.stop();
+    server.join();
+#endif
+}
+
+/*
+ * 服务模式下 100 条请求的往返耗时：逐条等待响应与连续发送后再读取
+ */
+void benchService(Bench &bench, Logger *logger)
+{
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+    if (!bench.filter.empty() &&
+        String("service/sequential/100 service/pipelined/100").find(bench.filter) == String::npos)
+        return;
+    Command cmd("bench", logger);
+    cmd.option("-a --alpha", "a")
+        ->option("-b --beta <value>", "b")
+        ->action([](Vector<Variant>, Map<String, Variant> opts) { doNotOptimize(opts); });
+    IPC::Service service(cmd);
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return;
+    std::thread server([&] { service.serve(fds[1], fds[1]); });
+    IPC::Service::Response response;
+    bench.run("service/sequential/100", [&]() {
+        for (int i = 0; i < 100; ++i)
+        {
+            IPC::Service::send(fds[0], "--alpha --beta 42");
+            IPC::Service::receive(fds[0], response);
+        }
+    });
+    bench.run("service/pipelined/100", [&]() {
+        for (int i = 0; i < 100; ++i)
+            IPC::Service::send(fds[0], "--alpha --beta 42");
+        for (int i = 0; i < 100; ++i)
+            IPC::Service::receive(fds[0], response);
+    });
+    ::shutdown(fds[0], SHUT_WR);
+    server.join();
+    ::close(fds[0]);
+    ::close(fds[1]);
+#endif
+}
+
+/*
+ * 回放调用记录：指定 --replay 时回放真实记录（命令树从 --schema 加载），否则先记录 1000 条生成的调用再回放
+ */
+void benchReplay(Bench &bench, Logger *logger, const String &log, const String &schema)
+{
+    if (!bench.filter.empty() && String("replay/validate replay/parse").find(bench.filter) == String::npos)
+        return;
+    std::unique_ptr<Command> loaded;
+    GENERATOR::GeneratedTree tree;
+    Command *root = nullptr;
+    String file = log;
+    if (!log.empty())
+    {
+        if (schema.empty())
+        {
+            std::cerr << "replay: --schema is required with --replay" << std::endl;
+            return;
+        }
+        loaded.reset(Command::loadSchema(schema, logger));
+        root = loaded.get();
+        if (!root)
+        {
+            std::cerr << "replay: " << schema << " load failed" << std::endl;
+            return;
+        }
+    }
+    else
+    {
+        tree = GENERATOR::generateTree(GENERATOR::TreeSpec(), logger);
+        root = tree.root.get();
+        file = std::filesystem::temp_directory_path().string() + "/commander-bench-replay";
+        std::filesystem::remove(file);
+        root->record(file);
+        for (auto &words : GENERATOR::generateArgv(tree, 11, 1000))
+        {
+            Argv argv(words);
+            root->parse(argv.argc(), argv.argv());
+        }
+        root->record(String());
+    }
+
+    ReplayReport report;
+    bench.run("replay/validate", [&]() { report = root->replay(file); });
+    if (!report.failure.empty() || report.mismatches)
+        std::cerr << "replay/validate: " << report.summary();
+    bench.run("replay/parse", [&]() { report = root->replay(file, true); });
+    if (!report.failure.empty() || report.mismatches)
+        std::cerr << "replay/parse: " << report.summary();
+    if (log.empty())
+        std::filesystem::remove(file);
+}
+
+int main(int argc, char **argv)
+{
+    NullLogger logger;
+    LoggerDefaultImpl cliLogger;
+    Bench bench;
+    String outFile;
+    String replayLog;
+    String replaySchema;
+    size_t maxNodes = 10000;
+    bool run = false;
+
+    Command("commander-bench", &cliLogger)
+        .description("commander-cpp micro benchmarks, results are written as JSON.")
+        ->option("-f --filter <pattern>", "only run benchmarks whose name contains pattern")
+        ->option("-s --samples <count>", "samples per benchmark")
+        ->option("-o --out <file>", "write JSON to file instead of stdout")
+        ->option("-n --max-nodes <count>", "largest generated tree for scale benchmarks, e.g. 100000")
+        ->option("-r --replay <log>", "replay an invocation log recorded with Command::record")
+        ->option("--schema <file>", "schema of the command tree the log was recorded against")
+        ->action([&](Vector<Variant>, Map<String, Variant> opts) {
+            Options o{opts};
+            bench.filter = o.getValue<String>("filter", "");
+            bench.samples = std::max(1, o.getValue<int>("samples", bench.samples));
+            outFile = o.getValue<String>("out", "");
+            maxNodes = static_cast<size_t>(std::max(1000, o.getValue<int>("max-nodes", static_cast<int>(maxNodes))));
+            replayLog = o.getValue<String>("replay", "");
+            replaySchema = o.getValue<String>("schema", "");
+            run = true;
+        })
+        ->parse(argc, argv);
+    if (!run)
+        return 0;
+
+    benchConstruction(bench, &logger);
+    benchParse(bench, &logger);
+    benchHelp(bench, &logger);
+    benchConversion(bench);
+    benchScale(bench, &logger, maxNodes);
+    benchLint(bench, &logger);
+    benchDaemon(bench, &logger);
+    benchService(bench, &logger);
+    benchReplay(bench, &logger, replayLog, replaySchema);
+
+    if (outFile.empty())
+        std::cout << bench.json();
+    else
+        std::ofstream(outFile) << bench.json();
+    return bench.failed ? 1 : 0;
+}
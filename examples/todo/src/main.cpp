@@ -3,6 +3,7 @@
 #include <fstream>
 
 #include "../../../src/commander_cpp.hpp"
+#include "../../../src/commander_cpp_ipc.hpp"
 #include "../../third/nlohmann/json.hpp"
 
 using namespace COMMANDER_CPP;
@@ -515,32 +516,40 @@ int main(int argc, char **argv)
     conf                            配置。
 
     */
+    // 设置 TODO_DAEMON 后调用转发给常驻进程，省去启动和构建命令树的开销；没有常驻进程时在本进程执行后启动一个
+    bool warm = std::getenv("TODO_DAEMON") != nullptr;
+    IPC::Daemon daemon(IPC::Daemon::defaultPath("todo"));
+    int status = 0;
+    if (warm && daemon.forward(argc, argv, status))
+        return status;
+
     auto logger = new TodoLogger();
-    Command("todo", logger)
-        .version("0.0.1", "-V --version", "显示版本号。")
+    Command *cmd = new Command("todo", logger);
+    cmd->version("0.0.1", "-V --version", "显示版本号。")
         ->description("待办。")
-        ->addCommand((new Command("add", logger))
-                         ->description("添加新的待办事项。")
-                         ->argument("<todo...>", "待办事项内容。")
-                         ->option("-d --done", "将待办事项标记为已完成。")
-                         ->option("-D --details <descriptions>", "为待办项添加描述。")
-                         ->action(doActionAdd))
-        ->addCommand((new Command("rm", logger))
-                         ->description("删除待办事项。")
-                         ->argument("<index...>", "待办事项索引。")
-                         ->action(doActionRm))
-        ->addCommand((new Command("mod", logger))
-                         ->description("修改一个待办事项。")
-                         ->option("-a --append", "追加内容到待办事项。")
-                         ->option("-d --done", "将待办事项标记为已完成。")
-                         ->argument("<index>", "待办事项索引。")
-                         ->argument("[todo]", "待办事项内容。")
-                         ->action(doActionMod))
-        ->addCommand((new Command("list", logger))
-                         ->description("显示待办事项列表。")
-                         ->option("-d --done <done>", "只显示完成的或未完成的待办事项，参数为true或false。", true)
-                         ->option("-c --count", "只显示待办事项数量。")
-                         ->argument("[range]", "显示范围\n"
+        // 子命令只在被选中或输出帮助时才构建
+        ->command("add", "添加新的待办事项。",
+                  [](Command *cmd) {
+                      cmd->argument("<todo...>", "待办事项内容。")
+                          ->option("-d --done", "将待办事项标记为已完成。")
+                          ->option("-D --details <descriptions>", "为待办项添加描述。")
+                          ->action(doActionAdd);
+                  })
+        ->command("rm", "删除待办事项。",
+                  [](Command *cmd) { cmd->argument("<index...>", "待办事项索引。")->action(doActionRm); })
+        ->command("mod", "修改一个待办事项。",
+                  [](Command *cmd) {
+                      cmd->option("-a --append", "追加内容到待办事项。")
+                          ->option("-d --done", "将待办事项标记为已完成。")
+                          ->argument("<index>", "待办事项索引。")
+                          ->argument("[todo]", "待办事项内容。")
+                          ->action(doActionMod);
+                  })
+        ->command("list", "显示待办事项列表。",
+                  [](Command *cmd) {
+                      cmd->option("-d --done <done>", "只显示完成的或未完成的待办事项，参数为true或false。", true)
+                          ->option("-c --count", "只显示待办事项数量。")
+                          ->argument("[range]", "显示范围\n"
                                                 "起始：[start | [start-，结束缺省:max\n"
                                                 "结束：end]，起始缺省：0\n"
                                                 "起始-结束：[start-end] | start-end\n"
@@ -548,34 +557,41 @@ int main(int argc, char **argv)
                                                 "查看起始位置为12的：[12 或 [12-\n"
                                                 "查看起始位置为12结束位置为14的：12-14 或 [12-14]\n"
                                                 "查看起始位置为0结束位置为14的：14],14] = [0-14] = 0-14")
-                         ->action(doActionList))
-        ->addCommand((new Command("mv", logger))
-                         ->description("移动待办事项。")
-                         ->argument("<index>", "待办事项索引。")
-                         ->argument("<distIndex>", "目标索引。")
-                         ->action(doActionMv))
-        ->addCommand((new Command("conf", logger))
-                         ->description("配置。")
-                         ->addCommand((new Command("init", logger))
-                                          ->description("初始化仓库。")
-                                          ->option("-c --cover", "如果已经初始化，不再询问，直接覆盖。")
-                                          ->option("-t --table <tableName>", "指定表名，默认为default。")
-                                          ->option("--connect <connectName>", "指定连接方式。")
-                                          ->action(doActionConfInit))
-                        //  ->addCommand((new Command("initWithLocal", logger))
-                        //                   ->description("初始化本地仓库。")
-                        //                   ->option("-c --cover", "如果已经初始化，不再询问，直接覆盖。")
-                        //                   ->option("-t --table <tableName>", "指定表名，默认为default。")
-                        //                   ->option("-r --repository <repositoryPath>", "指定仓库路径。")
-                        //                   ->action(doActionConfInitWithLocal))
-                         ->action([](Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
-                             static_cast<TodoLogger *>(cmd->logger())->printHelp(cmd);
-                         }))
+                          ->action(doActionList);
+                  })
+        ->command("mv", "移动待办事项。",
+                  [](Command *cmd) {
+                      cmd->argument("<index>", "待办事项索引。")
+                          ->argument("<distIndex>", "目标索引。")
+                          ->action(doActionMv);
+                  })
+        ->command("conf", "配置。",
+                  [](Command *cmd) {
+                      cmd->command("init", "初始化仓库。",
+                                   [](Command *init) {
+                                       init->option("-c --cover", "如果已经初始化，不再询问，直接覆盖。")
+                                           ->option("-t --table <tableName>", "指定表名，默认为default。")
+                                           ->option("--connect <connectName>", "指定连接方式。")
+                                           ->action(doActionConfInit);
+                                   })
+                          //  ->command("initWithLocal", "初始化本地仓库。", [](Command *init) {
+                          //      init->option("-c --cover", "如果已经初始化，不再询问，直接覆盖。")
+                          //          ->option("-t --table <tableName>", "指定表名，默认为default。")
+                          //          ->option("-r --repository <repositoryPath>", "指定仓库路径。")
+                          //          ->action(doActionConfInitWithLocal);
+                          //  })
+                          ->action([](Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
+                              static_cast<TodoLogger *>(cmd->logger())->printHelp(cmd);
+                          });
+                  })
         ->action([](Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
             static_cast<TodoLogger *>(cmd->logger())->printHelp(cmd);
-        })
-        ->parse(argc, argv);
+        });
+    cmd->parse(argc, argv);
+    if (warm)
+        daemon.start(IPC::Daemon::parseHandler(*cmd));
 
+    delete cmd;
     delete logger;
     logger = nullptr;
     
@@ -25,24 +25,107 @@ SOFTWARE.
 #define COMMANDER_CPP_HPP
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <regex>
+#include <shared_mutex>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+#define COMMANDER_CPP_HAS_MMAP 1
+#define COMMANDER_CPP_HAS_RUSAGE 1
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<link.h>)
+#include <link.h>
+#define COMMANDER_CPP_HAS_BUILD_ID 1
+#endif
+#if __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define COMMANDER_CPP_HAS_PERF_EVENT 1
+#endif
+#endif
+
+// USDT 静态探针，需要定义 COMMANDER_CPP_ENABLE_USDT 并且系统提供 sys/sdt.h（systemtap-sdt-dev）
+// 探针本身只是一条 nop 指令，但没有使用 semaphore，参数在每次经过探针时都会求值，无论是否附加了跟踪器
+#ifdef COMMANDER_CPP_ENABLE_USDT
+#if defined(__has_include) && !__has_include(<sys/sdt.h>)
+#error "COMMANDER_CPP_ENABLE_USDT requires <sys/sdt.h> (systemtap-sdt-dev)"
+#else
+#include <sys/sdt.h>
+#define COMMANDER_CPP_HAS_USDT 1
+#endif
+#endif
+
+#ifdef COMMANDER_CPP_HAS_USDT
+#define COMMANDER_CPP_PROBE1(name, a) DTRACE_PROBE1(commander_cpp, name, a)
+#define COMMANDER_CPP_PROBE2(name, a, b) DTRACE_PROBE2(commander_cpp, name, a, b)
+#define COMMANDER_CPP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(commander_cpp, name, a, b, c, d)
+#else
+#define COMMANDER_CPP_PROBE1(name, a) ((void)0)
+#define COMMANDER_CPP_PROBE2(name, a, b) ((void)0)
+#define COMMANDER_CPP_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
 namespace COMMANDER_CPP
 {
 using String = std::string;
-using VariantBase = std::variant<std::monostate, int, double, String, bool>;
-using Variant = std::variant<std::monostate, int, double, String, bool, std::vector<VariantBase>>;
 template <typename K, typename V> using Map = std::map<K, V>;
 template <typename T> using Vector = std::vector<T>;
+using VariantBase = std::variant<std::monostate, int, double, String, bool>;
+using Int64List = Vector<int64_t>;
+using DoubleList = Vector<double>;
+// 元素指向 argv（或响应文件映射），只在 parse 期间（包括 action 中）有效
+using StringViewList = Vector<std::string_view>;
+using Variant = std::variant<std::monostate, int, double, String, bool, std::vector<VariantBase>, Int64List, DoubleList,
+                             StringViewList>;
 using Action = std::function<void(class Command *cmd, Vector<Variant> args, Map<String, Variant> opts)>;
 using Action2 = std::function<void(Vector<Variant> args, Map<String, Variant> opts)>;
 using Action3 = std::function<void(class Command *cmd, Vector<Variant> args, class Options opts)>;
+// 延迟构建子命令的选项、参数和子命令
+using CommandBuilder = std::function<void(class Command *cmd)>;
+using ValueVisitor = std::function<void(size_t index, const VariantBase &value)>;
+
+/*
+ * @brief 多值选项的元素类型，Auto 表示按值自动识别并存为 Vector<VariantBase>
+ */
+enum class ValueType
+{
+    Auto,
+    Int64,
+    Double,
+    StringView
+};
 
 namespace TOOLS
 {
@@ -78,1046 +161,6089 @@ Vector<String> split(const String &str, const String &delimiter)
 
    return std::move(lines);
 }
-} // namespace TOOLS
 
-class FinialRelease
+/*
+ * @brief 以写时复制方式映射整个文件，保证 data()[size()] 可写，便于原地切分字符串
+ *        只读打开时直接共享映射，不要求末尾有空余字节
+ */
+class MappedFile
 {
   public:
-    FinialRelease(std::function<void()> release) : r(release)
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile()
     {
+#ifdef COMMANDER_CPP_HAS_MMAP
+        if (mapped)
+            munmap(mapped, mappedSize);
+#endif
     }
-    ~FinialRelease()
+
+    bool open(const String &path, bool writable = true)
     {
-        if (r)
-            r();
+#ifdef COMMANDER_CPP_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        FinalClose close{fd};
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            return false;
+
+        fileSize = static_cast<size_t>(st.st_size);
+        if (!writable && fileSize > 0)
+        {
+            void *p = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED)
+                return false;
+            mapped = static_cast<char *>(p);
+            mappedSize = fileSize;
+            return true;
+        }
+        long pageSize = sysconf(_SC_PAGESIZE);
+        // 文件大小恰好是页大小整数倍时，末尾没有可写的空余字节，退化为读入内存
+        if (fileSize > 0 && pageSize > 0 && fileSize % static_cast<size_t>(pageSize) != 0)
+        {
+            void *p = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+                return false;
+            mapped = static_cast<char *>(p);
+            mappedSize = fileSize;
+            return true;
+        }
+#endif
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        fileSize = buffer.size();
+        return true;
     }
 
-  private:
-    std::function<void()> r;
-};
-
-class Logger
-{
-  public:
-    virtual ~Logger()
+    char *data()
     {
+        return mapped ? mapped : &buffer[0];
     }
-    virtual Logger *debug(const String &msg)
-    {
-        return this;
-    };
-    virtual Logger *warn(const String &msg)
+    size_t size() const
     {
-        return this;
-    };
-    virtual Logger *error(const String &msg)
+        return fileSize;
+    }
+
+  private:
+#ifdef COMMANDER_CPP_HAS_MMAP
+    struct FinalClose
     {
-        return this;
+        int fd;
+        ~FinalClose()
+        {
+            ::close(fd);
+        }
     };
-    virtual Logger *print(const String &msg) = 0;
+#endif
+    char *mapped = nullptr;
+    size_t mappedSize = 0;
+    size_t fileSize = 0;
+    String buffer;
 };
 
-class LoggerDefaultImpl : public Logger
+/*
+ * @brief 选项 token 的组成部分，都指向原始 token
+ */
+struct OptionToken
 {
-  public:
-    virtual Logger *print(const String &msg) override
-    {
-        std::cout << msg << std::endl;
-        return this;
-    };
+    // 长选项的名称，或者别名组合中的全部别名
+    std::string_view name;
+    // "=" 之后的值，没有时为空；是原始 token 的后缀，以 '\0' 结尾
+    std::string_view value;
+    bool isLong = false;
 };
 
-class Options
+/*
+ * @brief 拆分 "--name[=value]" 或 "-abc[=value]"，不构造字符串
+ *        长选项名称以字母开头，只包含字母和 '-'；别名只包含字母；"=" 之后至少有一个字符
+ */
+inline bool splitOptionToken(const char *text, OptionToken &out)
 {
-  public:
-    Map<String, Variant> opts;
+    if (text[0] != '-')
+        return false;
+
+    const char *p = text + 1;
+    bool isLong = *p == '-';
+    if (isLong)
+        ++p;
+    if (!std::isalpha(static_cast<unsigned char>(*p)))
+        return false;
+
+    const char *name = p++;
+    while (std::isalpha(static_cast<unsigned char>(*p)) || (isLong && *p == '-'))
+        ++p;
+    if (*p != '\0' && !(*p == '=' && p[1] != '\0'))
+        return false;
+    out.name = std::string_view(name, static_cast<size_t>(p - name));
+    out.value = *p == '=' ? std::string_view(p + 1) : std::string_view();
+    out.isLong = isLong;
+    return true;
+}
 
-    inline bool hasOption(const String &name)
-    {
-        return opts.find(name) != opts.end();
-    }
+/*
+ * @brief 判断 token 是否是选项，规则与 splitOptionToken 一致
+ */
+inline bool isOptionToken(const char *text)
+{
+    OptionToken token;
+    return splitOptionToken(text, token);
+}
 
-    template <typename T> inline T getValue(const String &name, T defaultValue)
-    {
-        auto it = opts.find(name);
-        if (opts.find(name) == opts.end())
-        {
-            return defaultValue;
-        }
-        T *v = std::get_if<T>(&it->second);
-        return v ? *v : defaultValue;
-    }
+/*
+ * @brief 判断 token 是否可能是子命令名称：字母开头，只包含字母和数字
+ */
+inline bool isCommandToken(const char *text)
+{
+    if (!std::isalpha(static_cast<unsigned char>(*text)))
+        return false;
+    while (std::isalnum(static_cast<unsigned char>(*++text)))
+        ;
+    return *text == '\0';
+}
+
+enum class ScalarKind
+{
+    Empty,
+    Int,
+    Double,
+    Bool,
+    // 被一对相同引号包围，引号内不含该引号
+    Quoted,
+    Text
 };
 
-class Command
+/*
+ * @brief 自动类型识别：形如 "-12" 的整数、形如 "-1.5" 的小数、true/false、带引号的字符串或普通文本
+ */
+inline ScalarKind classifyScalar(std::string_view text)
 {
-  public:
-    Command(const String &name = String(), Logger *logger = new LoggerDefaultImpl())
-        : commandName(name), actionCallback(nullptr), pLogger(logger), versionOption(nullptr), helpOption(nullptr),
-          parentCommand(nullptr)
-    {
-        version("0.0.0", "-V --version", "out put version number.");
-        help("-h --help");
-    }
-    ~Command()
+    if (text.empty())
+        return ScalarKind::Empty;
+
+    auto digitsFrom = [&](size_t i) {
+        while (i < text.size() && std::isdigit(static_cast<unsigned char>(text[i])))
+            ++i;
+        return i;
+    };
+    size_t begin = text[0] == '-' ? 1 : 0;
+    size_t end = digitsFrom(begin);
+    if (end > begin)
     {
-        if (versionOption && !parentCommand)
-        {
-            delete versionOption;
-            versionOption = nullptr;
-        }
-        if (helpOption && !parentCommand)
+        if (end == text.size())
+            return ScalarKind::Int;
+        if (text[end] == '.')
         {
-            delete helpOption;
-            helpOption = nullptr;
+            size_t fraction = digitsFrom(end + 1);
+            if (fraction > end + 1 && fraction == text.size())
+                return ScalarKind::Double;
         }
+    }
 
-        for (const auto opt : options)
-        {
-            delete opt;
-        }
-        options.clear();
+    if (text == "true" || text == "false")
+        return ScalarKind::Bool;
+    char quote = text[0];
+    if (text.size() >= 3 && (quote == '"' || quote == '\'') && text.back() == quote &&
+        text.substr(1, text.size() - 2).find(quote) == std::string_view::npos)
+        return ScalarKind::Quoted;
+    return ScalarKind::Text;
+}
 
-        for (const auto cmd : subCommands)
-        {
-            delete cmd;
-        }
-        subCommands.clear();
+/*
+ * @brief 将 token 转换为指定类型的元素，失败时返回 false
+ */
+inline bool parseElement(const char *text, int &out)
+{
+    const char *end = text + std::strlen(text);
+    auto res = std::from_chars(text, end, out);
+    return res.ec == std::errc() && res.ptr == end && end != text;
+}
+inline bool parseElement(const char *text, int64_t &out)
+{
+    const char *end = text + std::strlen(text);
+    auto res = std::from_chars(text, end, out);
+    return res.ec == std::errc() && res.ptr == end && end != text;
+}
+inline bool parseElement(const char *text, double &out)
+{
+    const char *end = text + std::strlen(text);
+#if defined(__cpp_lib_to_chars)
+    auto res = std::from_chars(text, end, out);
+    return res.ec == std::errc() && res.ptr == end && end != text;
+#else
+    // 部分标准库尚未提供浮点数的 from_chars
+    if (end == text || std::isspace(static_cast<unsigned char>(*text)))
+        return false;
+    char *parsed = nullptr;
+    out = std::strtod(text, &parsed);
+    return parsed == end;
+#endif
+}
+inline bool parseElement(const char *text, std::string_view &out)
+{
+    out = text;
+    // 与自动识别时一致，去掉成对的引号
+    if (out.size() >= 2 && (out.front() == '"' || out.front() == '\'') && out.back() == out.front())
+        out = out.substr(1, out.size() - 2);
+    return true;
+}
 
-        for (const auto arg : arguments)
+/*
+ * @brief 8 字节中是否存在空白字符、引号或反斜杠（SWAR 按字长扫描）
+ */
+inline bool hasSpecialByte(uint64_t x)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    auto hasZero = [&](uint64_t v) { return (v - ones) & ~v & highs; };
+    // 小于等于空格的字节都视为分隔符
+    uint64_t lessThan = (x - ones * 0x21) & ~x & highs;
+    return lessThan || hasZero(x ^ (ones * '"')) || hasZero(x ^ (ones * '\'')) || hasZero(x ^ (ones * '\\'));
+}
+
+/*
+ * @brief 原地切分响应文件内容，支持空白分隔、单双引号和反斜杠转义
+ * @param begin 内容起始位置，end 之后必须至少有一个可写字节
+ * @param tokens 输出的 token，均指向原缓冲区并以 '\0' 结尾
+ * @return 引号未闭合时返回 false
+ */
+inline bool tokenize(char *begin, char *end, Vector<char *> &tokens)
+{
+    char *p = begin;
+    while (true)
+    {
+        while (p < end && static_cast<unsigned char>(*p) <= ' ')
+            ++p;
+        if (p == end)
+            break;
+
+        char *token = p;
+        char *w = p;
+        while (p < end)
         {
-            delete arg;
+            // 快速路径：一次跳过 8 个普通字节
+            while (end - p >= 8)
+            {
+                uint64_t x;
+                std::memcpy(&x, p, 8);
+                if (hasSpecialByte(x))
+                    break;
+                if (w != p)
+                    std::memmove(w, p, 8);
+                w += 8;
+                p += 8;
+            }
+            if (p == end)
+                break;
+
+            char c = *p;
+            if (static_cast<unsigned char>(c) <= ' ')
+                break;
+            if (c == '\\')
+            {
+                if (++p < end)
+                    *w++ = *p++;
+                continue;
+            }
+            if (c == '"')
+            {
+                ++p;
+                while (p < end && *p != '"')
+                {
+                    if (*p == '\\' && p + 1 < end && (p[1] == '"' || p[1] == '\\'))
+                        ++p;
+                    *w++ = *p++;
+                }
+                if (p == end)
+                    return false;
+                ++p;
+                continue;
+            }
+            if (c == '\'')
+            {
+                ++p;
+                while (p < end && *p != '\'')
+                    *w++ = *p++;
+                if (p == end)
+                    return false;
+                ++p;
+                continue;
+            }
+            *w++ = *p++;
         }
-        arguments.clear();
-    }
 
-  public:
-    virtual Command *name(const String &name)
-    {
-        commandName = name;
-        return this;
+        *w = '\0';
+        tokens.push_back(token);
     }
-    virtual String name()
+    return true;
+}
+
+/*
+ * @brief 把字符串写成 shell 的单引号字符串
+ *        bash 和 zsh 的单引号内没有转义，单引号写成 '\'' ；fish 的单引号内转义单引号和反斜杠
+ */
+inline String shellQuote(std::string_view text, bool fish)
+{
+    String out = "'";
+    for (char c : text)
     {
-        return commandName;
+        if (c == '\'' && !fish)
+            out += "'\\''";
+        else if ((c == '\'' || c == '\\') && fish)
+            out += String("\\") + c;
+        else
+            out.push_back(c);
     }
+    out.push_back('\'');
+    return out;
+}
 
-    virtual Command *version(const String &v, const String &flag = String(), const String &desc = String())
+/*
+ * @brief 把字符串写成带引号的 JSON 字符串，转义引号、反斜杠和控制字符
+ */
+inline void appendJsonString(String &out, std::string_view text)
+{
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : text)
     {
-        // 函数结束时调用
-        FinialRelease f([this, v, desc]() {
-            if (versionOption)
-            {
-                versionOption->defaultValue = v;
-                if (!desc.empty())
-                    versionOption->desc = desc;
-            }
-        });
-
-        if (!flag.empty())
+        unsigned char u = static_cast<unsigned char>(c);
+        switch (c)
         {
-            Option *opt = Option::create(flag, pLogger);
-            if (!opt)
-            {
-                return this;
-            }
-
-            if (versionOption)
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (u < 0x20)
             {
-                delete versionOption;
-                versionOption = nullptr;
+                out += "\\u00";
+                out.push_back(hex[u >> 4]);
+                out.push_back(hex[u & 0xF]);
             }
-
-            versionOption = opt;
+            else
+                out.push_back(c);
         }
+    }
+    out.push_back('"');
+}
 
-        return this;
-    };
-    virtual String version()
+/*
+ * @brief 只向前读取的 JSON 读取器，不构造 DOM，调用方边读边构造自己的对象
+ */
+class JsonReader
+{
+  public:
+    JsonReader(const char *begin, const char *end) : begin(begin), p(begin), end(end)
     {
-        String *v = std::get_if<String>(&versionOption->defaultValue);
-        return v ? *v : "0.0.0";
     }
 
-    virtual Command *description(const String &desc)
+    bool failed() const
     {
-        commandDescription = desc;
-        return this;
-    };
-    virtual String description()
+        return !lastError.empty();
+    }
+    const String &error() const
     {
-        return commandDescription;
+        return lastError;
+    }
+    size_t offset() const
+    {
+        return static_cast<size_t>(p - begin);
+    }
+    bool fail(const String &reason)
+    {
+        if (lastError.empty())
+            lastError = reason + " at offset " + std::to_string(offset());
+        return false;
     }
 
-    virtual Command *help(const String &flag = String(), const String &desc = String())
+    void skipSpace()
     {
-        FinialRelease r([this, desc]() {
-            if (helpOption)
-            {
-                if (!desc.empty())
-                    helpOption->desc = desc;
-            }
-        });
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            ++p;
+    }
+    bool peek(char c)
+    {
+        skipSpace();
+        return p < end && *p == c;
+    }
+    bool expect(char c)
+    {
+        if (!peek(c))
+            return fail(String("expected '") + c + "'");
+        ++p;
+        return true;
+    }
+    bool atEnd()
+    {
+        skipSpace();
+        return p == end;
+    }
 
-        if (!flag.empty())
+    /*
+     * @brief 读取对象，每个键调用一次 onKey(key)，onKey 必须读取对应的值
+     */
+    template <typename F> bool object(F onKey)
+    {
+        if (!expect('{') || !enter())
+            return false;
+        if (!peek('}'))
         {
-            Option *opt = Option::create(flag, pLogger);
-            if (!opt)
-            {
-                return this;
-            }
-
-            if (helpOption)
+            String key;
+            do
             {
-                delete helpOption;
-                helpOption = nullptr;
-            }
-
-            helpOption = opt;
+                if (!string(key) || !expect(':') || !onKey(key))
+                    return false;
+            } while (next());
         }
-        return this;
-    };
-    virtual String helpText()
+        --depth;
+        return expect('}');
+    }
+    /*
+     * @brief 读取数组，每个元素调用一次 onElement()，onElement 必须读取该元素
+     */
+    template <typename F> bool array(F onElement)
     {
-        auto getHelpText = [this]() {
-            std::vector<std::vector<String>> lines;
+        if (!expect('[') || !enter())
+            return false;
+        if (!peek(']'))
+        {
+            do
+            {
+                if (!onElement())
+                    return false;
+            } while (next());
+        }
+        --depth;
+        return expect(']');
+    }
 
-            auto getUsageText = [&](Command *cmd) {
-                std::stringstream out;
-                out << cmd->commandName;
-                if (cmd->options.size())
-                    out << " [options]";
-                String argumentText;
-                for (const auto arg : cmd->arguments)
+    bool string(String &out)
+    {
+        if (!expect('"'))
+            return false;
+        out.clear();
+        while (true)
+        {
+            const char *start = p;
+            while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20)
+                ++p;
+            out.append(start, p);
+            if (p == end || static_cast<unsigned char>(*p) < 0x20)
+                return fail("unterminated string");
+            if (*p++ == '"')
+                return true;
+            if (p == end)
+                return fail("unterminated string");
+            char c = *p++;
+            switch (c)
+            {
+            case '"':
+            case '\\':
+            case '/':
+                out.push_back(c);
+                break;
+            case 'b':
+                out.push_back('\b');
+                break;
+            case 'f':
+                out.push_back('\f');
+                break;
+            case 'n':
+                out.push_back('\n');
+                break;
+            case 'r':
+                out.push_back('\r');
+                break;
+            case 't':
+                out.push_back('\t');
+                break;
+            case 'u': {
+                uint32_t code = 0;
+                if (!hex4(code))
+                    return false;
+                // 代理对组合成一个码点
+                if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
                 {
-                    argumentText +=
-                        " " + (arg->valueIsRequired ? "<" + arg->name + (arg->isMultiValue ? "..." : "") + ">"
-                                                    : "[" + arg->name + (arg->isMultiValue ? "..." : "") + "]");
+                    p += 2;
+                    uint32_t low = 0;
+                    if (!hex4(low))
+                        return false;
+                    if (low < 0xDC00 || low >= 0xE000)
+                        return fail("invalid surrogate pair");
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
                 }
-                if (!cmd->arguments.empty())
-                    out << argumentText;
+                appendUtf8(out, code);
+                break;
+            }
+            default:
+                return fail("invalid escape");
+            }
+        }
+    }
+    bool boolean(bool &out)
+    {
+        Variant v;
+        if (!value(v))
+            return false;
+        if (!std::holds_alternative<bool>(v))
+            return fail("expected boolean");
+        out = std::get<bool>(v);
+        return true;
+    }
 
-                return out.str();
-            };
+    /*
+     * @brief 读取标量值：字符串、数字、布尔值或 null；整数超出 int 范围时读为 double
+     */
+    bool value(Variant &out)
+    {
+        skipSpace();
+        if (p == end)
+            return fail("unexpected end");
+        if (*p == '"')
+        {
+            String text;
+            if (!string(text))
+                return false;
+            out = std::move(text);
+            return true;
+        }
+        if (literal("true"))
+            return out = true, true;
+        if (literal("false"))
+            return out = false, true;
+        if (literal("null"))
+            return out = Variant(), true;
+
+        const char *start = p;
+        bool isInteger = true;
+        while (p < end && (std::isdigit(static_cast<unsigned char>(*p)) || *p == '-' || *p == '+' || *p == '.' ||
+                           *p == 'e' || *p == 'E'))
+        {
+            if (*p == '.' || *p == 'e' || *p == 'E')
+                isInteger = false;
+            ++p;
+        }
+        String number(start, p);
+        int n = 0;
+        double d = 0;
+        if (isInteger && parseElement(number.c_str(), n))
+            out = n;
+        else if (parseElement(number.c_str(), d))
+            out = d;
+        else
+            return fail("invalid value");
+        return true;
+    }
 
-            auto collectUsage = [&]() {
-                String usageText = getUsageText(this);
+    /*
+     * @brief 跳过任意值，用于忽略不认识的键
+     */
+    bool skip()
+    {
+        if (peek('{'))
+            return object([this](const String &) { return skip(); });
+        if (peek('['))
+            return array([this]() { return skip(); });
+        Variant v;
+        return value(v);
+    }
 
-                Command *p = parentCommand;
-                while (p)
-                {
-                    usageText = p->commandName + " " + usageText;
-                    p = p->parentCommand;
-                }
+  private:
+    bool next()
+    {
+        if (!peek(','))
+            return false;
+        ++p;
+        return true;
+    }
+    bool enter()
+    {
+        // 限制嵌套深度，避免恶意输入耗尽栈空间
+        if (++depth > 512)
+            return fail("nesting too deep");
+        return true;
+    }
+    bool literal(const char *word)
+    {
+        size_t size = std::strlen(word);
+        if (static_cast<size_t>(end - p) < size || std::memcmp(p, word, size) != 0)
+            return false;
+        p += size;
+        return true;
+    }
+    bool hex4(uint32_t &code)
+    {
+        if (end - p < 4)
+            return fail("invalid unicode escape");
+        for (int i = 0; i < 4; ++i)
+        {
+            char c = *p++;
+            int digit = c >= '0' && c <= '9'   ? c - '0'
+                        : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                        : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                               : -1;
+            if (digit < 0)
+                return fail("invalid unicode escape");
+            code = code * 16 + static_cast<uint32_t>(digit);
+        }
+        return true;
+    }
+    static void appendUtf8(String &out, uint32_t code)
+    {
+        if (code < 0x80)
+            out.push_back(static_cast<char>(code));
+        else if (code < 0x800)
+        {
+            out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        else if (code < 0x10000)
+        {
+            out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        else
+        {
+            out.push_back(static_cast<char>(0xF0 | (code >> 18)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
 
-                lines.push_back({{"Usage: " + usageText}});
-                lines.push_back({});
-            };
+    const char *begin;
+    const char *p;
+    const char *end;
+    int depth = 0;
+    String lastError;
+};
 
-            auto collectDescription = [&]() {
-                lines.push_back({{description()}});
-                lines.push_back({});
-            };
+/*
+ * @brief 当前可执行文件的身份：路径、修改时间、大小和 GNU build ID，用于判断磁盘上的缓存是否过期
+ */
+struct ExecutableIdentity
+{
+    String path;
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    String buildId;
 
-            auto collectArguments = [&]() {
-                if (!arguments.empty())
+    static ExecutableIdentity current()
+    {
+        ExecutableIdentity id;
+#if defined(__linux__)
+        char buffer[4096];
+        ssize_t n = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+        if (n > 0)
+            id.path.assign(buffer, static_cast<size_t>(n));
+#endif
+#ifdef COMMANDER_CPP_HAS_MMAP
+        struct stat st;
+        if (!id.path.empty() && stat(id.path.c_str(), &st) == 0)
+        {
+            id.mtime = static_cast<int64_t>(st.st_mtime);
+            id.size = static_cast<uint64_t>(st.st_size);
+        }
+#endif
+#ifdef COMMANDER_CPP_HAS_BUILD_ID
+        // 第一个回调是主程序，直接读取已加载的 PT_NOTE 段，不需要再打开文件
+        dl_iterate_phdr(
+            [](struct dl_phdr_info *info, size_t, void *data) {
+                String &out = *static_cast<String *>(data);
+                for (int i = 0; i < info->dlpi_phnum && out.empty(); ++i)
                 {
-                    lines.push_back({{"Arguments: "}});
-                    for (const auto arg : arguments)
+                    const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+                    if (ph.p_type != PT_NOTE)
+                        continue;
+                    const char *p = reinterpret_cast<const char *>(info->dlpi_addr + ph.p_vaddr);
+                    const char *end = p + ph.p_memsz;
+                    while (p + sizeof(ElfW(Nhdr)) <= end)
                     {
-                        Vector<String> descList = TOOLS::split(arg->desc, "\n");
-                        String firstLine = descList.front();
-
-                        lines.push_back({{"  " + arg->name + (arg->isMultiValue ? "..." : "")}, {firstLine}});
-                        for (auto it = descList.begin() + 1; it < descList.end(); ++it)
+                        const ElfW(Nhdr) *note = reinterpret_cast<const ElfW(Nhdr) *>(p);
+                        const char *name = p + sizeof(ElfW(Nhdr));
+                        const unsigned char *desc =
+                            reinterpret_cast<const unsigned char *>(name + ((note->n_namesz + 3) & ~3u));
+                        if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0)
                         {
-                            lines.push_back({{}, {*it}});
+                            static const char hex[] = "0123456789abcdef";
+                            for (uint32_t k = 0; k < note->n_descsz; ++k)
+                            {
+                                out.push_back(hex[desc[k] >> 4]);
+                                out.push_back(hex[desc[k] & 0xF]);
+                            }
+                            break;
                         }
+                        p = reinterpret_cast<const char *>(desc) + ((note->n_descsz + 3) & ~3u);
                     }
-                    lines.push_back({});
                 }
-            };
+                return 1;
+            },
+            &id.buildId);
+#endif
+        return id;
+    }
 
-            auto collectOptions = [&]() {
-                auto getOptionText = [](Option *opt) {
-                    std::stringstream out;
-                    out << "  " << (opt->alias.empty() ? "" : ("-" + opt->alias + ", ")) << ("--" + opt->name);
-                    if (!opt->valueName.empty())
-                        out << " "
-                            << (opt->valueIsRequired ? "<" + opt->valueName + (opt->multiValue ? "..." : "") + ">"
-                                                     : "[" + opt->valueName + (opt->multiValue ? "..." : "") + "]");
-                    return out.str();
-                };
+    /*
+     * @brief 缓存文件的头部，每个字段一行，shell 脚本按行号读取修改时间和大小
+     */
+    String header() const
+    {
+        return "#binary " + path + "\n#build-id " + buildId + "\n#mtime " + std::to_string(mtime) + "\n#size " +
+               std::to_string(size) + "\n";
+    }
+};
 
-                auto getDescriptionText = [](Option *opt) {
-                    std::stringstream out;
-                    out << opt->desc;
-                    if (!opt->valueName.empty())
-                    {
-                        String defaultValue;
-                        do
-                        {
-                            String *sv = std::get_if<String>(&opt->defaultValue);
-                            if (sv)
-                            {
-                                defaultValue = *sv;
-                                break;
-                            }
+/*
+ * @brief 测量一段代码的墙钟时间、CPU 时间、最大常驻内存和缺页次数，
+ *        Linux 上允许时通过 perf_event_open 额外统计用户态的周期数、指令数和缓存未命中
+ */
+class ResourceProfile
+{
+  public:
+    struct Sample
+    {
+        double wallMs = 0;
+        double userMs = 0;
+        double systemMs = 0;
+        long maxRssKb = 0;
+        long minorFaults = 0;
+        long majorFaults = 0;
+        // 硬件计数器不可用时（权限不足、虚拟机等）为 false
+        bool hasCounters = false;
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cacheMisses = 0;
+    };
 
-                            bool *bv = std::get_if<bool>(&opt->defaultValue);
-                            if (bv)
-                            {
-                                defaultValue = *bv ? "true" : "false";
-                                break;
-                            }
+    ResourceProfile() = default;
+    ResourceProfile(const ResourceProfile &) = delete;
+    ResourceProfile &operator=(const ResourceProfile &) = delete;
+    ~ResourceProfile()
+    {
+#ifdef COMMANDER_CPP_HAS_PERF_EVENT
+        for (int fd : counters)
+        {
+            if (fd >= 0)
+                close(fd);
+        }
+#endif
+    }
 
-                            int *iv = std::get_if<int>(&opt->defaultValue);
-                            if (iv)
-                            {
-                                defaultValue = std::to_string(*iv);
-                                break;
-                            }
+    void start()
+    {
+#ifdef COMMANDER_CPP_HAS_RUSAGE
+        getrusage(RUSAGE_SELF, &usageBegin);
+#endif
+#ifdef COMMANDER_CPP_HAS_PERF_EVENT
+        openCounters();
+        if (counters[0] >= 0)
+        {
+            ioctl(counters[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(counters[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+        wallBegin = std::chrono::steady_clock::now();
+    }
 
-                            double *dv = std::get_if<double>(&opt->defaultValue);
-                            if (dv)
-                            {
-                                defaultValue = std::to_string(*dv);
-                                break;
-                            }
-                        } while (0);
-                        if (!defaultValue.empty())
-                            out << " (default: " << defaultValue << ")";
-                    }
+    Sample stop()
+    {
+        Sample sample;
+        sample.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallBegin).count();
+#ifdef COMMANDER_CPP_HAS_PERF_EVENT
+        if (counters[0] >= 0)
+        {
+            ioctl(counters[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            // PERF_FORMAT_GROUP: 个数，随后依次是每个计数器的值
+            uint64_t values[1 + 3] = {};
+            if (read(counters[0], values, sizeof(values)) > 0 && values[0] == 3)
+            {
+                sample.hasCounters = true;
+                sample.cycles = values[1];
+                sample.instructions = values[2];
+                sample.cacheMisses = values[3];
+            }
+        }
+#endif
+#ifdef COMMANDER_CPP_HAS_RUSAGE
+        struct rusage end;
+        getrusage(RUSAGE_SELF, &end);
+        auto ms = [](const struct timeval &tv) { return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0; };
+        sample.userMs = ms(end.ru_utime) - ms(usageBegin.ru_utime);
+        sample.systemMs = ms(end.ru_stime) - ms(usageBegin.ru_stime);
+#if defined(__APPLE__)
+        // macOS 上 ru_maxrss 的单位是字节
+        sample.maxRssKb = end.ru_maxrss / 1024;
+#else
+        sample.maxRssKb = end.ru_maxrss;
+#endif
+        sample.minorFaults = end.ru_minflt - usageBegin.ru_minflt;
+        sample.majorFaults = end.ru_majflt - usageBegin.ru_majflt;
+#endif
+        return sample;
+    }
 
-                    return out.str();
-                };
+    static String toJson(const String &command, const Sample &s)
+    {
+        std::stringstream out;
+        out << std::fixed;
+        out.precision(3);
+        out << "{\"command\": \"" << command << "\", \"wall_ms\": " << s.wallMs << ", \"user_ms\": " << s.userMs
+            << ", \"system_ms\": " << s.systemMs << ", \"max_rss_kb\": " << s.maxRssKb
+            << ", \"minor_faults\": " << s.minorFaults << ", \"major_faults\": " << s.majorFaults;
+        if (s.hasCounters)
+            out << ", \"cycles\": " << s.cycles << ", \"instructions\": " << s.instructions
+                << ", \"cache_misses\": " << s.cacheMisses;
+        out << "}\n";
+        return out.str();
+    }
 
-                lines.push_back({{"Options: "}});
+    static String toText(const String &command, const Sample &s)
+    {
+        std::stringstream out;
+        out << std::fixed;
+        out.precision(3);
+        out << "profile: " << command << "\n"
+            << "  wall:         " << s.wallMs << " ms\n"
+            << "  cpu:          " << s.userMs << " ms user, " << s.systemMs << " ms system\n"
+            << "  max rss:      " << s.maxRssKb << " KB\n"
+            << "  page faults:  " << s.minorFaults << " minor, " << s.majorFaults << " major\n";
+        if (s.hasCounters)
+            out << "  cycles:       " << s.cycles << "\n"
+                << "  instructions: " << s.instructions << "\n"
+                << "  cache misses: " << s.cacheMisses << "\n";
+        else
+            out << "  hardware counters unavailable\n";
+        return out.str();
+    }
 
-                auto opts = options;
-                opts.insert(opts.begin(), versionOption);
-                opts.push_back(helpOption);
-                for (const auto opt : opts)
+  private:
+#ifdef COMMANDER_CPP_HAS_PERF_EVENT
+    void openCounters()
+    {
+        const uint64_t configs[3] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+        for (int i = 0; i < 3; ++i)
+        {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            counters[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : counters[0], 0));
+            if (counters[i] < 0)
+            {
+                // 任何一个计数器打不开都放弃硬件计数，只保留 rusage 的结果
+                for (int j = 0; j < i; ++j)
                 {
-                    auto descList = TOOLS::split(getDescriptionText(opt), "\n");
-                    auto first = descList.front();
-                    lines.push_back({{getOptionText(opt)}, {first}});
-
-                    for (auto it = descList.begin() + 1; it < descList.end(); ++it)
-                    {
-                        lines.push_back({{}, {*it}});
-                    }
+                    close(counters[j]);
+                    counters[j] = -1;
                 }
-                lines.push_back({});
-            };
+                return;
+            }
+        }
+    }
 
-            auto collectCommands = [&]() {
-                if (!subCommands.empty())
-                {
-                    lines.push_back({{"Commands: "}});
-                    for (const auto cmd : subCommands)
-                    {
-                        auto descList = TOOLS::split(cmd->description(), "\n");
-                        auto first = descList.front();
-                        lines.push_back({{"  " + getUsageText(cmd)}, {first}});
+    int counters[3] = {-1, -1, -1};
+#endif
+#ifdef COMMANDER_CPP_HAS_RUSAGE
+    struct rusage usageBegin;
+#endif
+    std::chrono::steady_clock::time_point wallBegin;
+};
+
+/*
+ * @brief 固定数量线程的任务队列
+ */
+class WorkerPool
+{
+  public:
+    explicit WorkerPool(size_t threads)
+    {
+        threads = std::max<size_t>(1, threads ? threads : std::thread::hardware_concurrency());
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this] { work(); });
+    }
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        ready.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        ready.notify_one();
+    }
+
+  private:
+    void work()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return closing || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::function<void()>> tasks;
+    Vector<std::thread> workers;
+    bool closing = false;
+};
+} // namespace TOOLS
+
+class FinialRelease
+{
+  public:
+    FinialRelease(std::function<void()> release) : r(release)
+    {
+    }
+    ~FinialRelease()
+    {
+        if (r)
+            r();
+    }
+
+  private:
+    std::function<void()> r;
+};
+
+/*
+ * @brief 解析失败的原因
+ */
+enum class ErrorCode : uint8_t
+{
+    None,
+    // 选项需要值，但没有提供
+    MissingValue,
+    // 值无法转换为选项要求的类型
+    InvalidValue,
+    // 数值超出 int/double 的表示范围
+    ValueOutOfRange,
+    // 缺少必填参数
+    MissingArgument,
+    // 无法识别的标识符
+    InvalidIdentifier,
+    // 响应文件打不开、嵌套过深或引号不匹配
+    ResponseFile,
+    // 以下只作为警告，不会中断解析
+    // 未定义的选项
+    UnknownOption,
+    // 未定义的选项别名
+    UnknownAlias,
+    // 不需要值的选项通过 = 传入了值
+    UnexpectedValue,
+    // 命令没有定义参数，但传入了参数
+    UnexpectedArgument
+};
+
+inline const char *errorCodeName(ErrorCode code)
+{
+    switch (code)
+    {
+    case ErrorCode::None:
+        return "none";
+    case ErrorCode::MissingValue:
+        return "missing-value";
+    case ErrorCode::InvalidValue:
+        return "invalid-value";
+    case ErrorCode::ValueOutOfRange:
+        return "value-out-of-range";
+    case ErrorCode::MissingArgument:
+        return "missing-argument";
+    case ErrorCode::InvalidIdentifier:
+        return "invalid-identifier";
+    case ErrorCode::ResponseFile:
+        return "response-file";
+    case ErrorCode::UnknownOption:
+        return "unknown-option";
+    case ErrorCode::UnknownAlias:
+        return "unknown-alias";
+    case ErrorCode::UnexpectedValue:
+        return "unexpected-value";
+    case ErrorCode::UnexpectedArgument:
+        return "unexpected-argument";
+    }
+    return "unknown";
+}
+
+enum class Severity : uint8_t
+{
+    Warning,
+    Error
+};
+
+/*
+ * @brief 一条紧凑的诊断记录，只保存错误码、下标和驻留名称，文本只在需要时才格式化
+ */
+struct Diagnostic
+{
+    ErrorCode code = ErrorCode::None;
+    Severity severity = Severity::Error;
+    // argv 下标，-1 表示和具体的 token 无关；启用响应文件时指向展开后的 token
+    int index = -1;
+    // 所在命令的驻留名称，可以直接比较指针
+    const String *command = nullptr;
+    // 相关选项或参数的驻留名称，没有时为空
+    const String *name = nullptr;
+    // 多值选项中出错的元素下标，或者别名组合中出错的别名位置
+    int element = -1;
+
+    /*
+     * @brief 格式化诊断信息
+     * @param token index 处的原始 token，没有时传空
+     */
+    String message(const char *token = nullptr) const
+    {
+        String tok = token ? token : "";
+        String target = name ? *name : String();
+        // "--opt=value" 中的 value
+        auto valueOf = [&]() {
+            size_t eq = tok.find('=');
+            return !tok.empty() && tok[0] == '-' && eq != String::npos ? tok.substr(eq + 1) : tok;
+        };
+
+        switch (code)
+        {
+        case ErrorCode::MissingValue:
+            return "option: " + target + " need a value, but got zero.";
+        case ErrorCode::InvalidValue:
+            return "option: " + target + " got an invalid value at index " + std::to_string(element < 0 ? 0 : element) +
+                   ": " + valueOf();
+        case ErrorCode::ValueOutOfRange:
+            return name ? "option: " + target + " got an out of range value: " + valueOf()
+                        : tok + " is not a valid argument value";
+        case ErrorCode::MissingArgument:
+            return "Command: " + (command ? *command : String()) + "'s argument: " + target +
+                   " is required, but got empty.";
+        case ErrorCode::InvalidIdentifier:
+            return "invalid identifier: " + tok;
+        case ErrorCode::ResponseFile:
+            return "response file could not be expanded";
+        case ErrorCode::UnknownOption: {
+            size_t begin = std::min(tok.find_first_not_of('-'), tok.size());
+            return "unknown option: " + tok.substr(begin, tok.find('=') == String::npos ? String::npos
+                                                                                           : tok.find('=') - begin);
+        }
+        case ErrorCode::UnknownAlias:
+            return "option alias " +
+                   (element >= 0 && static_cast<size_t>(element) + 1 < tok.size() ? tok.substr(element + 1, 1) : tok) +
+                   " not found";
+        case ErrorCode::UnexpectedValue:
+            return "option: " + target + " does not need a value, but got: " + valueOf();
+        case ErrorCode::UnexpectedArgument:
+            return "unknown identifier: " + tok;
+        default:
+            return String();
+        }
+    }
+};
+
+class Logger
+{
+  public:
+    virtual ~Logger()
+    {
+    }
+    virtual Logger *debug(const String &msg)
+    {
+        return this;
+    };
+    virtual Logger *warn(const String &msg)
+    {
+        return this;
+    };
+    virtual Logger *error(const String &msg)
+    {
+        return this;
+    };
+    virtual Logger *print(const String &msg) = 0;
+    /*
+     * @brief 解析过程中的警告和错误，默认格式化后交给 warn/error；
+     *        只关心错误码的实现可以重写它来避免格式化字符串
+     * @param token 诊断对应的原始 token，没有时为空
+     */
+    virtual Logger *diagnostic(const Diagnostic &d, const char *token)
+    {
+        return d.severity == Severity::Error ? error(d.message(token)) : warn(d.message(token));
+    }
+};
+
+class LoggerDefaultImpl : public Logger
+{
+  public:
+    virtual Logger *print(const String &msg) override
+    {
+        std::cout << msg << std::endl;
+        return this;
+    };
+};
+
+/*
+ * @brief 构造和解析过程划分的阶段，用于按阶段统计内存分配和耗时
+ */
+enum class Phase : uint8_t
+{
+    Other,
+    Construct,
+    // 识别 token 是命令、选项还是参数
+    Tokenize,
+    // 查找选项和子命令
+    Lookup,
+    // 值转换
+    Convert,
+    // 必填参数检查
+    Validate,
+    // 版本、帮助选项的处理和调用 action 前的准备
+    Dispatch,
+    // action 自身的执行
+    Action,
+    Help,
+    Count
+};
+
+inline const char *phaseName(Phase phase)
+{
+    switch (phase)
+    {
+    case Phase::Construct:
+        return "construct";
+    case Phase::Tokenize:
+        return "tokenize";
+    case Phase::Lookup:
+        return "lookup";
+    case Phase::Convert:
+        return "convert";
+    case Phase::Validate:
+        return "validate";
+    case Phase::Dispatch:
+        return "dispatch";
+    case Phase::Action:
+        return "action";
+    case Phase::Help:
+        return "help";
+    default:
+        return "other";
+    }
+}
+
+#ifdef COMMANDER_CPP_ALLOC_TRACKING
+/*
+ * @brief 按阶段统计堆内存分配的次数和字节数
+ *        需要在一个编译单元中使用 COMMANDER_CPP_DEFINE_ALLOC_HOOKS() 替换全局 operator new
+ *        预热后 Tokenize、Lookup、Validate、Dispatch 阶段保证不分配，Convert 只有字符串和列表值需要分配
+ */
+class AllocStats
+{
+  public:
+    struct Counter
+    {
+        uint64_t count = 0;
+        uint64_t bytes = 0;
+    };
+
+    /*
+     * @brief 当前线程所处的阶段
+     */
+    static Phase &current()
+    {
+        thread_local Phase phase = Phase::Other;
+        return phase;
+    }
+    static void record(size_t bytes)
+    {
+        Slot &slot = slots()[static_cast<size_t>(current())];
+        slot.count.fetch_add(1, std::memory_order_relaxed);
+        slot.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    static Counter get(Phase phase)
+    {
+        const Slot &slot = slots()[static_cast<size_t>(phase)];
+        return {slot.count.load(std::memory_order_relaxed), slot.bytes.load(std::memory_order_relaxed)};
+    }
+    static Counter total()
+    {
+        Counter sum;
+        for (size_t i = 0; i < static_cast<size_t>(Phase::Count); ++i)
+        {
+            Counter c = get(static_cast<Phase>(i));
+            sum.count += c.count;
+            sum.bytes += c.bytes;
+        }
+        return sum;
+    }
+    static void reset()
+    {
+        for (size_t i = 0; i < static_cast<size_t>(Phase::Count); ++i)
+        {
+            slots()[i].count.store(0, std::memory_order_relaxed);
+            slots()[i].bytes.store(0, std::memory_order_relaxed);
+        }
+    }
+
+  private:
+    struct Slot
+    {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+    static Slot *slots()
+    {
+        static Slot table[static_cast<size_t>(Phase::Count)];
+        return table;
+    }
+};
+
+#if defined(__cpp_exceptions)
+#define COMMANDER_CPP_ALLOC_FAILED() throw std::bad_alloc()
+#else
+#define COMMANDER_CPP_ALLOC_FAILED() std::abort()
+#endif
+
+// 替换全局 operator new/delete，只能在一个编译单元的全局作用域中使用一次
+// new 用 malloc 分配、delete 用 free 释放，内联后 GCC 会误报 -Wmismatched-new-delete，这里局部关闭
+#define COMMANDER_CPP_DEFINE_ALLOC_HOOKS()                                                                             \
+    _Pragma("GCC diagnostic push")                                                                                     \
+    _Pragma("GCC diagnostic ignored \"-Wmismatched-new-delete\"")                                                      \
+    void *operator new(std::size_t size)                                                                               \
+    {                                                                                                                  \
+        COMMANDER_CPP::AllocStats::record(size);                                                                       \
+        if (void *p = std::malloc(size ? size : 1))                                                                    \
+            return p;                                                                                                  \
+        COMMANDER_CPP_ALLOC_FAILED();                                                                                  \
+    }                                                                                                                  \
+    void *operator new[](std::size_t size)                                                                             \
+    {                                                                                                                  \
+        return ::operator new(size);                                                                                   \
+    }                                                                                                                  \
+    void operator delete(void *p) noexcept                                                                             \
+    {                                                                                                                  \
+        std::free(p);                                                                                                  \
+    }                                                                                                                  \
+    void operator delete[](void *p) noexcept                                                                           \
+    {                                                                                                                  \
+        std::free(p);                                                                                                  \
+    }                                                                                                                  \
+    void operator delete(void *p, std::size_t) noexcept                                                                \
+    {                                                                                                                  \
+        std::free(p);                                                                                                  \
+    }                                                                                                                  \
+    void operator delete[](void *p, std::size_t) noexcept                                                              \
+    {                                                                                                                  \
+        std::free(p);                                                                                                  \
+    }                                                                                                                  \
+    _Pragma("GCC diagnostic pop")
+#endif
+
+// Command 始终持有 Profiler 指针，不同编译单元对宏的设置不一致时对象布局也相同
+class Profiler;
+
+#ifdef COMMANDER_CPP_ENABLE_PROFILER
+/*
+ * @brief 解析阶段的计时接口，和 Logger 一样注入到 Command 中
+ *        只有定义了 COMMANDER_CPP_ENABLE_PROFILER 才会编译和记录，否则设置的 Profiler 不会被调用
+ */
+class Profiler
+{
+  public:
+    virtual ~Profiler()
+    {
+    }
+    /*
+     * @brief 一个阶段结束时调用，时间戳为 steady_clock 的纳秒数，嵌套的阶段各自记录
+     */
+    virtual void record(Phase phase, uint64_t beginNs, uint64_t endNs) = 0;
+    /*
+     * @brief 一个命令（包括每一层子命令）解析结束时调用，name 是驻留的名称，在进程生命周期内有效
+     */
+    virtual void command(const String &name, uint64_t beginNs, uint64_t endNs)
+    {
+    }
+
+    static uint64_t now()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    /*
+     * @brief 当前线程正在使用的 Profiler，由 Command::parse 设置
+     */
+    static Profiler *&active()
+    {
+        thread_local Profiler *profiler = nullptr;
+        return profiler;
+    }
+
+    /*
+     * @brief 在作用域内安装 Profiler，为空时沿用外层的 Profiler
+     */
+    class Install
+    {
+      public:
+        explicit Install(Profiler *profiler) : previous(active())
+        {
+            if (profiler)
+                active() = profiler;
+        }
+        ~Install()
+        {
+            active() = previous;
+        }
+        Install(const Install &) = delete;
+        Install &operator=(const Install &) = delete;
+
+      private:
+        Profiler *previous;
+    };
+
+    /*
+     * @brief 记录一个命令从开始解析到 action 结束的区间
+     */
+    class CommandSpan
+    {
+      public:
+        explicit CommandSpan(const String &name) : profiler(active()), name(name)
+        {
+            if (profiler)
+                begin = now();
+        }
+        ~CommandSpan()
+        {
+            if (profiler)
+                profiler->command(name, begin, now());
+        }
+        CommandSpan(const CommandSpan &) = delete;
+        CommandSpan &operator=(const CommandSpan &) = delete;
+
+      private:
+        Profiler *profiler;
+        const String &name;
+        uint64_t begin = 0;
+    };
+};
+
+/*
+ * @brief 按阶段聚合耗时直方图，适合批量执行或 REPL 会话中观察 p99
+ *        桶按 2 的幂划分，每个幂再分 8 个子桶，相对误差不超过 12.5%
+ */
+class HistogramProfiler : public Profiler
+{
+  public:
+    static constexpr size_t BucketCount = 8 + 61 * 8;
+
+    virtual void record(Phase phase, uint64_t beginNs, uint64_t endNs) override
+    {
+        uint64_t ns = endNs > beginNs ? endNs - beginNs : 0;
+        Slot &slot = slots[static_cast<size_t>(phase)];
+        slot.buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+        slot.count.fetch_add(1, std::memory_order_relaxed);
+        slot.sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = slot.max.load(std::memory_order_relaxed);
+        while (ns > max && !slot.max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t count(Phase phase) const
+    {
+        return slots[static_cast<size_t>(phase)].count.load(std::memory_order_relaxed);
+    }
+    uint64_t totalNs(Phase phase) const
+    {
+        return slots[static_cast<size_t>(phase)].sum.load(std::memory_order_relaxed);
+    }
+    uint64_t maxNs(Phase phase) const
+    {
+        return slots[static_cast<size_t>(phase)].max.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * @brief 百分位耗时（纳秒），返回所在桶的上界，p 取值 0~100
+     */
+    uint64_t percentile(Phase phase, double p) const
+    {
+        const Slot &slot = slots[static_cast<size_t>(phase)];
+        uint64_t total = slot.count.load(std::memory_order_relaxed);
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(std::max(1.0, p / 100.0 * total + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i)
+        {
+            seen += slot.buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(bucketUpper(i), maxNs(phase));
+        }
+        return maxNs(phase);
+    }
+
+    void reset()
+    {
+        for (auto &slot : slots)
+        {
+            for (auto &bucket : slot.buckets)
+                bucket.store(0, std::memory_order_relaxed);
+            slot.count.store(0, std::memory_order_relaxed);
+            slot.sum.store(0, std::memory_order_relaxed);
+            slot.max.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /*
+     * @brief 每个有数据的阶段输出一行：次数、平均、p50、p90、p99 和最大耗时（微秒）
+     */
+    String report() const
+    {
+        std::stringstream out;
+        out << std::fixed;
+        out.precision(3);
+        out << "phase      count      mean(us)   p50(us)    p90(us)    p99(us)    max(us)\n";
+        for (size_t i = 0; i < static_cast<size_t>(Phase::Count); ++i)
+        {
+            Phase phase = static_cast<Phase>(i);
+            uint64_t n = count(phase);
+            if (n == 0)
+                continue;
+            String name = phaseName(phase);
+            out << name << String(name.size() < 11 ? 11 - name.size() : 1, ' ');
+            String countText = std::to_string(n);
+            out << countText << String(countText.size() < 11 ? 11 - countText.size() : 1, ' ');
+            for (double ns : {static_cast<double>(totalNs(phase)) / n, static_cast<double>(percentile(phase, 50)),
+                              static_cast<double>(percentile(phase, 90)), static_cast<double>(percentile(phase, 99)),
+                              static_cast<double>(maxNs(phase))})
+            {
+                std::stringstream cell;
+                cell << std::fixed;
+                cell.precision(3);
+                cell << ns / 1000.0;
+                out << cell.str() << String(cell.str().size() < 11 ? 11 - cell.str().size() : 1, ' ');
+            }
+            out << "\n";
+        }
+        return out.str();
+    }
+
+    static size_t bucketIndex(uint64_t ns)
+    {
+        if (ns < 8)
+            return static_cast<size_t>(ns);
+        int exp = 63;
+        while (!(ns >> exp))
+            --exp;
+        return static_cast<size_t>((exp - 2) * 8 + ((ns >> (exp - 3)) & 7));
+    }
+    static uint64_t bucketUpper(size_t index)
+    {
+        if (index < 8)
+            return index;
+        int exp = static_cast<int>(index / 8) + 2;
+        uint64_t lower = (8 + index % 8) << (exp - 3);
+        return lower + (uint64_t(1) << (exp - 3)) - 1;
+    }
+
+  private:
+    struct Slot
+    {
+        std::atomic<uint64_t> buckets[BucketCount] = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+    Slot slots[static_cast<size_t>(Phase::Count)];
+};
+
+/*
+ * @brief 把解析阶段、每一层子命令和 action 记录到内存中，导出为 Chrome/Perfetto 可读的 trace_event JSON
+ *        指定文件名时在析构时写入文件，也可以随时调用 write/json 导出
+ */
+class TraceRecorder : public Profiler
+{
+  public:
+    explicit TraceRecorder(const String &path = String(), size_t maxEvents = 1 << 20)
+        : path(path), maxEvents(maxEvents), origin(now())
+    {
+    }
+    ~TraceRecorder()
+    {
+        if (!path.empty())
+            write(path);
+    }
+
+    virtual void record(Phase phase, uint64_t beginNs, uint64_t endNs) override
+    {
+        push({phaseName(phase), nullptr, beginNs, endNs, threadIndex()});
+    }
+    virtual void command(const String &name, uint64_t beginNs, uint64_t endNs) override
+    {
+        push({nullptr, &name, beginNs, endNs, threadIndex()});
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return events.size();
+    }
+    /*
+     * @brief 缓冲区满后丢弃的事件数
+     */
+    size_t dropped() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return droppedEvents;
+    }
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.clear();
+        droppedEvents = 0;
+    }
+
+    String json() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::stringstream out;
+        out << std::fixed;
+        out.precision(3);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        for (size_t i = 0; i < events.size(); ++i)
+        {
+            const Event &e = events[i];
+            out << (i ? ",\n" : "\n") << "{\"name\":\"" << (e.phase ? String(e.phase) : escape(*e.command))
+                << "\",\"cat\":\"" << (e.phase ? "phase" : "command") << "\",\"ph\":\"X\",\"ts\":"
+                << (e.begin - std::min(e.begin, origin)) / 1000.0 << ",\"dur\":" << (e.end - e.begin) / 1000.0
+                << ",\"pid\":1,\"tid\":" << e.thread << "}";
+        }
+        out << "\n]}\n";
+        return out.str();
+    }
+    bool write(const String &file) const
+    {
+        std::ofstream out(file, std::ios::binary);
+        out << json();
+        return static_cast<bool>(out);
+    }
+
+  private:
+    struct Event
+    {
+        const char *phase;
+        const String *command;
+        uint64_t begin;
+        uint64_t end;
+        uint32_t thread;
+    };
+
+    void push(const Event &event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (events.size() >= maxEvents)
+        {
+            ++droppedEvents;
+            return;
+        }
+        events.push_back(event);
+    }
+    static uint32_t threadIndex()
+    {
+        static std::atomic<uint32_t> next{1};
+        thread_local uint32_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+    static String escape(const String &text)
+    {
+        String out;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out.push_back('\\');
+            out.push_back(c);
+        }
+        return out;
+    }
+
+    String path;
+    size_t maxEvents;
+    uint64_t origin;
+    mutable std::mutex mutex;
+    Vector<Event> events;
+    size_t droppedEvents = 0;
+};
+#endif
+
+#if defined(COMMANDER_CPP_ALLOC_TRACKING) || defined(COMMANDER_CPP_ENABLE_PROFILER)
+/*
+ * @brief 标记一个阶段：统计内存分配时切换当前线程的阶段，开启 Profiler 时记录阶段耗时
+ */
+class PhaseScope
+{
+  public:
+    explicit PhaseScope(Phase phase)
+    {
+#ifdef COMMANDER_CPP_ALLOC_TRACKING
+        previous = AllocStats::current();
+        AllocStats::current() = phase;
+#endif
+#ifdef COMMANDER_CPP_ENABLE_PROFILER
+        profiler = Profiler::active();
+        if (profiler)
+        {
+            this->phase = phase;
+            begin = Profiler::now();
+        }
+#endif
+    }
+    ~PhaseScope()
+    {
+#ifdef COMMANDER_CPP_ENABLE_PROFILER
+        if (profiler)
+            profiler->record(phase, begin, Profiler::now());
+#endif
+#ifdef COMMANDER_CPP_ALLOC_TRACKING
+        AllocStats::current() = previous;
+#endif
+    }
+    PhaseScope(const PhaseScope &) = delete;
+    PhaseScope &operator=(const PhaseScope &) = delete;
+
+  private:
+#ifdef COMMANDER_CPP_ALLOC_TRACKING
+    Phase previous;
+#endif
+#ifdef COMMANDER_CPP_ENABLE_PROFILER
+    Profiler *profiler;
+    Phase phase = Phase::Other;
+    uint64_t begin = 0;
+#endif
+};
+
+#define COMMANDER_CPP_PHASE_CONCAT_(a, b) a##b
+#define COMMANDER_CPP_PHASE_CONCAT(a, b) COMMANDER_CPP_PHASE_CONCAT_(a, b)
+#define COMMANDER_CPP_PHASE(phase)                                                                                     \
+    COMMANDER_CPP::PhaseScope COMMANDER_CPP_PHASE_CONCAT(commanderCppPhase, __LINE__)(phase)
+#else
+// 未开启统计和 Profiler 时阶段标记不产生任何代码
+#define COMMANDER_CPP_PHASE(phase) ((void)0)
+#endif
+
+/*
+ * @brief 全局名称驻留表，相同的名称只保存一份，名称之间的比较只需比较指针
+ */
+class NameTable
+{
+  public:
+    using Id = const String *;
+
+    /*
+     * @brief 驻留名称，返回名称唯一的 Id
+     */
+    static Id intern(std::string_view name)
+    {
+        NameTable &table = instance();
+        {
+            std::shared_lock<std::shared_mutex> lock(table.mutex);
+            auto it = table.index.find(name);
+            if (it != table.index.end())
+                return it->second;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(table.mutex);
+        auto it = table.index.find(name);
+        if (it != table.index.end())
+            return it->second;
+
+        // deque 扩容时不移动已有元素，key 可以直接引用存储中的字符串
+        table.storage.emplace_back(name);
+        Id id = &table.storage.back();
+        table.index.emplace(std::string_view(*id), id);
+        return id;
+    }
+
+    /*
+     * @brief 查找名称但不驻留，名称从未被驻留过时返回 nullptr
+     */
+    static Id find(std::string_view name)
+    {
+        NameTable &table = instance();
+        std::shared_lock<std::shared_mutex> lock(table.mutex);
+        auto it = table.index.find(name);
+        return it != table.index.end() ? it->second : nullptr;
+    }
+
+  private:
+    static NameTable &instance()
+    {
+        static NameTable table;
+        return table;
+    }
+
+    std::shared_mutex mutex;
+    std::deque<String> storage;
+    std::unordered_map<std::string_view, Id> index;
+};
+
+/*
+ * @brief 驻留后的名称，相等比较只比较指针
+ */
+class Name
+{
+  public:
+    Name() = default;
+    Name(std::string_view name) : nameId(name.empty() ? nullptr : NameTable::intern(name))
+    {
+    }
+    Name(const String &name) : Name(std::string_view(name))
+    {
+    }
+    Name(const char *name) : Name(std::string_view(name))
+    {
+    }
+
+    const String &str() const
+    {
+        static const String empty;
+        return nameId ? *nameId : empty;
+    }
+    NameTable::Id id() const
+    {
+        return nameId;
+    }
+    bool empty() const
+    {
+        return nameId == nullptr;
+    }
+    bool operator==(const Name &other) const
+    {
+        return nameId == other.nameId;
+    }
+    bool operator!=(const Name &other) const
+    {
+        return nameId != other.nameId;
+    }
+
+  private:
+    NameTable::Id nameId = nullptr;
+};
+
+class Options
+{
+  public:
+    Map<String, Variant> opts;
+
+    inline bool hasOption(const String &name)
+    {
+        return opts.find(name) != opts.end();
+    }
+
+    template <typename T> inline T getValue(const String &name, T defaultValue)
+    {
+        auto it = opts.find(name);
+        if (opts.find(name) == opts.end())
+        {
+            return defaultValue;
+        }
+        T *v = std::get_if<T>(&it->second);
+        return v ? *v : defaultValue;
+    }
+};
+
+/*
+ * @brief 紧凑的值单元，固定 16 字节：15 字节负载 + 1 字节标签
+ *        不超过 15 字节的字符串内联存储，string_view 不持有内存，只有长字符串和列表放在堆上
+ */
+class CompactValue
+{
+  public:
+    enum class Kind : uint8_t
+    {
+        Empty,
+        Int,
+        Double,
+        Bool,
+        String,
+        List
+    };
+
+    CompactValue()
+    {
+        std::memset(storage, 0, sizeof(storage));
+    }
+    CompactValue(int64_t v) : CompactValue()
+    {
+        store(Int, v);
+    }
+    CompactValue(int v) : CompactValue(static_cast<int64_t>(v))
+    {
+    }
+    CompactValue(double v) : CompactValue()
+    {
+        store(Double, v);
+    }
+    CompactValue(bool v) : CompactValue()
+    {
+        store(Bool, v);
+    }
+    CompactValue(std::string_view v) : CompactValue()
+    {
+        if (v.size() <= sizeof(storage))
+        {
+            std::memcpy(storage, v.data(), v.size());
+            tag = static_cast<uint8_t>(InlineString | (v.size() << 4));
+            return;
+        }
+
+        char *p = new char[v.size()];
+        std::memcpy(p, v.data(), v.size());
+        storeHeap(HeapString, p, v.size());
+    }
+    CompactValue(const String &v) : CompactValue(std::string_view(v))
+    {
+    }
+    CompactValue(const char *v) : CompactValue(std::string_view(v))
+    {
+    }
+    CompactValue(const CompactValue &other) : CompactValue()
+    {
+        copyFrom(other);
+    }
+    CompactValue(CompactValue &&other) noexcept
+    {
+        std::memcpy(storage, other.storage, sizeof(storage));
+        tag = other.tag;
+        other.tag = Empty;
+    }
+    CompactValue &operator=(const CompactValue &other)
+    {
+        if (this != &other)
+        {
+            release();
+            copyFrom(other);
+        }
+        return *this;
+    }
+    CompactValue &operator=(CompactValue &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            std::memcpy(storage, other.storage, sizeof(storage));
+            tag = other.tag;
+            other.tag = Empty;
+        }
+        return *this;
+    }
+    ~CompactValue()
+    {
+        release();
+    }
+
+    /*
+     * @brief 构造不持有内存的字符串值，调用者需保证 v 指向的内存比值活得久
+     */
+    static CompactValue view(std::string_view v)
+    {
+        CompactValue value;
+        value.storeHeap(ViewString, const_cast<char *>(v.data()), v.size());
+        return value;
+    }
+
+    /*
+     * @brief 构造列表值，elementType 决定 toVariant 还原成哪种列表
+     */
+    static CompactValue list(Vector<CompactValue> items, ValueType elementType)
+    {
+        CompactValue value;
+        value.storeHeap(List, reinterpret_cast<char *>(new ListBlock{std::move(items), elementType}), 0);
+        return value;
+    }
+
+    static CompactValue fromVariant(const Variant &v)
+    {
+        struct Visitor
+        {
+            CompactValue operator()(std::monostate) const
+            {
+                return CompactValue();
+            }
+            CompactValue operator()(int v) const
+            {
+                return CompactValue(v);
+            }
+            CompactValue operator()(double v) const
+            {
+                return CompactValue(v);
+            }
+            CompactValue operator()(const String &v) const
+            {
+                return CompactValue(v);
+            }
+            CompactValue operator()(bool v) const
+            {
+                return CompactValue(v);
+            }
+            CompactValue operator()(const std::vector<VariantBase> &v) const
+            {
+                return makeList(v, ValueType::Auto, [](const VariantBase &e) { return std::visit(Visitor(), e); });
+            }
+            CompactValue operator()(const Int64List &v) const
+            {
+                return makeList(v, ValueType::Int64, [](int64_t e) { return CompactValue(e); });
+            }
+            CompactValue operator()(const DoubleList &v) const
+            {
+                return makeList(v, ValueType::Double, [](double e) { return CompactValue(e); });
+            }
+            CompactValue operator()(const StringViewList &v) const
+            {
+                return makeList(v, ValueType::StringView, [](std::string_view e) { return CompactValue::view(e); });
+            }
+        };
+        return std::visit(Visitor(), v);
+    }
+
+    /*
+     * @brief 转换回 Variant，超出 int 范围的整数转换为 double，列表按原来的元素类型还原
+     */
+    Variant toVariant() const
+    {
+        switch (kind())
+        {
+        case Kind::Int:
+        case Kind::Double:
+        case Kind::Bool:
+        case Kind::String:
+            return std::visit([](auto &&x) { return Variant(x); }, toVariantBase());
+        case Kind::List: {
+            const ListBlock *block = list();
+            switch (block->elementType)
+            {
+            case ValueType::Int64:
+                return Variant(collect<int64_t>(block, [](const CompactValue &item) { return item.toInt(); }));
+            case ValueType::Double:
+                return Variant(collect<double>(block, [](const CompactValue &item) { return item.toDouble(); }));
+            case ValueType::StringView:
+                return Variant(
+                    collect<std::string_view>(block, [](const CompactValue &item) { return item.toStringView(); }));
+            default:
+                return Variant(
+                    collect<VariantBase>(block, [](const CompactValue &item) { return item.toVariantBase(); }));
+            }
+        }
+        default:
+            return Variant();
+        }
+    }
+
+    Kind kind() const
+    {
+        switch (tag & 0x0f)
+        {
+        case Int:
+            return Kind::Int;
+        case Double:
+            return Kind::Double;
+        case Bool:
+            return Kind::Bool;
+        case InlineString:
+        case HeapString:
+        case ViewString:
+            return Kind::String;
+        case List:
+            return Kind::List;
+        default:
+            return Kind::Empty;
+        }
+    }
+    bool isEmpty() const
+    {
+        return kind() == Kind::Empty;
+    }
+    int64_t toInt() const
+    {
+        return tag == Int ? load<int64_t>() : 0;
+    }
+    double toDouble() const
+    {
+        return tag == Double ? load<double>() : 0.0;
+    }
+    bool toBool() const
+    {
+        return tag == Bool ? load<bool>() : false;
+    }
+    std::string_view toStringView() const
+    {
+        if ((tag & 0x0f) == InlineString)
+            return std::string_view(reinterpret_cast<const char *>(storage), tag >> 4);
+        if (kind() == Kind::String)
+            return std::string_view(load<char *>(), heapSize());
+        return std::string_view();
+    }
+    size_t size() const
+    {
+        return tag == List ? list()->items.size() : 0;
+    }
+    const CompactValue &at(size_t index) const
+    {
+        return list()->items[index];
+    }
+
+  private:
+    // 标签低 4 位是存储方式，内联字符串的长度放在高 4 位
+    enum Rep : uint8_t
+    {
+        Empty,
+        Int,
+        Double,
+        Bool,
+        InlineString,
+        HeapString,
+        ViewString,
+        List
+    };
+    struct ListBlock
+    {
+        Vector<CompactValue> items;
+        ValueType elementType;
+    };
+
+    template <typename L, typename F> static CompactValue makeList(const L &source, ValueType elementType, F convert)
+    {
+        Vector<CompactValue> items;
+        items.reserve(source.size());
+        for (const auto &e : source)
+            items.push_back(convert(e));
+        return list(std::move(items), elementType);
+    }
+    template <typename T, typename F> static Vector<T> collect(const ListBlock *block, F convert)
+    {
+        Vector<T> out;
+        out.reserve(block->items.size());
+        for (const auto &item : block->items)
+            out.push_back(convert(item));
+        return out;
+    }
+
+    template <typename T> void store(Rep rep, T v)
+    {
+        std::memcpy(storage, &v, sizeof(T));
+        tag = rep;
+    }
+    template <typename T> T load() const
+    {
+        T v;
+        std::memcpy(&v, storage, sizeof(T));
+        return v;
+    }
+    // 指针之后的字节按低位在前逐字节保存长度，与平台字节序无关
+    void storeHeap(Rep rep, char *p, size_t size)
+    {
+        std::memcpy(storage, &p, sizeof(p));
+        uint64_t n = size;
+        for (size_t i = sizeof(p); i < sizeof(storage); ++i, n >>= 8)
+            storage[i] = static_cast<unsigned char>(n & 0xff);
+        tag = rep;
+    }
+    size_t heapSize() const
+    {
+        uint64_t n = 0;
+        for (size_t i = sizeof(storage); i-- > sizeof(char *);)
+            n = (n << 8) | storage[i];
+        return static_cast<size_t>(n);
+    }
+    ListBlock *list() const
+    {
+        return reinterpret_cast<ListBlock *>(load<char *>());
+    }
+    VariantBase toVariantBase() const
+    {
+        switch (kind())
+        {
+        case Kind::Int: {
+            int64_t v = toInt();
+            if (v >= std::numeric_limits<int>::min() && v <= std::numeric_limits<int>::max())
+                return VariantBase(static_cast<int>(v));
+            return VariantBase(static_cast<double>(v));
+        }
+        case Kind::Double:
+            return VariantBase(toDouble());
+        case Kind::Bool:
+            return VariantBase(toBool());
+        case Kind::String:
+            return VariantBase(String(toStringView()));
+        default:
+            return VariantBase();
+        }
+    }
+    void copyFrom(const CompactValue &other)
+    {
+        if (other.tag == HeapString)
+        {
+            *this = CompactValue(other.toStringView());
+            return;
+        }
+        if (other.tag == List)
+        {
+            const ListBlock *block = other.list();
+            CompactValue value;
+            value.storeHeap(List, reinterpret_cast<char *>(new ListBlock(*block)), 0);
+            *this = std::move(value);
+            return;
+        }
+        std::memcpy(storage, other.storage, sizeof(storage));
+        tag = other.tag;
+    }
+    void release()
+    {
+        if (tag == HeapString)
+            delete[] load<char *>();
+        else if (tag == List)
+            delete list();
+        tag = Empty;
+    }
+
+    unsigned char storage[15];
+    uint8_t tag = Empty;
+};
+static_assert(sizeof(CompactValue) == 16, "CompactValue must stay 16 bytes");
+// 参数和选项值以 CompactValue 存储，通过 Command::compactAction 设置
+using CompactAction =
+    std::function<void(class Command *cmd, Vector<CompactValue> args, Map<String, CompactValue> opts)>;
+
+/*
+ * @brief 二进制命令树 schema：文件头 + 命令表 + 选项表 + 参数表 + 子命令索引 + 字符串池
+ *        所有记录定长且按 8 字节对齐，映射文件后直接按下标访问，不需要反序列化
+ */
+class Schema
+{
+  public:
+    static constexpr uint32_t Version = 1;
+    static constexpr uint32_t None = 0xFFFFFFFFu;
+
+    enum class ValueKind : uint8_t
+    {
+        None,
+        Int,
+        Double,
+        String,
+        Bool
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        // 文件头之后全部字节的校验和
+        uint64_t checksum;
+        uint64_t fileSize;
+        uint32_t commandCount;
+        uint32_t optionCount;
+        uint32_t argumentCount;
+        uint32_t stringBytes;
+        // 根命令共享的内置选项，None 表示没有
+        uint32_t versionOption;
+        uint32_t helpOption;
+        uint32_t profileOption;
+        // 子命令索引表的条目数
+        uint32_t childCount;
+    };
+    struct CommandRecord
+    {
+        uint32_t name;
+        uint32_t description;
+        uint32_t firstOption;
+        uint32_t optionCount;
+        uint32_t firstArgument;
+        uint32_t argumentCount;
+        // 命令按层序存储，子命令是 [firstChild, firstChild + childCount) 的连续区间，保持注册顺序
+        uint32_t firstChild;
+        uint32_t childCount;
+        // 子命令索引表中按名称排序的区间起点，用于二分查找
+        uint32_t sortedChildren;
+        uint32_t reserved;
+    };
+    struct ValueRecord
+    {
+        uint64_t bits;
+        ValueKind kind;
+        uint8_t reserved[7];
+    };
+    struct OptionRecord
+    {
+        uint32_t name;
+        uint32_t alias;
+        uint32_t valueName;
+        uint32_t description;
+        uint8_t multiValue;
+        uint8_t valueIsRequired;
+        uint8_t elementType;
+        uint8_t reserved[5];
+        ValueRecord defaultValue;
+    };
+    struct ArgumentRecord
+    {
+        uint32_t name;
+        uint32_t description;
+        uint8_t isMultiValue;
+        uint8_t valueIsRequired;
+        uint8_t reserved[6];
+        ValueRecord defaultValue;
+    };
+
+    /*
+     * @brief 按层序逐条写入记录，最后生成完整的文件内容
+     */
+    class Writer
+    {
+      public:
+        Writer()
+        {
+            // 偏移 0 固定为空字符串
+            strings.resize(sizeof(uint32_t) + 1, '\0');
+        }
+
+        uint32_t string(std::string_view text)
+        {
+            if (text.empty())
+                return 0;
+            auto it = stringIndex.find(String(text));
+            if (it != stringIndex.end())
+                return it->second;
+            uint32_t offset = static_cast<uint32_t>(strings.size());
+            uint32_t size = static_cast<uint32_t>(text.size());
+            strings.append(reinterpret_cast<const char *>(&size), sizeof(size));
+            strings.append(text.data(), text.size());
+            strings.push_back('\0');
+            stringIndex.emplace(String(text), offset);
+            return offset;
+        }
+        void value(const Variant &v, ValueRecord &out)
+        {
+            std::memset(&out, 0, sizeof(out));
+            if (auto p = std::get_if<int>(&v))
+            {
+                out.kind = ValueKind::Int;
+                out.bits = static_cast<uint64_t>(static_cast<int64_t>(*p));
+            }
+            else if (auto p = std::get_if<double>(&v))
+            {
+                out.kind = ValueKind::Double;
+                std::memcpy(&out.bits, p, sizeof(double));
+            }
+            else if (auto p = std::get_if<String>(&v))
+            {
+                out.kind = ValueKind::String;
+                out.bits = string(*p);
+            }
+            else if (auto p = std::get_if<bool>(&v))
+            {
+                out.kind = ValueKind::Bool;
+                out.bits = *p ? 1 : 0;
+            }
+            // 列表类型的默认值不写入 schema
+        }
+
+        Vector<CommandRecord> commands;
+        Vector<OptionRecord> options;
+        Vector<ArgumentRecord> arguments;
+        Vector<uint32_t> sortedChildren;
+        uint32_t versionOption = None;
+        uint32_t helpOption = None;
+        uint32_t profileOption = None;
+
+        /*
+         * @brief 生成文件内容，需要在所有命令的子命令区间确定后调用
+         */
+        String finish()
+        {
+            // 子命令索引按名称排序，查找时可以直接二分
+            sortedChildren.clear();
+            for (auto &cmd : commands)
+            {
+                cmd.sortedChildren = static_cast<uint32_t>(sortedChildren.size());
+                size_t begin = sortedChildren.size();
+                for (uint32_t i = 0; i < cmd.childCount; ++i)
+                    sortedChildren.push_back(cmd.firstChild + i);
+                std::sort(sortedChildren.begin() + begin, sortedChildren.end(), [this](uint32_t a, uint32_t b) {
+                    return text(commands[a].name) < text(commands[b].name);
+                });
+            }
+            while (strings.size() % 8)
+                strings.push_back('\0');
+
+            Header header;
+            std::memset(&header, 0, sizeof(header));
+            std::memcpy(header.magic, Magic, sizeof(header.magic));
+            header.version = Version;
+            header.headerSize = sizeof(Header);
+            header.commandCount = static_cast<uint32_t>(commands.size());
+            header.optionCount = static_cast<uint32_t>(options.size());
+            header.argumentCount = static_cast<uint32_t>(arguments.size());
+            header.stringBytes = static_cast<uint32_t>(strings.size());
+            header.versionOption = versionOption;
+            header.helpOption = helpOption;
+            header.profileOption = profileOption;
+            header.childCount = static_cast<uint32_t>(sortedChildren.size());
+
+            String out(sizeof(Header), '\0');
+            auto append = [&out](const void *data, size_t size) {
+                out.append(static_cast<const char *>(data), size);
+            };
+            append(commands.data(), commands.size() * sizeof(CommandRecord));
+            append(options.data(), options.size() * sizeof(OptionRecord));
+            append(arguments.data(), arguments.size() * sizeof(ArgumentRecord));
+            append(sortedChildren.data(), sortedChildren.size() * sizeof(uint32_t));
+            while (out.size() % 8)
+                out.push_back('\0');
+            out += strings;
+
+            header.fileSize = out.size();
+            header.checksum = Schema::checksum(out.data() + sizeof(Header), out.size() - sizeof(Header));
+            std::memcpy(&out[0], &header, sizeof(header));
+            return out;
+        }
+
+      private:
+        std::string_view text(uint32_t offset) const
+        {
+            uint32_t size = 0;
+            std::memcpy(&size, strings.data() + offset, sizeof(size));
+            return std::string_view(strings.data() + offset + sizeof(size), size);
+        }
+
+        String strings;
+        std::unordered_map<String, uint32_t> stringIndex;
+    };
+
+    /*
+     * @brief 只读映射 schema 文件并检查文件头和各表的范围
+     * @param verify 是否同时计算整个文件的校验和；耗时与文件大小成正比，默认只在需要时开启
+     *        不计算校验和时，记录的访问仍然做范围检查，损坏的文件不会造成越界读取
+     * @return 失败时返回 false，原因通过 error() 获取
+     */
+    bool open(const String &path, bool verify = false)
+    {
+        if (!file.open(path, false))
+            return fail("open failed");
+        return load(file.data(), file.size(), verify);
+    }
+
+    /*
+     * @brief 直接使用内存中的 schema，数据需要在 Schema 的生命周期内有效
+     */
+    bool load(const char *data, size_t size, bool verify = false)
+    {
+        base = nullptr;
+        if (size < sizeof(Header))
+            return fail("file too small");
+        std::memcpy(&header, data, sizeof(Header));
+        if (std::memcmp(header.magic, Magic, sizeof(header.magic)) != 0)
+            return fail("bad magic");
+        if (header.version != Version)
+            return fail("unsupported version " + std::to_string(header.version));
+        if (header.headerSize != sizeof(Header) || header.fileSize != size)
+            return fail("size mismatch");
+
+        uint64_t tables = static_cast<uint64_t>(header.commandCount) * sizeof(CommandRecord) +
+                          static_cast<uint64_t>(header.optionCount) * sizeof(OptionRecord) +
+                          static_cast<uint64_t>(header.argumentCount) * sizeof(ArgumentRecord) +
+                          static_cast<uint64_t>(header.childCount) * sizeof(uint32_t);
+        tables = (tables + 7) / 8 * 8;
+        if (header.commandCount == 0 || sizeof(Header) + tables + header.stringBytes != size)
+            return fail("table size mismatch");
+        if (verify && checksum(data + sizeof(Header), size - sizeof(Header)) != header.checksum)
+            return fail("checksum mismatch");
+
+        base = data;
+        commandTable = reinterpret_cast<const CommandRecord *>(data + sizeof(Header));
+        optionTable = reinterpret_cast<const OptionRecord *>(commandTable + header.commandCount);
+        argumentTable = reinterpret_cast<const ArgumentRecord *>(optionTable + header.optionCount);
+        childTable = reinterpret_cast<const uint32_t *>(argumentTable + header.argumentCount);
+        stringPool = data + sizeof(Header) + tables;
+        return true;
+    }
+
+    bool isOpen() const
+    {
+        return base != nullptr;
+    }
+    const String &error() const
+    {
+        return lastError;
+    }
+    const Header &info() const
+    {
+        return header;
+    }
+
+    /*
+     * @brief 按下标访问记录，越界时返回空记录，损坏的文件不会造成越界读取
+     */
+    const CommandRecord &command(uint32_t index) const
+    {
+        static const CommandRecord empty{};
+        return index < header.commandCount ? commandTable[index] : empty;
+    }
+    const OptionRecord &option(uint32_t index) const
+    {
+        static const OptionRecord empty{};
+        return index < header.optionCount ? optionTable[index] : empty;
+    }
+    const ArgumentRecord &argument(uint32_t index) const
+    {
+        static const ArgumentRecord empty{};
+        return index < header.argumentCount ? argumentTable[index] : empty;
+    }
+    std::string_view string(uint32_t offset) const
+    {
+        uint32_t size = 0;
+        if (static_cast<uint64_t>(offset) + sizeof(size) > header.stringBytes)
+            return std::string_view();
+        std::memcpy(&size, stringPool + offset, sizeof(size));
+        if (static_cast<uint64_t>(offset) + sizeof(size) + size > header.stringBytes)
+            return std::string_view();
+        return std::string_view(stringPool + offset + sizeof(size), size);
+    }
+    Variant value(const ValueRecord &v) const
+    {
+        switch (v.kind)
+        {
+        case ValueKind::Int:
+            return Variant(static_cast<int>(static_cast<int64_t>(v.bits)));
+        case ValueKind::Double: {
+            double d = 0;
+            std::memcpy(&d, &v.bits, sizeof(d));
+            return Variant(d);
+        }
+        case ValueKind::String:
+            return Variant(String(string(static_cast<uint32_t>(v.bits))));
+        case ValueKind::Bool:
+            return Variant(v.bits != 0);
+        default:
+            return Variant();
+        }
+    }
+
+    /*
+     * @brief 按名称顺序列出名称以 prefix 开头的子命令，对每个命令下标调用 visit(index)
+     */
+    template <typename F> void forEachChild(uint32_t parent, std::string_view prefix, F visit) const
+    {
+        const CommandRecord &rec = command(parent);
+        if (static_cast<uint64_t>(rec.sortedChildren) + rec.childCount > header.childCount)
+            return;
+        const uint32_t *begin = childTable + rec.sortedChildren;
+        const uint32_t *end = begin + rec.childCount;
+        auto it = std::lower_bound(begin, end, prefix, [this](uint32_t index, std::string_view key) {
+            return string(command(index).name) < key;
+        });
+        for (; it != end && string(command(*it).name).substr(0, prefix.size()) == prefix; ++it)
+            visit(*it);
+    }
+
+    /*
+     * @brief 在子命令中按名称二分查找，返回命令下标，找不到时返回 None
+     */
+    uint32_t findChild(uint32_t parent, std::string_view name) const
+    {
+        const CommandRecord &rec = command(parent);
+        if (static_cast<uint64_t>(rec.sortedChildren) + rec.childCount > header.childCount)
+            return None;
+        const uint32_t *begin = childTable + rec.sortedChildren;
+        const uint32_t *end = begin + rec.childCount;
+        auto it = std::lower_bound(begin, end, name,
+                                   [this](uint32_t index, std::string_view key) { return string(command(index).name) < key; });
+        return it != end && string(command(*it).name) == name ? *it : None;
+    }
+
+    /*
+     * @brief 按 8 字节读取的乘法散列，用于检测文件损坏；4 路独立累加，乘法之间没有依赖
+     */
+    static uint64_t checksum(const char *data, size_t size)
+    {
+        const uint64_t prime = 0x9FB21C651E98DF25ULL;
+        auto mix = [prime](uint64_t h, const char *p) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            h = (h ^ word) * prime;
+            return h ^ (h >> 32);
+        };
+        uint64_t lanes[4] = {0xCBF29CE484222325ULL ^ size, 0x84222325CBF29CE4ULL, 0x9E3779B97F4A7C15ULL,
+                             0xC2B2AE3D27D4EB4FULL};
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            for (int k = 0; k < 4; ++k)
+                lanes[k] = mix(lanes[k], data + i + k * 8);
+        }
+        uint64_t h = lanes[0];
+        for (int k = 1; k < 4; ++k)
+            h = (h ^ lanes[k]) * prime;
+        for (; i + 8 <= size; i += 8)
+            h = mix(h, data + i);
+        for (; i < size; ++i)
+            h = (h ^ static_cast<unsigned char>(data[i])) * prime;
+        return h ^ (h >> 29);
+    }
+
+  private:
+    static constexpr char Magic[8] = {'C', 'M', 'D', 'S', 'C', 'H', 'E', 'M'};
+
+    bool fail(const String &reason)
+    {
+        lastError = reason;
+        base = nullptr;
+        return false;
+    }
+
+    TOOLS::MappedFile file;
+    Header header{};
+    const char *base = nullptr;
+    const CommandRecord *commandTable = nullptr;
+    const OptionRecord *optionTable = nullptr;
+    const ArgumentRecord *argumentTable = nullptr;
+    const uint32_t *childTable = nullptr;
+    const char *stringPool = nullptr;
+    String lastError;
+};
+
+/*
+ * @brief 批量检查命令行文件的结果
+ */
+struct LintReport
+{
+    struct Line
+    {
+        // 行号，从 1 开始
+        size_t line = 0;
+        // 第一个错误，只有警告时为 None
+        ErrorCode code = ErrorCode::None;
+        String message;
+    };
+
+    // 检查过的命令行数，不包括空行和注释
+    size_t lines = 0;
+    // 有错误的行数
+    size_t errors = 0;
+    // 只有警告的行数
+    size_t warnings = 0;
+    // 每种诊断出现的次数
+    Map<ErrorCode, size_t> counts;
+    // 有诊断的行，按行号排列，超过上限的不再记录
+    Vector<Line> details;
+    // 文件打不开时的原因
+    String failure;
+
+    bool ok() const
+    {
+        return failure.empty() && errors == 0;
+    }
+
+    String summary() const
+    {
+        if (!failure.empty())
+            return "error: " + failure + "\n";
+        String out = "checked " + std::to_string(lines) + " lines: " + std::to_string(errors) + " with errors, " +
+                     std::to_string(warnings) + " with warnings only\n";
+        for (const auto &count : counts)
+            out += String("  ") + errorCodeName(count.first) + ": " + std::to_string(count.second) + "\n";
+        for (const auto &line : details)
+        {
+            String message = line.message;
+            for (size_t at = 0; (at = message.find('\n', at)) != String::npos && at + 1 < message.size(); at += 2)
+                message.replace(at, 1, "; ");
+            out += std::to_string(line.line) + ": " + message;
+        }
+        return out;
+    }
+};
+
+/*
+ * @brief 调用记录文件：16 字节文件头之后是按 8 字节对齐的记录，只追加不修改，可以直接映射后顺序读取
+ *        记录：总长度、argc、开始时间（Unix 纳秒）、耗时（纳秒）、结果的错误码、parse 的 index、
+ *        argc 个 4 字节长度，然后是全部 argv 的内容
+ */
+struct Invocation
+{
+    uint64_t startNs = 0;
+    uint64_t durationNs = 0;
+    ErrorCode code = ErrorCode::None;
+    int index = 1;
+    // 指向映射的文件，只在 InvocationLog 存活期间有效
+    Vector<std::string_view> argv;
+};
+
+class InvocationLog
+{
+  public:
+    static constexpr char magic[8] = {'C', 'M', 'D', 'R', 'E', 'C', 'L', 'G'};
+    static constexpr uint32_t version = 1;
+    static constexpr size_t headerSize = 16;
+
+    struct RecordHeader
+    {
+        uint32_t size;
+        uint32_t argc;
+        uint64_t startNs;
+        uint64_t durationNs;
+        uint8_t code;
+        uint8_t reserved[3];
+        int32_t index;
+    };
+    static_assert(sizeof(RecordHeader) == 32, "RecordHeader must stay 32 bytes");
+
+    bool open(const String &path)
+    {
+        if (!file.open(path, false))
+        {
+            failure = path + " open failed";
+            return false;
+        }
+        if (file.size() < headerSize || std::memcmp(file.data(), magic, sizeof(magic)) != 0)
+        {
+            failure = path + " is not an invocation log";
+            return false;
+        }
+        uint32_t fileVersion;
+        std::memcpy(&fileVersion, file.data() + sizeof(magic), sizeof(fileVersion));
+        if (fileVersion != version)
+        {
+            failure = path + " has unsupported version " + std::to_string(fileVersion);
+            return false;
+        }
+        return true;
+    }
+    const String &error() const
+    {
+        return failure;
+    }
+
+    /*
+     * @brief 按写入顺序访问每条记录，末尾写了一半的记录（进程在写入时退出）被忽略
+     * @return 访问的记录数
+     */
+    template <typename Visit> size_t forEach(Visit &&visit)
+    {
+        size_t count = 0;
+        const char *data = file.data();
+        size_t offset = headerSize;
+        Invocation record;
+        while (file.size() - offset >= sizeof(RecordHeader))
+        {
+            // 多个进程同时创建文件时可能重复写入文件头，跳过即可
+            if (std::memcmp(data + offset, magic, sizeof(magic)) == 0)
+            {
+                offset += headerSize;
+                continue;
+            }
+            RecordHeader header;
+            std::memcpy(&header, data + offset, sizeof(header));
+            if (header.size < sizeof(header) || header.size % 8 != 0 || header.size > file.size() - offset ||
+                (header.size - sizeof(header)) / sizeof(uint32_t) < header.argc)
+                break;
+            const char *lengths = data + offset + sizeof(header);
+            const char *text = lengths + sizeof(uint32_t) * header.argc;
+            const char *end = data + offset + header.size;
+            record.startNs = header.startNs;
+            record.durationNs = header.durationNs;
+            record.code = static_cast<ErrorCode>(header.code);
+            record.index = header.index;
+            record.argv.clear();
+            bool valid = true;
+            for (uint32_t i = 0; i < header.argc && valid; ++i)
+            {
+                uint32_t length;
+                std::memcpy(&length, lengths + sizeof(uint32_t) * i, sizeof(length));
+                valid = length <= static_cast<size_t>(end - text);
+                if (valid)
+                    record.argv.emplace_back(text, length);
+                text += valid ? length : 0;
+            }
+            if (!valid)
+                break;
+            visit(static_cast<const Invocation &>(record));
+            ++count;
+            offset += header.size;
+        }
+        return count;
+    }
+
+  private:
+    TOOLS::MappedFile file;
+    String failure;
+};
+
+/*
+ * @brief 把调用追加到记录文件，每条记录一次 write；文件以 O_APPEND 打开，多个进程可以写同一个文件
+ *        写入不完整时（例如磁盘已满）停止记录，之后的记录不会接在残缺的记录后面
+ */
+class InvocationRecorder
+{
+  public:
+    explicit InvocationRecorder(const String &path)
+    {
+#ifdef COMMANDER_CPP_HAS_MMAP
+        // 新建文件的进程负责写入文件头
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0)
+        {
+            char header[InvocationLog::headerSize] = {};
+            std::memcpy(header, InvocationLog::magic, sizeof(InvocationLog::magic));
+            std::memcpy(header + sizeof(InvocationLog::magic), &InvocationLog::version, sizeof(uint32_t));
+            writeRecord(header, sizeof(header));
+        }
+        else if (errno == EEXIST)
+            fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+#else
+        stream = std::fopen(path.c_str(), "ab");
+        if (stream && std::ftell(stream) == 0)
+        {
+            char header[InvocationLog::headerSize] = {};
+            std::memcpy(header, InvocationLog::magic, sizeof(InvocationLog::magic));
+            std::memcpy(header + sizeof(InvocationLog::magic), &InvocationLog::version, sizeof(uint32_t));
+            writeRecord(header, sizeof(header));
+        }
+#endif
+    }
+    InvocationRecorder(const InvocationRecorder &) = delete;
+    InvocationRecorder &operator=(const InvocationRecorder &) = delete;
+    ~InvocationRecorder()
+    {
+#ifdef COMMANDER_CPP_HAS_MMAP
+        if (fd >= 0)
+            ::close(fd);
+#else
+        if (stream)
+            std::fclose(stream);
+#endif
+    }
+
+    bool isOpen() const
+    {
+#ifdef COMMANDER_CPP_HAS_MMAP
+        return fd >= 0;
+#else
+        return stream != nullptr;
+#endif
+    }
+
+    void append(int argc, char **argv, int index, uint64_t startNs, uint64_t durationNs, ErrorCode code)
+    {
+        InvocationLog::RecordHeader header = {};
+        header.argc = static_cast<uint32_t>(std::max(argc, 0));
+        header.startNs = startNs;
+        header.durationNs = durationNs;
+        header.code = static_cast<uint8_t>(code);
+        header.index = index;
+
+        String record(sizeof(header) + sizeof(uint32_t) * header.argc, '\0');
+        for (uint32_t i = 0; i < header.argc; ++i)
+        {
+            uint32_t length = static_cast<uint32_t>(std::strlen(argv[i]));
+            std::memcpy(&record[sizeof(header) + sizeof(uint32_t) * i], &length, sizeof(length));
+            record.append(argv[i], length);
+        }
+        record.resize((record.size() + 7) / 8 * 8, '\0');
+        header.size = static_cast<uint32_t>(record.size());
+        std::memcpy(&record[0], &header, sizeof(header));
+        writeRecord(record.data(), record.size());
+    }
+
+  private:
+    void writeRecord(const char *data, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+#ifdef COMMANDER_CPP_HAS_MMAP
+        if (fd < 0)
+            return;
+        // O_APPEND 的一次 write 在文件末尾整体追加，不会和其它进程的记录交错
+        ssize_t n;
+        do
+            n = ::write(fd, data, size);
+        while (n < 0 && errno == EINTR);
+        if (n != static_cast<ssize_t>(size))
+        {
+            ::close(fd);
+            fd = -1;
+        }
+#else
+        // 没有 O_APPEND 时只保证同一进程内的记录不交错
+        if (!stream)
+            return;
+        if (std::fwrite(data, 1, size, stream) != size || std::fflush(stream) != 0)
+        {
+            std::fclose(stream);
+            stream = nullptr;
+        }
+#endif
+    }
+
+#ifdef COMMANDER_CPP_HAS_MMAP
+    int fd = -1;
+#else
+    std::FILE *stream = nullptr;
+#endif
+    std::mutex mutex;
+};
+
+/*
+ * @brief 回放调用记录的结果
+ */
+struct ReplayReport
+{
+    size_t records = 0;
+    // 结果的错误码与记录时不同的调用数
+    size_t mismatches = 0;
+    // 回放时 parse 或 validate 的总耗时和记录时的总耗时
+    uint64_t replayNs = 0;
+    uint64_t recordedNs = 0;
+    // 单次调用回放耗时的分位数
+    uint64_t p50Ns = 0;
+    uint64_t p99Ns = 0;
+    uint64_t maxNs = 0;
+    String failure;
+
+    String summary() const
+    {
+        if (!failure.empty())
+            return "error: " + failure + "\n";
+        std::stringstream out;
+        out << "replayed " << records << " invocations, " << mismatches << " with a different result\n"
+            << "  replay total: " << replayNs / 1000 << " us, recorded total: " << recordedNs / 1000 << " us\n"
+            << "  per invocation: p50 " << p50Ns << " ns, p99 " << p99Ns << " ns, max " << maxNs << " ns\n";
+        return out.str();
+    }
+};
+
+/*
+ * @brief 补全候选：子命令名称、"--name" 或 "-a"，以及描述的第一行
+ */
+struct CompletionCandidate
+{
+    String value;
+    String description;
+};
+
+/*
+ * @brief parse 的结果，出错时记录第一个错误，不依赖异常
+ */
+struct ParseResult
+{
+    ErrorCode code = ErrorCode::None;
+    // 出错的 argv 下标，-1 表示和具体的 token 无关
+    int index = -1;
+    // 按出现顺序记录的全部警告和错误
+    Vector<Diagnostic> diagnostics;
+
+    bool ok() const
+    {
+        return code == ErrorCode::None;
+    }
+    explicit operator bool() const
+    {
+        return ok();
+    }
+
+    size_t count(ErrorCode code) const
+    {
+        return static_cast<size_t>(std::count_if(diagnostics.begin(), diagnostics.end(),
+                                                  [code](const Diagnostic &d) { return d.code == code; }));
+    }
+
+    /*
+     * @brief 把全部诊断格式化为文本，每条一行；传入解析时的 argv 可以带上原始 token
+     */
+    String format(int argc = 0, char **argv = nullptr) const
+    {
+        String out;
+        for (const auto &d : diagnostics)
+        {
+            const char *token = argv && d.index >= 0 && d.index < argc ? argv[d.index] : nullptr;
+            out += (d.severity == Severity::Error ? "error: " : "warning: ") + d.message(token) + "\n";
+        }
+        return out;
+    }
+};
+
+class Command
+{
+  public:
+    Command(const String &name = String(), Logger *logger = new LoggerDefaultImpl())
+        : commandName(name), actionCallback(nullptr), pLogger(logger), versionOption(nullptr), helpOption(nullptr),
+          parentCommand(nullptr)
+    {
+        version("0.0.0", "-V --version", "out put version number.");
+        help("-h --help");
+    }
+    virtual ~Command()
+    {
+        if (versionOption && !parentCommand)
+        {
+            delete versionOption;
+            versionOption = nullptr;
+        }
+        if (helpOption && !parentCommand)
+        {
+            delete helpOption;
+            helpOption = nullptr;
+        }
+        if (profileOption)
+        {
+            delete profileOption;
+            profileOption = nullptr;
+        }
+
+        for (const auto opt : options)
+        {
+            delete opt;
+        }
+        options.clear();
+
+        for (const auto cmd : subCommands)
+        {
+            delete cmd;
+        }
+        subCommands.clear();
+
+        for (const auto arg : arguments)
+        {
+            delete arg;
+        }
+        arguments.clear();
+    }
+
+  public:
+    virtual Command *name(const String &name)
+    {
+        commandName = name;
+        // 已经挂到父命令下时，保持父命令的名称索引有序
+        if (parentCommand)
+        {
+            auto &index = parentCommand->sortedCommands;
+            index.erase(std::remove(index.begin(), index.end(), this), index.end());
+            parentCommand->indexCommand(this);
+        }
+        return this;
+    }
+    virtual String name()
+    {
+        return commandName.str();
+    }
+
+    virtual Command *version(const String &v, const String &flag = String(), const String &desc = String())
+    {
+        // 函数结束时调用
+        FinialRelease f([this, v, desc]() {
+            if (versionOption)
+            {
+                versionOption->defaultValue = v;
+                if (!desc.empty())
+                    versionOption->desc = desc;
+            }
+        });
+
+        if (!flag.empty())
+        {
+            Option *opt = Option::create(flag, pLogger);
+            if (!opt)
+            {
+                return this;
+            }
+
+            if (versionOption)
+            {
+                delete versionOption;
+                versionOption = nullptr;
+            }
+
+            versionOption = opt;
+        }
+
+        return this;
+    };
+    virtual String version()
+    {
+        String *v = std::get_if<String>(&versionOption->defaultValue);
+        return v ? *v : "0.0.0";
+    }
+
+    virtual Command *description(const String &desc)
+    {
+        commandDescription = desc;
+        return this;
+    };
+    virtual String description()
+    {
+        return commandDescription;
+    }
+
+    virtual Command *help(const String &flag = String(), const String &desc = String())
+    {
+        FinialRelease r([this, desc]() {
+            if (helpOption)
+            {
+                if (!desc.empty())
+                    helpOption->desc = desc;
+            }
+        });
+
+        if (!flag.empty())
+        {
+            Option *opt = Option::create(flag, pLogger);
+            if (!opt)
+            {
+                return this;
+            }
+
+            if (helpOption)
+            {
+                delete helpOption;
+                helpOption = nullptr;
+            }
+
+            helpOption = opt;
+        }
+        return this;
+    };
+
+    /**
+     * @brief 开启全局的性能分析选项，只能在根命令上设置，所有子命令都可以使用
+     *        指定该选项时测量 action 的墙钟时间、CPU 时间、最大常驻内存、缺页次数以及可用的硬件计数器，
+     *        结果输出到 stderr；通过 --profile=file 指定文件时写入 JSON
+     * @param flag 选项定义，值只能通过 = 传入，避免把后面的子命令或参数当作文件名
+     */
+    virtual Command *profile(const String &flag = "--profile [file]",
+                             const String &desc = "profile the action, write JSON to file if given.")
+    {
+        if (parentCommand)
+        {
+            if (pLogger)
+                pLogger->warn(String("profile option can only be set on the root command"));
+            return this;
+        }
+
+        Option *opt = Option::create(flag, pLogger);
+        if (!opt)
+        {
+            if (pLogger)
+                pLogger->error(String("option ") + flag + String(" create failed"));
+            return this;
+        }
+        opt->desc = desc;
+
+        if (profileOption)
+            delete profileOption;
+        profileOption = opt;
+        return this;
+    }
+    virtual String helpText()
+    {
+        COMMANDER_CPP_PHASE(Phase::Help);
+        // 帮助文本需要子命令的完整定义
+        materialize();
+        expandSchema();
+        for (const auto cmd : subCommands)
+            cmd->materialize();
+        auto getHelpText = [this]() {
+            std::vector<std::vector<String>> lines;
+
+            auto getUsageText = [&](Command *cmd) {
+                std::stringstream out;
+                out << cmd->commandName.str();
+                if (cmd->options.size())
+                    out << " [options]";
+                String argumentText;
+                for (const auto arg : cmd->arguments)
+                {
+                    argumentText +=
+                        " " + (arg->valueIsRequired ? "<" + arg->name + (arg->isMultiValue ? "..." : "") + ">"
+                                                    : "[" + arg->name + (arg->isMultiValue ? "..." : "") + "]");
+                }
+                if (!cmd->arguments.empty())
+                    out << argumentText;
+
+                return out.str();
+            };
+
+            auto collectUsage = [&]() {
+                String usageText = getUsageText(this);
+
+                Command *p = parentCommand;
+                while (p)
+                {
+                    usageText = p->commandName.str() + " " + usageText;
+                    p = p->parentCommand;
+                }
+
+                lines.push_back({{"Usage: " + usageText}});
+                lines.push_back({});
+            };
+
+            auto collectDescription = [&]() {
+                lines.push_back({{description()}});
+                lines.push_back({});
+            };
+
+            auto collectArguments = [&]() {
+                if (!arguments.empty())
+                {
+                    lines.push_back({{"Arguments: "}});
+                    for (const auto arg : arguments)
+                    {
+                        Vector<String> descList = TOOLS::split(arg->desc, "\n");
+                        String firstLine = descList.front();
+
+                        lines.push_back({{"  " + arg->name + (arg->isMultiValue ? "..." : "")}, {firstLine}});
+                        for (auto it = descList.begin() + 1; it < descList.end(); ++it)
+                        {
+                            lines.push_back({{}, {*it}});
+                        }
+                    }
+                    lines.push_back({});
+                }
+            };
+
+            auto collectOptions = [&]() {
+                auto getOptionText = [](Option *opt) {
+                    std::stringstream out;
+                    out << "  " << (opt->alias.empty() ? "" : ("-" + opt->alias.str() + ", ")) << ("--" + opt->name.str());
+                    if (!opt->valueName.empty())
+                        out << " "
+                            << (opt->valueIsRequired ? "<" + opt->valueName + (opt->multiValue ? "..." : "") + ">"
+                                                     : "[" + opt->valueName + (opt->multiValue ? "..." : "") + "]");
+                    return out.str();
+                };
+
+                auto getDescriptionText = [](Option *opt) {
+                    std::stringstream out;
+                    out << opt->desc;
+                    if (!opt->valueName.empty())
+                    {
+                        String defaultValue;
+                        do
+                        {
+                            String *sv = std::get_if<String>(&opt->defaultValue);
+                            if (sv)
+                            {
+                                defaultValue = *sv;
+                                break;
+                            }
+
+                            bool *bv = std::get_if<bool>(&opt->defaultValue);
+                            if (bv)
+                            {
+                                defaultValue = *bv ? "true" : "false";
+                                break;
+                            }
+
+                            int *iv = std::get_if<int>(&opt->defaultValue);
+                            if (iv)
+                            {
+                                defaultValue = std::to_string(*iv);
+                                break;
+                            }
+
+                            double *dv = std::get_if<double>(&opt->defaultValue);
+                            if (dv)
+                            {
+                                defaultValue = std::to_string(*dv);
+                                break;
+                            }
+                        } while (0);
+                        if (!defaultValue.empty())
+                            out << " (default: " << defaultValue << ")";
+                    }
+
+                    return out.str();
+                };
+
+                lines.push_back({{"Options: "}});
+
+                auto opts = options;
+                opts.insert(opts.begin(), versionOption);
+                if (rootCommand()->profileOption)
+                    opts.push_back(rootCommand()->profileOption);
+                opts.push_back(helpOption);
+                for (const auto opt : opts)
+                {
+                    auto descList = TOOLS::split(getDescriptionText(opt), "\n");
+                    auto first = descList.front();
+                    lines.push_back({{getOptionText(opt)}, {first}});
+
+                    for (auto it = descList.begin() + 1; it < descList.end(); ++it)
+                    {
+                        lines.push_back({{}, {*it}});
+                    }
+                }
+                lines.push_back({});
+            };
+
+            auto collectCommands = [&]() {
+                if (!subCommands.empty())
+                {
+                    lines.push_back({{"Commands: "}});
+                    for (const auto cmd : subCommands)
+                    {
+                        auto descList = TOOLS::split(cmd->description(), "\n");
+                        auto first = descList.front();
+                        lines.push_back({{"  " + getUsageText(cmd)}, {first}});
+
+                        for (auto it = descList.begin() + 1; it < descList.end(); ++it)
+                        {
+                            lines.push_back({{}, {*it}});
+                        }
+                    }
+                    lines.push_back({});
+                }
+            };
+
+            auto mergeLines = [&]() {
+                std::vector<int> columnMaxLens;
+                std::stringstream out;
+
+                // 先遍历每一行，每一列的最长长度
+                for (const auto &columns : lines)
+                {
+                    if (columns.size() <= 1)
+                        continue;
+
+                    for (size_t i = 0; i < columns.size(); ++i)
+                    {
+                        if (i >= columnMaxLens.size())
+                            columnMaxLens.push_back(0);
+                        columnMaxLens[i] = std::max<int>(columnMaxLens[i], columns[i].size());
+                    }
+                }
+
+                // 将每一列短的补空格补齐，然后重新组织文本
+                for (const auto &columns : lines)
+                {
+                    if (columns.size() == 1)
+                    {
+                        out << columns[0] << std::endl;
+                        continue;
+                    }
+
+                    for (size_t i = 0; i < columns.size(); ++i)
+                    {
+                        int s = columnMaxLens[i];
+                        const String &c = columns[i];
+                        out << c;
+                        int l = s - c.size();
+                        if (l >= 0)
+                        {
+                            String space;
+                            // 这里+2是让每一列不要紧挨着，中间留两个空格的宽度
+                            space.resize(l + 2, ' ');
+                            out << space;
+                        }
+                    }
+                    out << std::endl;
+                }
+                return out.str();
+            };
+
+            collectUsage();
+            collectDescription();
+            collectArguments();
+            collectOptions();
+            collectCommands();
+
+            return mergeLines();
+        };
+        return !helpOption->desc.empty() ? helpOption->desc : getHelpText();
+    }
+
+    /**
+     * @param nameAndArg 命令名称和参数定义字符串，例如 "copy <from...> | [to...]"
+     * @return new Command
+     */
+    virtual Command *command(const String &nameAndArg, const String &desc = String())
+    {
+        if (pLogger)
+            pLogger->debug(String("create command: nameAndArg: ") + nameAndArg);
+        COMMANDER_CPP_PHASE(Phase::Construct);
+        static const std::regex reg(
+            R"(^\s*([a-zA-Z][a-zA-Z\d]+)\s*((?:\[[a-zA-Z][a-zA-Z\d]+(?:\.\.\.)?\])|(?:<[a-zA-Z][a-zA-Z\d]+(?:\.\.\.)?>))?\s*$)");
+        std::smatch res;
+        if (!std::regex_search(nameAndArg, res, reg))
+            return nullptr;
+        String name = res.str(1);
+        String arg = res.str(2);
+        Command *cmd = (new Command(name, pLogger))->description(desc)->argument(arg);
+
+        addCommand(cmd);
+
+        return cmd;
+    };
+
+    /**
+     * @brief 延迟注册子命令，builder 只在子命令被 findCommand 选中或需要完整帮助文本时才执行一次，
+     *        启动开销只和实际执行的路径有关
+     * @param nameAndArg 命令名称和参数定义字符串，与 command(nameAndArg, desc) 相同
+     * @param builder 为子命令添加选项、参数、子命令和 action
+     * @return 当前命令，便于继续注册其它子命令
+     */
+    virtual Command *command(const String &nameAndArg, const String &desc, const CommandBuilder &builder)
+    {
+        Command *cmd = command(nameAndArg, desc);
+        if (cmd)
+            cmd->pendingBuilder = builder;
+        else if (pLogger)
+            pLogger->error(String("command ") + nameAndArg + String(" create failed"));
+        return this;
+    }
+
+    /**
+     * @brief 立即执行延迟注册的 builder，已经构建过的命令不会重复执行
+     */
+    Command *materialize()
+    {
+        if (pendingBuilder)
+        {
+            CommandBuilder builder = std::move(pendingBuilder);
+            pendingBuilder = nullptr;
+            builder(this);
+        }
+        return this;
+    }
+    virtual Command *addCommand(Command *command)
+    {
+        if (!command)
+        {
+            if (pLogger)
+                pLogger->warn(String("add command failed, command is null"));
+            return this;
+        }
+
+        if (findCommand(command->commandName.str()))
+        {
+            if (pLogger)
+                pLogger->warn(String("add command failed, command ") + command->commandName.str() +
+                              String(" already exists"));
+            return this;
+        }
+
+        command->parentCommand = this;
+        command->versionOption = versionOption;
+        command->helpOption = helpOption;
+        if (!command->pLogger)
+            command->pLogger = pLogger;
+
+        subCommands.push_back(command);
+        indexCommand(command);
+        return this;
+    };
+
+    /**
+     * @param name 参数名称和定义字符串，例如 "<todo...>" 或 "[todo...]"
+     * @return this
+     */
+    virtual Command *argument(const String &name, const String &desc = String(), const Variant &defaultValue = Variant())
+    {
+        COMMANDER_CPP_PHASE(Phase::Construct);
+        Argument *arg = Argument::create(name, pLogger);
+        if (!arg)
+        {
+            if (pLogger)
+                pLogger->error(String("argument ") + name + String(" create failed"));
+            return this;
+        }
+
+        arg->desc = desc;
+        arg->defaultValue = defaultValue;
+        arguments.push_back(arg);
+        return this;
+    };
+
+    /**
+     * @param flag 选项标志字符串，例如 "-d --debug <level...> | [debug...]"
+     * @return this
+     */
+    virtual Command *option(const String &flag, const String &desc = String(), const Variant &defaultValue = Variant())
+    {
+        COMMANDER_CPP_PHASE(Phase::Construct);
+        Option *opt = Option::create(flag, pLogger);
+        if (!opt)
+        {
+            if (pLogger)
+                pLogger->error(String("option ") + flag + String(" create failed"));
+            return this;
+        }
+
+        for( const auto &existOpt : options)
+        {
+            if(!opt->alias.empty() && existOpt->alias == opt->alias)
+            {
+                if (pLogger)
+                    pLogger->warn(String("option alias ") + opt->alias.str() + String(" already exists, Option: ") + opt->name.str() + String("'s alias will forever be invalid."));
+            }
+
+            if (existOpt->name == opt->name)
+            {
+                if (pLogger)
+                    pLogger->warn(String("option ") + flag + String(" already exists, skip add"));
+                delete opt;
+                return this;
+            }
+        }
+
+        opt->desc = desc;
+        opt->defaultValue = defaultValue;
+        options.push_back(opt);
+
+        return this;
+    };
+
+    /**
+     * @brief 定义带元素类型的多值选项，值以紧凑的 Int64List/DoubleList/StringViewList 存储
+     * @param flag 选项标志字符串，必须是多值选项，例如 "--ids <ids...>"
+     * @param elementType 元素类型
+     */
+    virtual Command *option(const String &flag, const String &desc, ValueType elementType)
+    {
+        size_t count = options.size();
+        option(flag, desc);
+        if (options.size() == count)
+            return this;
+
+        Option *opt = options.back();
+        if (!opt->multiValue)
+        {
+            if (pLogger)
+                pLogger->warn(String("option ") + flag + String(" is not a multi value option, element type ignored"));
+            return this;
+        }
+        opt->elementType = elementType;
+        return this;
+    }
+
+    /**
+     * @brief 设置带元素类型的多值选项并行转换的阈值，值的个数达到阈值后分块在多个线程上转换
+     *        转换线程在第一次并行转换时创建，之后的解析复用同一组线程
+     * @param threshold 阈值，0 表示始终串行转换
+     * @param threads 线程数，0 表示使用硬件并发数
+     */
+    virtual Command *parallelConversion(size_t threshold, unsigned threads = 0)
+    {
+        parallelThreshold = threshold;
+        parallelThreads = threads;
+        std::lock_guard<std::mutex> lock(conversionPoolMutex);
+        conversionPool.reset();
+        return this;
+    }
+
+    /**
+     * @brief 以流式方式接收多值选项的值，每解析出一个值就回调一次，值不再收集到 opts 中
+     * @param name 选项名称，例如 "files"
+     * @param visitor 值回调，参数为值在该选项中的序号和值本身
+     */
+    virtual Command *visitOption(const String &name, const ValueVisitor &visitor)
+    {
+        for (const auto opt : options)
+        {
+            if (opt->name.str() != name)
+                continue;
+
+            if (!opt->multiValue)
+            {
+                if (pLogger)
+                    pLogger->warn(String("option ") + name + String(" is not a multi value option, visitor ignored"));
+                return this;
+            }
+            opt->visitor = visitor;
+            return this;
+        }
+
+        if (pLogger)
+            pLogger->warn(String("visit option failed, option ") + name + String(" not found"));
+        return this;
+    }
+
+    /**
+     * @brief 以流式方式接收多值参数的值，每解析出一个值就回调一次，值不再收集到 args 中
+     * @param name 参数名称，例如 "files"
+     * @param visitor 值回调，参数为值在该参数中的序号和值本身
+     */
+    virtual Command *visitArgument(const String &name, const ValueVisitor &visitor)
+    {
+        for (const auto arg : arguments)
+        {
+            if (arg->name != name)
+                continue;
+
+            if (!arg->isMultiValue)
+            {
+                if (pLogger)
+                    pLogger->warn(String("argument ") + name +
+                                  String(" is not a multi value argument, visitor ignored"));
+                return this;
+            }
+            arg->visitor = visitor;
+            return this;
+        }
+
+        if (pLogger)
+            pLogger->warn(String("visit argument failed, argument ") + name + String(" not found"));
+        return this;
+    }
+
+    /**
+     * @brief 设置命令的动作回调函数
+     * @param cb 动作回调函数，参数为参数列表和选项列表
+     */
+    virtual Command *action(const Action &cb)
+    {
+        if (!cb)
+        {
+            if (pLogger)
+                pLogger->debug(String("[error]:") + String("action callback is null"));
+        }
+
+        actionCallback = cb;
+        compactCallback = nullptr;
+        return this;
+    }
+    virtual Command *action(const Action2 &cb)
+    {
+        if (!cb)
+        {
+            if (pLogger)
+                pLogger->debug(String("[error]:") + String("action callback is null"));
+        }
+
+        actionCallback = [cb](class Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
+            (void)cmd;
+            cb(args, opts);
+        };
+        compactCallback = nullptr;
+        return this;
+    }
+    virtual Command *action(const Action3 &cb)
+    {
+        if (!cb)
+        {
+            if (pLogger)
+                pLogger->debug(String("[error]:") + String("action callback is null"));
+        }
+
+        actionCallback = [cb](class Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
+            cb(cmd, args, {opts});
+        };
+        compactCallback = nullptr;
+        return this;
+    }
+
+    /**
+     * @brief 设置以 CompactValue 接收值的动作回调函数，与 action 互斥
+     *        解析时参数和选项值直接存为 16 字节的 CompactValue，不再保存 Variant
+     * @param cb 动作回调函数，参数为参数列表和选项列表
+     */
+    virtual Command *compactAction(const CompactAction &cb)
+    {
+        if (!cb)
+        {
+            if (pLogger)
+                pLogger->debug(String("[error]:") + String("compact action callback is null"));
+        }
+
+        compactCallback = cb;
+        actionCallback = nullptr;
+        return this;
+    }
+
+    /**
+     * @brief 开启响应文件支持，解析时 "@path" 会被替换为文件中的参数列表
+     * @param enable 是否开启
+     * @param maxDepth 响应文件嵌套的最大深度
+     */
+    virtual Command *responseFile(bool enable = true, int maxDepth = 8)
+    {
+        responseFileEnabled = enable;
+        responseFileMaxDepth = maxDepth;
+        return this;
+    }
+
+    /**
+     * @brief 构造全部延迟注册的子命令和 schema 中的子命令，之后 parse 不再修改命令树，
+     *        可以在多个线程中同时对同一棵树调用 parse（action 自身需要是线程安全的）
+     */
+    Command *freeze()
+    {
+        Vector<Command *> stack{this};
+        while (!stack.empty())
+        {
+            Command *cmd = stack.back();
+            stack.pop_back();
+            cmd->materialize();
+            cmd->expandSchema();
+            stack.insert(stack.end(), cmd->subCommands.begin(), cmd->subCommands.end());
+        }
+        return this;
+    }
+
+    /**
+     * @brief 把命令树（名称、选项、参数、描述、默认值和层级）保存为二进制 schema 文件，
+     *        action、visitor 和列表类型的默认值不会保存
+     * @return 写入失败时返回 false
+     */
+    bool saveSchema(const String &path)
+    {
+        Schema::Writer writer;
+        auto writeOption = [&writer](const Option *opt) {
+            Schema::OptionRecord rec{};
+            rec.name = writer.string(opt->name.str());
+            rec.alias = writer.string(opt->alias.str());
+            rec.valueName = writer.string(opt->valueName);
+            rec.description = writer.string(opt->desc);
+            rec.multiValue = opt->multiValue;
+            rec.valueIsRequired = opt->valueIsRequired;
+            rec.elementType = static_cast<uint8_t>(opt->elementType);
+            writer.value(opt->defaultValue, rec.defaultValue);
+            writer.options.push_back(rec);
+            return static_cast<uint32_t>(writer.options.size() - 1);
+        };
+
+        // 按层序展开，每个命令的子命令在表中是连续的区间
+        Vector<Command *> queue{this};
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            Command *cmd = queue[i];
+            cmd->materialize();
+            cmd->expandSchema();
+
+            Schema::CommandRecord rec{};
+            rec.name = writer.string(cmd->commandName.str());
+            rec.description = writer.string(cmd->commandDescription);
+            rec.firstOption = static_cast<uint32_t>(writer.options.size());
+            rec.optionCount = static_cast<uint32_t>(cmd->options.size());
+            for (const auto opt : cmd->options)
+                writeOption(opt);
+            rec.firstArgument = static_cast<uint32_t>(writer.arguments.size());
+            rec.argumentCount = static_cast<uint32_t>(cmd->arguments.size());
+            for (const auto arg : cmd->arguments)
+            {
+                Schema::ArgumentRecord a{};
+                a.name = writer.string(arg->name);
+                a.description = writer.string(arg->desc);
+                a.isMultiValue = arg->isMultiValue;
+                a.valueIsRequired = arg->valueIsRequired;
+                writer.value(arg->defaultValue, a.defaultValue);
+                writer.arguments.push_back(a);
+            }
+            rec.firstChild = static_cast<uint32_t>(queue.size());
+            rec.childCount = static_cast<uint32_t>(cmd->subCommands.size());
+            queue.insert(queue.end(), cmd->subCommands.begin(), cmd->subCommands.end());
+            writer.commands.push_back(rec);
+        }
+        if (versionOption)
+            writer.versionOption = writeOption(versionOption);
+        if (helpOption)
+            writer.helpOption = writeOption(helpOption);
+        if (profileOption)
+            writer.profileOption = writeOption(profileOption);
+
+        std::ofstream out(path, std::ios::binary);
+        out << writer.finish();
+        if (!out && pLogger)
+            pLogger->error(String("schema ") + path + String(" write failed"));
+        return static_cast<bool>(out);
+    }
+
+    /**
+     * @brief 加载 saveSchema 保存的文件并返回根命令，文件保持只读映射，
+     *        子命令只在被 findCommand 选中或输出帮助时才从映射中构造，启动开销与命令树规模无关
+     * @param binder 每个命令构造完成后调用一次，用于按名称挂接 action
+     * @param verify 是否检查整个文件的校验和，耗时与文件大小成正比；默认只检查文件头和各表的范围
+     * @return 文件无法打开、格式或版本不匹配、校验失败时返回 nullptr
+     */
+    static Command *loadSchema(const String &path, Logger *logger = new LoggerDefaultImpl(),
+                               const CommandBuilder &binder = nullptr, bool verify = false)
+    {
+        auto link = std::make_shared<SchemaLink>();
+        if (!link->schema.open(path, verify))
+        {
+            if (logger)
+                logger->error(String("schema ") + path + String(" load failed: ") + link->schema.error());
+            return nullptr;
+        }
+        link->binder = binder;
+
+        Command *root = fromSchema(link, 0, logger);
+        const Schema::Header &header = link->schema.info();
+        if (header.versionOption != Schema::None)
+        {
+            delete root->versionOption;
+            root->versionOption = optionFromSchema(link->schema, header.versionOption);
+        }
+        if (header.helpOption != Schema::None)
+        {
+            delete root->helpOption;
+            root->helpOption = optionFromSchema(link->schema, header.helpOption);
+        }
+        if (header.profileOption != Schema::None)
+            root->profileOption = optionFromSchema(link->schema, header.profileOption);
+        if (binder)
+            binder(root);
+        return root;
+    }
+
+    /**
+     * @brief 把命令树的完整定义导出为 JSON：子命令、选项（别名、值名称、是否多值、值是否必需、元素类型）、参数、
+     *        默认值和描述，根命令还包括 version、help 和 profile 选项；action、visitor 和列表类型的默认值不会导出
+     */
+    String toJson()
+    {
+        String out;
+        writeJson(out);
+        return out;
+    }
+
+    /**
+     * @brief 在一次线性扫描中按 toJson 的格式构造选项、参数和子命令，不构造中间的 JSON 树，不认识的键会被忽略
+     *        当前命令没有名称时使用 JSON 中的名称；version、help 和 profile 只对根命令生效
+     *        可以在延迟注册的 builder 中调用，让插件以数据的形式提供命令定义
+     * @param binder 每个命令的定义读取完成后调用一次，用于按名称挂接 action
+     *        选项、参数和子命令按 option、argument、command 的规则校验，重复或非法的定义会导致导入失败
+     * @return JSON 格式错误或定义不合法时返回 false，原因输出到日志，已经读取的部分保留
+     */
+    virtual bool importJson(const String &json, const CommandBuilder &binder = nullptr)
+    {
+        COMMANDER_CPP_PHASE(Phase::Construct);
+        TOOLS::JsonReader reader(json.data(), json.data() + json.size());
+        bool ok = readJson(reader, binder) && (reader.atEnd() || reader.fail("unexpected trailing data"));
+        if (!ok && pLogger)
+            pLogger->error(String("json schema: ") + reader.error());
+        return ok;
+    }
+
+    /**
+     * @brief 开启隐藏的补全查询入口，只能在根命令上设置
+     *        "app __complete <words...>" 按最后一个单词（光标处，可以为空）输出候选的子命令、选项和别名，
+     *        每行一个，候选和描述之间以制表符分隔；不执行 action，也不做参数校验
+     */
+    virtual Command *completion(const String &name = "__complete")
+    {
+        if (parentCommand)
+        {
+            if (pLogger)
+                pLogger->warn(String("completion can only be set on the root command"));
+            return this;
+        }
+        completionName = name;
+        return this;
+    }
+
+    /**
+     * @brief 设置补全缓存文件，只能在根命令上设置
+     *        缓存以可执行文件的路径、修改时间、大小和 build ID 为键，保存整棵命令树的补全数据；
+     *        补全脚本在缓存有效时直接用 awk 查询缓存，不再启动程序，过期时调用补全查询入口并由程序重写缓存
+     */
+    virtual Command *completionCache(const String &file)
+    {
+        if (parentCommand)
+        {
+            if (pLogger)
+                pLogger->warn(String("completion cache can only be set on the root command"));
+            return this;
+        }
+        completionCacheFile = file;
+        return this;
+    }
+
+    /**
+     * @brief 把整棵命令树的补全数据写入缓存文件，先写临时文件再重命名，并发补全不会读到半个文件
+     *        每行依次是命令路径、类型、候选和描述，以制表符分隔；"*" 表示所有命令共享的选项
+     *        类型：c 子命令，f 不带值的选项，v 带一个值的选项，m 带多个值的选项
+     */
+    bool writeCompletionCache(const String &file)
+    {
+        Command *root = rootCommand();
+        String out = "#commander-cpp-completion 1\n" + TOOLS::ExecutableIdentity::current().header();
+        auto writeOption = [&out](const String &path, const Option *opt) {
+            const char *kind = opt->valueName.empty() || !opt->valueIsRequired ? "f" : opt->multiValue ? "m" : "v";
+            String desc = summaryLine(opt->desc);
+            out += path + "\t" + kind + "\t--" + opt->name.str() + "\t" + desc + "\n";
+            if (!opt->alias.empty())
+                out += path + "\t" + kind + "\t-" + opt->alias.str() + "\t" + desc + "\n";
+        };
+        writeOption("*", root->versionOption);
+        writeOption("*", root->helpOption);
+        if (root->profileOption)
+            writeOption("*", root->profileOption);
+
+        Vector<std::pair<Command *, String>> stack{{root, String()}};
+        while (!stack.empty())
+        {
+            Command *cmd = stack.back().first;
+            String path = stack.back().second;
+            stack.pop_back();
+            cmd->materialize();
+            cmd->expandSchema();
+            for (const auto opt : cmd->options)
+                writeOption(path, opt);
+            for (const auto sub : cmd->sortedCommands)
+            {
+                out += path + "\tc\t" + sub->commandName.str() + "\t" + summaryLine(sub->commandDescription) + "\n";
+                stack.push_back({sub, path.empty() ? sub->commandName.str() : path + " " + sub->commandName.str()});
+            }
+        }
+
+        String temp = file + ".tmp";
+#ifdef COMMANDER_CPP_HAS_MMAP
+        temp += std::to_string(getpid());
+#endif
+        {
+            std::ofstream stream(temp, std::ios::binary);
+            stream << out;
+            if (!stream)
+            {
+                if (pLogger)
+                    pLogger->error(String("completion cache ") + file + String(" write failed"));
+                return false;
+            }
+        }
+        return std::rename(temp.c_str(), file.c_str()) == 0;
+    }
+
+    /**
+     * @brief 缓存文件存在且和当前可执行文件的身份一致
+     */
+    bool completionCacheFresh(const String &file)
+    {
+        std::ifstream in(file, std::ios::binary);
+        String header(4096, '\0');
+        in.read(&header[0], static_cast<std::streamsize>(header.size()));
+        header.resize(static_cast<size_t>(in.gcount()));
+        String expected = "#commander-cpp-completion 1\n" + TOOLS::ExecutableIdentity::current().header();
+        return header.compare(0, expected.size(), expected) == 0;
+    }
+
+    /**
+     * @brief 计算补全候选，只沿单词选中的子命令路径前进，子命令在名称索引上按前缀二分查找
+     * @param words 程序名之后的单词，最后一个是光标处正在输入的单词
+     * @return 按字典序排列的候选，光标处应当输入选项的值时为空
+     */
+    Vector<CompletionCandidate> complete(const Vector<String> &words)
+    {
+        Vector<CompletionCandidate> out;
+        if (words.empty())
+            return out;
+
+        Command *cmd = this;
+        const size_t last = words.size() - 1;
+        const String &current = words[last];
+        auto isOption = [](const String &word) { return word.size() > 1 && word[0] == '-'; };
+        for (size_t i = 0; i < last; ++i)
+        {
+            const String &word = words[i];
+            if (!isOption(word))
+            {
+                if (Command *sub = cmd->findCommand(word))
+                    cmd = sub;
+                continue;
+            }
+            if (word.find('=') != String::npos)
+                continue;
+            Option *opt = cmd->completionOption(word);
+            if (!opt || opt->valueName.empty() || !opt->valueIsRequired)
+                continue;
+            // 跳过选项的值，光标处正在输入值时没有候选
+            if (opt->multiValue)
+            {
+                while (i + 1 < last && !isOption(words[i + 1]))
+                    ++i;
+                if (i + 1 == last && !isOption(current))
+                    return out;
+            }
+            else if (++i == last)
+                return out;
+        }
+
+        return cmd->completionCandidates(current);
+    }
+
+    /**
+     * @brief 逐个 token 输入的增量解析器，见 Command::PushParser 的定义
+     */
+    class PushParser;
+
+    /**
+     * @brief 生成 bash、zsh 或 fish 的补全脚本，设置了补全缓存时优先查询缓存，否则调用程序的补全查询入口
+     * @return 不支持的 shell 返回空字符串
+     */
+    String completionScript(const String &shell)
+    {
+        Command *root = rootCommand();
+        String program = root->commandName.str();
+        String entry = root->completionName.empty() ? String("__complete") : root->completionName;
+        const String &cache = root->completionCacheFile;
+        String function = "_" + program;
+        for (auto &c : function)
+        {
+            if (!std::isalnum(static_cast<unsigned char>(c)))
+                c = '_';
+        }
+
+        // 沿单词在缓存中找到命令路径，再按前缀输出候选，规则与 complete 一致
+        static const char *query = R"AWK(BEGIN {
+    FS = "\t"
+    n = split(ENVIRON["COMMANDER_CPP_WORDS"], w, "\037")
+    if (n == 0) { n = 1; w[1] = "" }
+    for (i = 1; i < n; i++) used[w[i]] = 1
+}
+/^#/ { next }
+{
+    if ($1 != "*" && $1 != "") { c = split($1, part, " "); for (j = 1; j <= c; j++) if (!(part[j] in used)) next }
+    kind[$1, $3] = $2
+    line[$1, ++count[$1]] = $0
+}
+END {
+    path = ""
+    for (i = 1; i < n; i++) {
+        word = w[i]
+        if (word ~ /^-./) {
+            if (index(word, "=")) continue
+            key = word
+            if (word !~ /^--/) key = "-" substr(word, length(word), 1)
+            k = ((path, key) in kind) ? kind[path, key] : kind["*", key]
+            if (k == "v") { if (++i == n) exit }
+            else if (k == "m") { while (i + 1 < n && w[i + 1] !~ /^-./) i++; if (i + 1 == n && w[n] !~ /^-./) exit }
+            continue
+        }
+        if (((path, word) in kind) && kind[path, word] == "c") path = (path == "" ? word : path " " word)
+    }
+    cur = w[n]
+    option = cur ~ /^-/
+    for (p = 0; p < 2; p++) {
+        at = p ? "*" : path
+        for (j = 1; j <= count[at]; j++) {
+            split(line[at, j], f, "\t")
+            if ((f[2] == "c") == option) continue
+            if (substr(f[3], 1, length(cur)) != cur) continue
+            if (f[3] !~ /^--/ && length(cur) > 2) continue
+            print (f[4] == "" ? f[3] : f[3] "\t" f[4])
+        }
+    }
+})AWK";
+
+        std::stringstream out;
+        if (shell == "bash" || shell == "zsh")
+        {
+            if (shell == "zsh")
+                out << "#compdef " << program << "\n";
+            out << function << "_query() {\n";
+            if (!cache.empty())
+                out << "    local cache=" << TOOLS::shellQuote(cache, false) << " bin stamp mtime size\n"
+                    << "    bin=$(command -v " << program << ")\n"
+                    << "    if [ -r \"$cache\" ] && [ -n \"$bin\" ]; then\n"
+                    << "        stamp=$(stat -L -c '%Y %s' \"$bin\" 2>/dev/null || stat -L -f '%m %z' \"$bin\" 2>/dev/null)\n"
+                    << "        { read -r _; read -r _; read -r _; read -r mtime; read -r size; } < \"$cache\"\n"
+                    << "        if [ \"$stamp\" = \"${mtime#\\#mtime } ${size#\\#size }\" ]; then\n"
+                    << "            COMMANDER_CPP_WORDS=\"$(IFS=$'\\037'; printf '%s' \"$*\")\" awk '" << query
+                    << "' \"$cache\"\n"
+                    << "            return\n"
+                    << "        fi\n"
+                    << "    fi\n";
+            out << "    " << program << " " << entry << " \"$@\" 2>/dev/null\n"
+                << "}\n";
+        }
+        if (shell == "bash")
+        {
+            out << function << "() {\n"
+                << "    local IFS=$'\\n'\n"
+                << "    COMPREPLY=($(" << function << "_query \"${COMP_WORDS[@]:1:COMP_CWORD}\" | cut -f1))\n"
+                << "}\n"
+                << "complete -o default -F " << function << " " << program << "\n";
+        }
+        else if (shell == "zsh")
+        {
+            out << function << "() {\n"
+                << "    local out\n"
+                << "    local -a candidates\n"
+                << "    out=$(" << function << "_query \"${(@)words[2,CURRENT]}\")\n"
+                << "    [[ -z $out ]] && return 1\n"
+                << "    candidates=(\"${(@f)out}\")\n"
+                << "    candidates=(\"${(@)candidates//:/\\\\:}\")\n"
+                << "    candidates=(\"${(@)candidates//$'\\t'/:}\")\n"
+                << "    _describe '" << program << "' candidates\n"
+                << "}\n"
+                << "compdef " << function << " " << program << "\n";
+        }
+        else if (shell == "fish")
+        {
+            out << "function _" << function << "\n"
+                << "    set -l words (commandline -opc) (commandline -ct)\n"
+                << "    set -e words[1]\n";
+            if (!cache.empty())
+                out << "    set -l cache " << TOOLS::shellQuote(cache, true) << "\n"
+                    << "    set -l bin (command -v " << program << ")\n"
+                    << "    if test -r $cache -a -n \"$bin\"\n"
+                    << "        set -l stamp (stat -L -c '%Y %s' $bin 2>/dev/null; or stat -L -f '%m %z' $bin 2>/dev/null)\n"
+                    << "        set -l head (head -n 5 $cache)\n"
+                    << "        if test \"$stamp\" = (string replace '#mtime ' '' -- $head[4])' '(string replace '#size ' '' -- $head[5])\n"
+                    << "            COMMANDER_CPP_WORDS=(string join \\x1f -- $words) awk '" << query << "' $cache\n"
+                    << "            return\n"
+                    << "        end\n"
+                    << "    end\n";
+            out << "    " << program << " " << entry << " $words 2>/dev/null\n"
+                << "end\n"
+                << "complete -c " << program << " -f -a '(_" << function << ")'\n";
+        }
+        else if (shell != "bash" && shell != "zsh" && pLogger)
+            pLogger->error(String("unsupported shell for completion: ") + shell);
+        return out.str();
+    }
+
+    /**
+     * @brief 设置记录解析阶段耗时的 Profiler，在这个命令上调用 parse 时生效，子命令沿用同一个 Profiler
+     *        未定义 COMMANDER_CPP_ENABLE_PROFILER 时只保存指针，不记录耗时
+     */
+    virtual Command *profiler(Profiler *profiler)
+    {
+        pProfiler = profiler;
+        return this;
+    }
+    Profiler *profiler()
+    {
+        return pProfiler;
+    }
+
+    /**
+     * @param argc
+     * @param argv
+     * @param index 开始解析的索引，默认从1开始，0为命令本身
+     * @return 解析结果，第一个错误的错误码和 argv 下标，解析过程不抛出异常
+     */
+    ParseResult parse(int argc, char **argv, int index = 1)
+    {
+#ifdef COMMANDER_CPP_ENABLE_PROFILER
+        Profiler::Install install(pProfiler);
+#endif
+        // 补全查询不执行 action，也不做参数校验
+        if (!completionName.empty() && index < argc && completionName == argv[index])
+        {
+            Vector<String> words(argv + index + 1, argv + argc);
+            if (words.empty())
+                words.emplace_back();
+            String out;
+            for (const auto &c : complete(words))
+                out += c.value + (c.description.empty() ? String() : "\t" + c.description) + "\n";
+            if (!out.empty() && pLogger)
+            {
+                out.pop_back();
+                pLogger->print(out);
+            }
+            // 脚本只在缓存过期时才会调用程序，顺便重写缓存，之后的补全直接查询缓存
+            if (!completionCacheFile.empty() && !completionCacheFresh(completionCacheFile))
+                writeCompletionCache(completionCacheFile);
+            return ParseResult();
+        }
+
+        COMMANDER_CPP_PROBE2(parse_start, commandName.str().c_str(), argc);
+        const auto begin = std::chrono::steady_clock::now();
+        ParseContext ctx;
+        parseExpanded(argc, argv, index, ctx);
+        COMMANDER_CPP_PROBE1(parse_end, commandName.str().c_str());
+        if (recorder)
+        {
+            const auto end = std::chrono::steady_clock::now();
+            uint64_t wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::system_clock::now().time_since_epoch() - (end - begin))
+                                .count();
+            recorder->append(argc, argv, index, wall,
+                             std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(),
+                             ctx.result.code);
+        }
+        return ctx.result;
+    }
+
+    /**
+     * @brief 把之后每次 parse 的 argv、开始时间、耗时（包括 action）和结果追加到记录文件，空路径表示停止记录
+     *        validate 和 replay 不会被记录；只能在根命令上设置
+     */
+    Command *record(const String &path)
+    {
+        if (parentCommand)
+        {
+            if (pLogger)
+                pLogger->warn(String("record can only be set on the root command"));
+            return this;
+        }
+        recorder.reset();
+        if (path.empty())
+            return this;
+        recorder = std::make_shared<InvocationRecorder>(path);
+        if (!recorder->isOpen())
+        {
+            if (pLogger)
+                pLogger->error(String("invocation log ") + path + String(" open failed"));
+            recorder.reset();
+        }
+        return this;
+    }
+
+    /**
+     * @brief 把记录的调用按顺序重新交给当前命令树，用真实的调用分布比较不同版本的解析耗时和结果
+     * @param dispatch 为 true 时调用 parse 并执行 action，否则调用 validate
+     */
+    ReplayReport replay(const String &path, bool dispatch = false)
+    {
+        ReplayReport report;
+        InvocationLog log;
+        if (!log.open(path))
+        {
+            report.failure = log.error();
+            return report;
+        }
+        // 回放本身不再被记录
+        std::shared_ptr<InvocationRecorder> saved = std::move(recorder);
+        recorder.reset();
+
+        Vector<uint64_t> latencies;
+        Vector<String> words;
+        Vector<char *> argv;
+        log.forEach([&](const Invocation &record) {
+            words.assign(record.argv.begin(), record.argv.end());
+            argv.clear();
+            for (auto &word : words)
+                argv.push_back(&word[0]);
+            argv.push_back(nullptr);
+            const int argc = static_cast<int>(words.size());
+
+            const auto begin = std::chrono::steady_clock::now();
+            ParseResult result = dispatch ? parse(argc, argv.data(), record.index)
+                                          : validate(argc, argv.data(), record.index);
+            const auto elapsed = std::chrono::steady_clock::now() - begin;
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+            ++report.records;
+            report.recordedNs += record.durationNs;
+            report.replayNs += latencies.back();
+            if (result.code != record.code)
+                ++report.mismatches;
+        });
+        recorder = std::move(saved);
+
+        if (!latencies.empty())
+        {
+            std::sort(latencies.begin(), latencies.end());
+            report.p50Ns = latencies[latencies.size() / 2];
+            report.p99Ns = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+            report.maxNs = latencies.back();
+        }
+        return report;
+    }
+
+    /**
+     * @brief 只检查不执行：和 parse 一样切分、查找子命令和选项、转换值并检查必填参数，
+     *        但不调用 action 和 visitor，也不输出日志、帮助和版本信息，诊断只记录在返回值中
+     *        在 freeze 之后的命令树上可以并发调用
+     */
+    ParseResult validate(int argc, char **argv, int index = 1)
+    {
+        ParseContext ctx;
+        ctx.dryRun = true;
+        parseExpanded(argc, argv, index, ctx);
+        return ctx.result;
+    }
+
+    /**
+     * @brief 用 validate 检查文件中的每一行命令行，文件按行切分成多个分片在多个线程上并行检查
+     *        每行按响应文件的规则切分，第一个 token 是程序名；空行和以 # 开头的行被跳过
+     * @param threads 线程数，0 表示使用硬件并发数
+     * @param maxDetails 最多记录多少行的诊断
+     * @param responseFiles 为 false 时不展开行中的 "@file"，它们按普通 token 检查，不会打开任何文件
+     */
+    LintReport lint(const String &path, unsigned threads = 0, size_t maxDetails = 1000, bool responseFiles = true)
+    {
+        LintReport report;
+        TOOLS::MappedFile file;
+        if (!file.open(path, false))
+        {
+            report.failure = path + " open failed";
+            return report;
+        }
+        freeze();
+
+        const char *begin = file.size() ? file.data() : nullptr;
+        const char *end = begin + file.size();
+        // 每个分片至少 64KB，分片边界对齐到行首
+        threads = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, file.size() / (64 << 10) + 1)));
+        Vector<const char *> bounds{begin};
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            const char *p = std::max(bounds.back(), begin + file.size() * t / threads);
+            p = std::find(p, end, '\n');
+            bounds.push_back(p == end ? end : p + 1);
+        }
+        bounds.push_back(end);
+
+        Vector<LintReport> parts(threads);
+        Vector<size_t> lineCounts(threads, 0);
+        auto check = [&](unsigned t) {
+            LintReport &part = parts[t];
+            String buffer;
+            Vector<char *> tokens;
+            size_t line = 0;
+            for (const char *p = bounds[t]; p < bounds[t + 1];)
+            {
+                const char *q = std::find(p, bounds[t + 1], '\n');
+                ++line;
+                buffer.assign(p, q);
+                p = q + 1;
+                size_t first = buffer.find_first_not_of(" \t\r");
+                if (first == String::npos || buffer[first] == '#')
+                    continue;
+
+                ++part.lines;
+                buffer.push_back('\0');
+                tokens.clear();
+                if (!TOOLS::tokenize(&buffer[0], &buffer[0] + buffer.size() - 1, tokens))
+                {
+                    // 行按响应文件的规则切分，引号不匹配和响应文件中的一样处理
+                    ++part.errors;
+                    ++part.counts[ErrorCode::ResponseFile];
+                    if (part.details.size() < maxDetails)
+                        part.details.push_back({line, ErrorCode::ResponseFile, "error: unterminated quote\n"});
+                    continue;
+                }
+                int argc = static_cast<int>(tokens.size());
+                tokens.push_back(nullptr);
+                ParseContext ctx;
+                ctx.dryRun = true;
+                ctx.responseFiles = responseFiles;
+                parseExpanded(argc, tokens.data(), 1, ctx);
+                const ParseResult &result = ctx.result;
+                if (result.diagnostics.empty())
+                    continue;
+                ++(result.ok() ? part.warnings : part.errors);
+                for (const auto &d : result.diagnostics)
+                    ++part.counts[d.code];
+                if (part.details.size() < maxDetails)
+                    part.details.push_back({line, result.code, result.format(argc, tokens.data())});
+            }
+            lineCounts[t] = line;
+        };
+
+        Vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back(check, t);
+        check(0);
+        for (auto &worker : workers)
+            worker.join();
+
+        // 分片按文件顺序合并，行号加上前面分片的行数
+        size_t offset = 0;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            report.lines += parts[t].lines;
+            report.errors += parts[t].errors;
+            report.warnings += parts[t].warnings;
+            for (const auto &count : parts[t].counts)
+                report.counts[count.first] += count.second;
+            for (auto &line : parts[t].details)
+            {
+                if (report.details.size() >= maxDetails)
+                    break;
+                line.line += offset;
+                report.details.push_back(std::move(line));
+            }
+            offset += lineCounts[t];
+        }
+        return report;
+    }
+
+  private:
+    /*
+     * 一次 parse 调用内、在各层子命令之间共享的状态
+     */
+    struct ParseContext
+    {
+        // 只检查不执行：不调用 action 和 visitor，不输出日志
+        bool dryRun = false;
+        // 为 false 时不展开 "@file"，即使命令开启了响应文件
+        bool responseFiles = true;
+        bool profile = false;
+        String profileFile;
+        ParseResult result;
+
+        void report(const Diagnostic &d)
+        {
+            result.diagnostics.push_back(d);
+            // 只保留第一个错误
+            if (d.severity == Severity::Error && result.ok())
+            {
+                result.code = d.code;
+                result.index = d.index;
+            }
+        }
+    };
+
+    Command *rootCommand()
+    {
+        Command *root = this;
+        while (root->parentCommand)
+            root = root->parentCommand;
+        return root;
+    }
+
+    void parseExpanded(int argc, char **argv, int index, ParseContext &ctx)
+    {
+        if (!responseFileEnabled || !ctx.responseFiles)
+        {
+            parseArgv(argc, argv, index, ctx);
+            return;
+        }
+
+        // 展开后的 token 直接指向文件映射，映射需要存活到解析（包括 action）结束
+        Vector<std::unique_ptr<TOOLS::MappedFile>> files;
+        Vector<char *> expanded(argv, argv + std::min(index, argc));
+        if (!expandResponseFiles(argc, argv, index, expanded, files, 0, !ctx.dryRun))
+        {
+            // 具体原因已经在展开时输出到日志，dryRun 时不输出
+            Diagnostic d;
+            d.code = ErrorCode::ResponseFile;
+            ctx.report(d);
+            return;
+        }
+
+        parseArgv(static_cast<int>(expanded.size()), expanded.data(), index, ctx);
+    }
+
+    bool expandResponseFiles(int argc, char **argv, int index, Vector<char *> &out,
+                             Vector<std::unique_ptr<TOOLS::MappedFile>> &files, int depth, bool log)
+    {
+        for (int i = index; i < argc; ++i)
+        {
+            char *arg = argv[i];
+            if (arg[0] != '@' || arg[1] == '\0')
+            {
+                out.push_back(arg);
+                continue;
+            }
+
+            if (depth >= responseFileMaxDepth)
+            {
+                if (pLogger && log)
+                    pLogger->error(String("response file: ") + (arg + 1) + String(" exceeds max depth: ") +
+                                   std::to_string(responseFileMaxDepth));
+                return false;
+            }
+
+            auto file = std::make_unique<TOOLS::MappedFile>();
+            if (!file->open(arg + 1))
+            {
+                if (pLogger && log)
+                    pLogger->error(String("response file: ") + (arg + 1) + String(" open failed"));
+                return false;
+            }
+
+            Vector<char *> tokens;
+            if (!TOOLS::tokenize(file->data(), file->data() + file->size(), tokens))
+            {
+                if (pLogger && log)
+                    pLogger->error(String("response file: ") + (arg + 1) + String(" has an unterminated quote"));
+                return false;
+            }
+            files.push_back(std::move(file));
+
+            if (!expandResponseFiles(static_cast<int>(tokens.size()), tokens.data(), 0, out, files, depth + 1, log))
+                return false;
+        }
+        return true;
+    }
+
+    void parseArgv(int argc, char **argv, int index, ParseContext &ctx)
+    {
+        materialize();
+#ifdef COMMANDER_CPP_ENABLE_PROFILER
+        Profiler::CommandSpan span(commandName.str());
+#endif
+        Vector<Variant> args;
+        Map<String, Variant> opts;
+        // 设置了 compactAction 时值只存入这两个容器
+        Vector<CompactValue> compactArgs;
+        Map<String, CompactValue> compactOpts;
+        const bool compact = static_cast<bool>(compactCallback);
+        // 已解析的位置参数个数，包括流式交给 visitor 的值
+        size_t positional = 0;
+        // 当前正在解析的原始 token 及其下标，"--opt=value" 中的 value 可直接指向它
+        const char *currentToken = nullptr;
+        int currentIndex = index;
+
+        int cur = index;
+
+        enum LogType{D,W,E,P};
+        auto log = [this, &ctx](LogType type, const String &msg) {
+            if (!pLogger || ctx.dryRun)
+                return;
+            if (type == D) pLogger->debug(msg);
+            if (type == W) pLogger->warn(msg);
+            if (type == E) pLogger->error(msg);
+            if (type == P) pLogger->print(msg);
+        };
+
+        // 记录诊断，只有设置了日志对象时才格式化文本
+        auto report = [&](ErrorCode code, Severity severity, int at, const String *name = nullptr, int element = -1) {
+            Diagnostic d;
+            d.code = code;
+            d.severity = severity;
+            d.index = at;
+            d.command = commandName.id();
+            d.name = name;
+            d.element = element;
+            ctx.report(d);
+            if (pLogger && !ctx.dryRun)
+                pLogger->diagnostic(d, at >= 0 && at < argc ? argv[at] : nullptr);
+        };
+        // 所有值转换失败都经过这里：触发 convert_failed 探针后报告错误
+        // target 是选项名或位置参数名，element 为 -1 表示不是列表中的元素
+        auto conversionFailed = [&](ErrorCode code, int at, const char *token, const char *target, const String *name,
+                                    int element) {
+            COMMANDER_CPP_PROBE4(convert_failed, commandName.str().c_str(), target, element, token);
+            report(code, Severity::Error, at, name, element);
+        };
+
+        // token 的识别不构造字符串，也不使用正则
+        auto isOption = [](const char *token) {
+            COMMANDER_CPP_PHASE(Phase::Tokenize);
+            return TOOLS::isOptionToken(token);
+        };
+
+        auto getBaseValue = [](std::string_view text) { return autoValue<VariantBase>(text); };
+        auto getValue = [](std::string_view text) { return autoValue<Variant>(text); };
+        // compactAction 使用：规则与 getValue 相同，结果直接存入 CompactValue
+        auto getCompactValue = [](std::string_view text) { return autoValue<CompactValue>(text); };
+
+        auto parseCommand = [&](const String &name) {
+            log(D, String("try parse command: ") + name);
+            Command *command = findCommand(name);
+            if (!command)
+            {
+                log(D, name + " is not a sub command");
+                return false;
+            }
+
+            log(D, "parse command: " + name + " success");
+            COMMANDER_CPP_PROBE2(command_selected, commandName.str().c_str(), command->commandName.str().c_str());
+            command->parseArgv(argc, argv, ++cur, ctx);
+            return true;
+        };
+        auto parseOptionName = [&](std::string_view name, std::string_view value = std::string_view()) {
+            log(D, String("try parse option name: ") + String(name) + String(", value: ") + String(value));
+            Option *opt = matchOption(name, false);
+            if (!opt)
+            {
+                report(ErrorCode::UnknownOption, Severity::Warning, cur);
+                ++cur;
+                return true;
+            }
+            COMMANDER_CPP_PROBE2(option_matched, commandName.str().c_str(), opt->name.str().c_str());
+            const int optionIndex = currentIndex;
+            const OptionBinding binding = bindingOf(opt);
+
+            // 全局的性能分析选项不交给 action，只记录在本次解析的状态中
+            if (binding == OptionBinding::Profile)
+            {
+                ctx.profile = true;
+                ctx.profileFile = String(value);
+                cur++;
+                return true;
+            }
+
+            Variant v;
+            // compact 模式下从 token 直接得到的值，其余情况（默认值、开关）仍从 v 转换
+            CompactValue cv;
+            bool haveCompact = false;
+
+            if (binding == OptionBinding::Switch)
+            {
+                if (!value.empty())
+                    report(ErrorCode::UnexpectedValue, Severity::Warning, optionIndex, opt->name.id());
+            }
+            else if (binding == OptionBinding::Optional)
+            {
+                // 可选值只能通过 --opt=value 传入
+                if (!value.empty())
+                    v = getValue(value);
+            }
+            else if (binding == OptionBinding::Default)
+            {
+                log(D, "option: " + opt->name.str() + " use default value");
+                v = opt->defaultValue;
+            }
+            else if (binding == OptionBinding::List && typedList(opt, ctx.dryRun))
+            {
+                // 带元素类型的多值选项不做自动类型识别，token 直接转换到紧凑存储
+                Vector<const char *> tokens;
+                int firstToken = cur + 1;
+                if (!value.empty())
+                {
+                    firstToken = cur;
+                    tokens.push_back(std::strchr(currentToken, '=') + 1);
+                }
+                else
+                {
+                    while (++cur < argc)
+                    {
+                        if (TOOLS::isOptionToken(argv[cur]))
+                        {
+                            --cur;
+                            break;
+                        }
+                        tokens.push_back(argv[cur]);
+                    }
+                }
+
+                if (tokens.empty())
+                {
+                    report(ErrorCode::MissingValue, Severity::Error, optionIndex, opt->name.id());
+                    ++cur;
+                    return false;
+                }
+
+                size_t badIndex = 0;
+                unsigned threads = conversionThreads(tokens.size());
+                TOOLS::WorkerPool *pool = threads > 1 ? conversionWorkers() : nullptr;
+                haveCompact = compact;
+                if (compact ? !convertCompactList(opt->elementType, tokens, cv, badIndex, threads, pool)
+                            : !convertList(opt->elementType, tokens, v, badIndex, threads, pool))
+                {
+                    conversionFailed(ErrorCode::InvalidValue, firstToken + static_cast<int>(badIndex),
+                                     tokens[badIndex], opt->name.str().c_str(), opt->name.id(),
+                                     static_cast<int>(badIndex));
+                    return false;
+                }
+            }
+            else if (binding == OptionBinding::List)
+            {
+                std::vector<VariantBase> mv;
+                Vector<CompactValue> items;
+                size_t count = 0;
+                // 非空文本转换为空值说明数值超出范围，报告这个元素并停止解析
+                auto outOfRange = [&](bool empty, int at, std::string_view text) {
+                    if (!empty)
+                        return false;
+                    conversionFailed(ErrorCode::ValueOutOfRange, at, text.data(), opt->name.str().c_str(),
+                                     opt->name.id(), static_cast<int>(count));
+                    return true;
+                };
+                // 设置了 visitor 时，值直接交给 visitor，不再收集
+                auto collect = [&](std::string_view text, int at) {
+                    if (compact && !(opt->visitor && !ctx.dryRun))
+                    {
+                        CompactValue item = getCompactValue(text);
+                        if (outOfRange(item.isEmpty(), at, text))
+                            return false;
+                        items.push_back(std::move(item));
+                        ++count;
+                        return true;
+                    }
+                    auto nv = getBaseValue(text);
+                    if (outOfRange(std::holds_alternative<std::monostate>(nv), at, text))
+                        return false;
+                    if (opt->visitor && !ctx.dryRun)
+                        opt->visitor(count, nv);
+                    else
+                        mv.push_back(std::move(nv));
+                    ++count;
+                    return true;
+                };
+                if (!value.empty())
+                {
+                    if (!collect(value, optionIndex))
+                        return false;
+                }
+                else
+                {
+                    while (++cur < argc)
+                    {
+                        std::string_view arg = argv[cur];
+                        log(D, "try get value from identifier: " + String(arg));
+                        if (isOption(argv[cur]))
+                        {
+                            --cur;
+                            break;
+                        }
+                        if (arg.empty())
+                            continue;
+                        if (!collect(arg, cur))
+                            return false;
+                    }
+                }
+
+                if (count == 0)
+                {
+                    report(ErrorCode::MissingValue, Severity::Error, optionIndex, opt->name.id());
+                    ++cur;
+                    return false;
+                }
+
+                if (compact)
+                {
+                    cv = CompactValue::list(std::move(items), ValueType::Auto);
+                    haveCompact = true;
+                }
+                else
+                    v = mv;
+            }
+            else
+            {
+                std::string_view valueText = !value.empty() ? value : ++cur < argc ? argv[cur] : "";
+                log(D, "try get value from identifier: " + String(valueText));
+                if (valueText.empty() || isOption(valueText.data()))
+                {
+                    report(ErrorCode::MissingValue, Severity::Error, optionIndex, opt->name.id());
+                    ++cur;
+                    return false;
+                }
+
+                if (compact)
+                {
+                    cv = getCompactValue(valueText);
+                    haveCompact = true;
+                }
+                else
+                    v = getValue(valueText);
+
+                if (haveCompact ? cv.isEmpty() : std::holds_alternative<std::monostate>(v))
+                {
+                    // 非空文本只有数值超出范围时才转换失败
+                    conversionFailed(ErrorCode::ValueOutOfRange, !value.empty() ? optionIndex : cur,
+                                     valueText.data(), opt->name.str().c_str(), opt->name.id(), -1);
+                    return false;
+                }
+            }
+
+            if (compact)
+                compactOpts[opt->name.str()] = haveCompact ? std::move(cv) : CompactValue::fromVariant(v);
+            else
+                opts[opt->name.str()] = std::move(v);
+            cur++;
+            return true;
+        };
+        auto parseMuiltOptionAlias = [&](std::string_view alias, std::string_view value = std::string_view()) {
+            log(D, String("try parse multi option alias: ") + String(alias));
+            const int clusterIndex = currentIndex;
+            bool lastMatched = false;
+            // 每个别名都从组合所在的 token 开始解析，只有最后一个别名可以读取后面的 token
+            bool ok = forEachAlias(alias, clusterIndex, report, [&](Option *opt, bool last) {
+                cur = clusterIndex;
+                lastMatched = last;
+                return parseOptionName(opt->name.str(), last ? value : std::string_view());
+            });
+            if (!ok)
+                return false;
+            if (!lastMatched)
+                cur = clusterIndex + 1;
+            return true;
+        };
+        auto parseArgument = [&](std::string_view arg) {
+            log(D, String("try parse argument: ") + String(arg));
+
+            ErrorCode warning = argumentWarning(arg);
+            if (warning != ErrorCode::None)
+            {
+                report(warning, Severity::Warning, cur);
+                ++cur;
+                return true;
+            }
+
+            // 非空文本只有数值超出范围时才转换失败，和选项值一样作为错误处理，不再执行 action
+            Variant v;
+            CompactValue cv;
+            if (compact)
+                cv = getCompactValue(arg);
+            else
+                v = getValue(arg);
+            if (compact ? cv.isEmpty() : std::holds_alternative<std::monostate>(v))
+            {
+                const Argument *target = arguments[std::min(positional, arguments.size() - 1)];
+                conversionFailed(ErrorCode::ValueOutOfRange, cur, arg.data(), target->name.c_str(), nullptr, -1);
+                return false;
+            }
+
+            log(D, "parse argument: " + String(arg) + " success");
+
+            cur++;
+            // 超出定义个数的值都归属最后一个参数
+            size_t argIndex = std::min(positional, arguments.size() - 1);
+            Argument *target = arguments[argIndex];
+            if (target->visitor && target->isMultiValue && !ctx.dryRun)
+            {
+                target->visitor(positional - argIndex, getBaseValue(arg));
+                ++positional;
+                return true;
+            }
+
+            ++positional;
+            if (compact)
+                compactArgs.push_back(std::move(cv));
+            else
+                args.push_back(std::move(v));
+            return true;
+        };
+        while (cur < argc)
+        {
+            currentToken = argv[cur];
+            currentIndex = cur;
+            log(D, String("try parse identifier: ") + currentToken);
+            bool commandToken = false;
+            bool optionToken = false;
+            TOOLS::OptionToken option;
+            {
+                COMMANDER_CPP_PHASE(Phase::Tokenize);
+                commandToken = TOOLS::isCommandToken(currentToken);
+                optionToken = !commandToken && TOOLS::splitOptionToken(currentToken, option);
+            }
 
-                        for (auto it = descList.begin() + 1; it < descList.end(); ++it)
-                        {
-                            lines.push_back({{}, {*it}});
-                        }
-                    }
-                    lines.push_back({});
-                }
+            // 尝试解析子命令
+            if (commandToken)
+            {
+                // 如果解析到子命令直接就使用子命令的解析了，不再继续当前的解析了
+                if (parseCommand(currentToken))
+                    return;
+                // 否则继续解析
+            }
+            // 尝试解析选项或选项别名
+            if (optionToken)
+            {
+                if (option.isLong ? parseOptionName(option.name, option.value)
+                                  : parseMuiltOptionAlias(option.name, option.value))
+                    continue;
+                return;
+            }
+            // 尝试解析参数，失败时已经报告了错误，直接结束
+            if (parseArgument(currentToken))
+                continue;
+            return;
+        }
+
+        {
+            COMMANDER_CPP_PHASE(Phase::Dispatch);
+            auto given = [&](Option *opt) {
+                return compact ? compactOpts.count(opt->name.str()) != 0 : opts.count(opt->name.str()) != 0;
             };
+            if (given(versionOption))
+            {
+                log(P, version());
+                return;
+            }
 
-            auto mergeLines = [&]() {
-                std::vector<int> columnMaxLens;
-                std::stringstream out;
+            if (given(helpOption))
+            {
+                if (!ctx.dryRun)
+                    log(P, helpText());
+                return;
+            }
+        }
 
-                // 先遍历每一行，每一列的最长长度
-                for (auto columns : lines)
+        {
+            COMMANDER_CPP_PHASE(Phase::Validate);
+            bool argsEmpty = positional == 0;
+            for (const auto arg : arguments)
+            {
+                if (arg->valueIsRequired)
                 {
-                    if (columns.size() <= 1)
-                        continue;
-
-                    for (int i = 0; i < columns.size(); ++i)
+                    if (argsEmpty)
                     {
-                        int s = 0;
-                        try
-                        {
-                            s = columnMaxLens.at(i);
-                        }
-                        catch (const std::exception &e)
-                        {
-                            columnMaxLens.emplace_back(s);
-                        }
-
-                        String column = columns.at(i);
-                        s = std::max<int>(s, column.size());
-
-                        columnMaxLens[i] = s;
+                        report(ErrorCode::MissingArgument, Severity::Error, -1, NameTable::intern(arg->name));
+                        return;
                     }
+                    break;
                 }
+            }
+        }
 
-                // 将每一列短的补空格补齐，然后重新组织文本
-                for (auto columns : lines)
-                {
-                    if (columns.size() == 1)
-                    {
-                        String c = columns.at(0);
-                        out << c << std::endl;
-                        continue;
-                    }
+        if ((actionCallback || compactCallback) && !ctx.dryRun)
+        {
+            COMMANDER_CPP_PHASE(Phase::Action);
+            TOOLS::ResourceProfile profile;
+            if (ctx.profile)
+                profile.start();
+            COMMANDER_CPP_PROBE1(action_start, commandName.str().c_str());
+            if (compact)
+                compactCallback(this, std::move(compactArgs), std::move(compactOpts));
+            else
+                actionCallback(this, std::move(args), std::move(opts));
+            COMMANDER_CPP_PROBE1(action_end, commandName.str().c_str());
+            if (ctx.profile)
+                reportProfile(profile.stop(), ctx.profileFile);
+        }
+    }
 
-                    for (int i = 0; i < columns.size(); ++i)
-                    {
-                        int s = columnMaxLens.at(i);
-                        String c = columns.at(i);
-                        out << c;
-                        int l = s - c.size();
-                        if (l >= 0)
-                        {
-                            String space;
-                            // 这里+2是让每一列不要紧挨着，中间留两个空格的宽度
-                            space.resize(l + 2, ' ');
-                            out << space;
-                        }
-                    }
-                    out << std::endl;
-                }
-                return out.str();
-            };
+    void reportProfile(const TOOLS::ResourceProfile::Sample &sample, const String &file)
+    {
+        String path = commandName.str();
+        for (Command *p = parentCommand; p; p = p->parentCommand)
+            path = p->commandName.str() + " " + path;
 
-            collectUsage();
-            collectDescription();
-            collectArguments();
-            collectOptions();
-            collectCommands();
+        if (file.empty())
+        {
+            std::cerr << TOOLS::ResourceProfile::toText(path, sample) << std::flush;
+            return;
+        }
 
-            return mergeLines();
+        std::ofstream out(file, std::ios::binary);
+        out << TOOLS::ResourceProfile::toJson(path, sample);
+        if (!out && pLogger)
+            pLogger->error(String("profile: write ") + file + String(" failed"));
+    }
+
+    /*
+     * 自动类型识别后构造 VariantBase、Variant 或 CompactValue，数值超出范围时返回空值
+     * text 必须以 '\0' 结尾：它总是 argv 中的 token 或 token 的后缀
+     */
+    template <typename V> static V autoValue(std::string_view text)
+    {
+        COMMANDER_CPP_PHASE(Phase::Convert);
+        auto textValue = [](std::string_view value) {
+            if constexpr (std::is_same_v<V, CompactValue>)
+                return V(value);
+            else
+                return V(String(value));
         };
-        return !helpOption->desc.empty() ? helpOption->desc : getHelpText();
+        switch (TOOLS::classifyScalar(text))
+        {
+        case TOOLS::ScalarKind::Int: {
+            int n = 0;
+            return TOOLS::parseElement(text.data(), n) ? V(n) : V();
+        }
+        case TOOLS::ScalarKind::Double: {
+            double d = 0;
+            return TOOLS::parseElement(text.data(), d) ? V(d) : V();
+        }
+        case TOOLS::ScalarKind::Bool:
+            // 沿用原有的识别结果
+            return V(text == "false");
+        case TOOLS::ScalarKind::Quoted:
+            return textValue(text.substr(1, text.size() - 2));
+        case TOOLS::ScalarKind::Text:
+            return textValue(text);
+        default:
+            return V();
+        }
     }
 
-    /**
-     * @param nameAndArg 命令名称和参数定义字符串，例如 "copy <from...> | [to...]"
-     * @return new Command
+    /*
+     * 根据根命令的设置计算转换 count 个值需要的线程数，1 表示串行
      */
-    virtual Command *command(const String &nameAndArg, const String &desc = String())
+    unsigned conversionThreads(size_t count)
     {
-        if (pLogger)
-            pLogger->debug(String("create command: nameAndArg: ") + nameAndArg);
-        std::regex reg(
-            R"(^\s*([a-zA-Z][a-zA-Z\d]+)\s*((?:\[[a-zA-Z][a-zA-Z\d]+(?:\.\.\.)?\])|(?:<[a-zA-Z][a-zA-Z\d]+(?:\.\.\.)?>))?\s*$)");
-        std::smatch res;
-        if (!std::regex_search(nameAndArg, res, reg))
-            return nullptr;
-        String name = res.str(1);
-        String arg = res.str(2);
-        Command *cmd = (new Command(name, pLogger))->description(desc)->argument(arg);
+        Command *root = this;
+        while (root->parentCommand)
+            root = root->parentCommand;
 
-        addCommand(cmd);
+        if (root->parallelThreshold == 0 || count < root->parallelThreshold)
+            return 1;
 
-        return cmd;
-    };
-    virtual Command *addCommand(Command *command)
+        unsigned threads = root->parallelThreads ? root->parallelThreads : std::thread::hardware_concurrency();
+        return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, count)));
+    }
+
+    /*
+     * 根命令上的转换线程池，第一次使用时创建；调用线程自己也转换一个分块，所以池中少一个线程
+     */
+    TOOLS::WorkerPool *conversionWorkers()
     {
-        if (!command)
+        Command *root = rootCommand();
+        std::lock_guard<std::mutex> lock(root->conversionPoolMutex);
+        if (!root->conversionPool)
         {
-            if (pLogger)
-                pLogger->warn(String("add command failed, command is null"));
-            return this;
+            unsigned threads = root->parallelThreads ? root->parallelThreads : std::thread::hardware_concurrency();
+            root->conversionPool = std::make_unique<TOOLS::WorkerPool>(std::max(2u, threads) - 1);
         }
+        return root->conversionPool.get();
+    }
+
+    template <typename T, typename F>
+    static bool convertElements(const Vector<const char *> &tokens, Vector<T> &out, size_t &badIndex, unsigned threads,
+                                TOOLS::WorkerPool *pool, F convert)
+    {
+        out.resize(tokens.size());
+        // 每个分块只记录自己的第一个非法位置，最终取最小值，保证报错结果与串行一致
+        auto convertChunk = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+            {
+                if (!convert(tokens[i], out[i]))
+                    return i;
+            }
+            return tokens.size();
+        };
 
-        if (findCommand(command->commandName))
+        size_t firstBad = tokens.size();
+        if (threads <= 1 || !pool)
         {
-            if (pLogger)
-                pLogger->warn(String("add command failed, command ") + command->commandName +
-                              String(" already exists"));
-            return this;
+            firstBad = convertChunk(0, tokens.size());
+        }
+        else
+        {
+            size_t chunk = (tokens.size() + threads - 1) / threads;
+            Vector<size_t> bad(threads, tokens.size());
+            std::mutex doneMutex;
+            std::condition_variable doneChanged;
+            unsigned pending = threads - 1;
+            for (unsigned t = 1; t < threads; ++t)
+            {
+                size_t begin = std::min(tokens.size(), t * chunk);
+                size_t end = std::min(tokens.size(), begin + chunk);
+                pool->submit([&, t, begin, end]() {
+                    bad[t] = convertChunk(begin, end);
+                    // 持有锁时通知，等待方返回并销毁这些局部变量之前本任务已经不再访问它们
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    --pending;
+                    doneChanged.notify_one();
+                });
+            }
+            bad[0] = convertChunk(0, std::min(tokens.size(), chunk));
+            std::unique_lock<std::mutex> lock(doneMutex);
+            doneChanged.wait(lock, [&] { return pending == 0; });
+            firstBad = *std::min_element(bad.begin(), bad.end());
         }
 
-        command->parentCommand = this;
-        command->versionOption = versionOption;
-        command->helpOption = helpOption;
-        if (!command->pLogger)
-            command->pLogger = pLogger;
+        if (firstBad != tokens.size())
+        {
+            badIndex = firstBad;
+            return false;
+        }
+        return true;
+    }
 
-        subCommands.push_back(command);
-        return this;
-    };
+    static bool convertList(ValueType type, const Vector<const char *> &tokens, Variant &v, size_t &badIndex,
+                            unsigned threads = 1, TOOLS::WorkerPool *pool = nullptr)
+    {
+        COMMANDER_CPP_PHASE(Phase::Convert);
+        auto parse = [](const char *text, auto &value) { return TOOLS::parseElement(text, value); };
+        switch (type)
+        {
+        case ValueType::Int64: {
+            Int64List list;
+            if (!convertElements(tokens, list, badIndex, threads, pool, parse))
+                return false;
+            v = std::move(list);
+            return true;
+        }
+        case ValueType::Double: {
+            DoubleList list;
+            if (!convertElements(tokens, list, badIndex, threads, pool, parse))
+                return false;
+            v = std::move(list);
+            return true;
+        }
+        case ValueType::StringView: {
+            StringViewList list;
+            if (!convertElements(tokens, list, badIndex, threads, pool, parse))
+                return false;
+            v = std::move(list);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
 
-    /**
-     * @param name 参数名称和定义字符串，例如 "<todo...>" 或 "[todo...]"
-     * @return this
+    /*
+     * compactAction 使用：token 直接转换成 CompactValue 列表，不经过 Variant
      */
-    virtual Command *argument(const String &name, const String &desc = String(), const Variant &defaultValue = Variant())
+    static bool convertCompactList(ValueType type, const Vector<const char *> &tokens, CompactValue &v,
+                                   size_t &badIndex, unsigned threads = 1, TOOLS::WorkerPool *pool = nullptr)
     {
-        Argument *arg = Argument::create(name, pLogger);
-        if (!arg)
+        COMMANDER_CPP_PHASE(Phase::Convert);
+        Vector<CompactValue> items;
+        bool converted = false;
+        switch (type)
         {
-            if (pLogger)
-                pLogger->error(String("argument ") + name + String(" create failed"));
-            return this;
+        case ValueType::Int64:
+            converted = convertElements(tokens, items, badIndex, threads, pool, [](const char *text, CompactValue &value) {
+                int64_t n = 0;
+                if (!TOOLS::parseElement(text, n))
+                    return false;
+                value = CompactValue(n);
+                return true;
+            });
+            break;
+        case ValueType::Double:
+            converted = convertElements(tokens, items, badIndex, threads, pool, [](const char *text, CompactValue &value) {
+                double d = 0;
+                if (!TOOLS::parseElement(text, d))
+                    return false;
+                value = CompactValue(d);
+                return true;
+            });
+            break;
+        case ValueType::StringView:
+            converted = convertElements(tokens, items, badIndex, threads, pool, [](const char *text, CompactValue &value) {
+                value = CompactValue::view(text);
+                return true;
+            });
+            break;
+        default:
+            break;
         }
+        if (!converted)
+            return false;
+        v = CompactValue::list(std::move(items), type);
+        return true;
+    }
 
-        arg->desc = desc;
-        arg->defaultValue = defaultValue;
-        arguments.push_back(arg);
-        return this;
-    };
-
+  public:
+    /*
+     * 通过名称查找子命令
+     */
+    Command *findCommand(const String &name)
+    {
+        COMMANDER_CPP_PHASE(Phase::Lookup);
+        auto range = commandRange(name);
+        if (range.first != range.second && (*range.first)->commandName.str() == name)
+            return (*range.first)->materialize();
+        // 从 schema 加载的命令在第一次选中时才构造子命令
+        if (schemaLink && !schemaExpanded)
+        {
+            uint32_t index = schemaLink->schema.findChild(schemaIndex, name);
+            if (index != Schema::None)
+                return attachFromSchema(index)->materialize();
+        }
+        return nullptr;
+    }
     /**
-     * @param flag 选项标志字符串，例如 "-d --debug <level...> | [debug...]"
-     * @return this
+     * 获取日志操作对象指针
      */
-    virtual Command *option(const String &flag, const String &desc = String(), const Variant &defaultValue = Variant())
+    Logger *logger()
     {
-        Option *opt = Option::create(flag, pLogger);
-        if (!opt)
+        return pLogger;
+    }
+
+  private:
+    class Option
+    {
+      public:
+        static Option *create(const String &flag, Logger *logger)
         {
-            if (pLogger)
-                pLogger->error(String("option ") + flag + String(" create failed"));
-            return this;
+            COMMANDER_CPP_PHASE(Phase::Construct);
+            static const std::regex reg(
+                R"(^\s*(?:(?:-([a-zA-Z])(?:(?:\s+)|(?:\s*,\s*))\-\-([a-zA-Z-]+)\s+(?:\[([a-zA-Z]+)(\.\.\.)?\]|<([a-zA-Z]+)(\.\.\.)?>))|(?:-([a-zA-Z])(?:(?:\s+)|(?:\s*,\s*))\-\-([a-zA-Z-]+))|(?:\-\-([a-zA-Z-]+)\s+(?:(?:\[([a-zA-Z]+)(\.\.\.)?\])|(?:\<([a-zA-Z]+)(\.\.\.)?\>)))|(?:\-\-([a-zA-Z-]+)))\s*$)");
+            std::smatch res;
+            if (!std::regex_search(flag, res, reg))
+            {
+                return nullptr;
+            }
+            std::string alias = !res.str(1).empty() ? res.str(1) : !res.str(7).empty() ? res.str(7) : "";
+            std::string name = !res.str(2).empty()    ? res.str(2)
+                               : !res.str(8).empty()  ? res.str(8)
+                               : !res.str(9).empty()  ? res.str(9)
+                               : !res.str(14).empty() ? res.str(14)
+                                                      : "";
+            std::string valueName = !res.str(3).empty()    ? res.str(3)
+                                    : !res.str(5).empty()  ? res.str(5)
+                                    : !res.str(10).empty() ? res.str(10)
+                                    : !res.str(12).empty() ? res.str(12)
+                                                           : "";
+
+            bool multiValue =
+                !res.str(4).empty() || !res.str(6).empty() || !res.str(11).empty() || !res.str(13).empty();
+            bool valueIsRequired = !res.str(5).empty() || !res.str(12).empty();
+
+            if (logger)
+                logger->debug(String("create option: ") + String("alias: ") + alias + String(" name: ") + name +
+                              String(" valueName: ") + valueName + String(" multiValue: ") +
+                              std::to_string(multiValue) + String(" valueIsRequired: ") +
+                              std::to_string(valueIsRequired));
+
+            Option *opt = new Option();
+            opt->name = name;
+            opt->alias = alias;
+            opt->valueName = valueName;
+            opt->multiValue = multiValue;
+            opt->valueIsRequired = valueIsRequired;
+            return opt;
         }
 
-        for( const auto &existOpt : options)
+        Name name;
+        Name alias;
+        String valueName;
+        bool multiValue = false;
+        bool valueIsRequired = false;
+
+        String desc;
+        Variant defaultValue;
+        ValueVisitor visitor;
+        ValueType elementType = ValueType::Auto;
+    };
+    class Argument
+    {
+      public:
+        static Argument *create(const String &name, Logger *logger)
         {
-            if(!opt->alias.empty() && existOpt->alias == opt->alias)
+            COMMANDER_CPP_PHASE(Phase::Construct);
+            static const std::regex reg(
+                R"(^\s*(?:(?:\[([a-zA-Z][a-zA-Z\d]+)(\.\.\.)?\])|(?:<([a-zA-Z][a-zA-Z\d]+)(\.\.\.)?>))\s*$)");
+            std::smatch res;
+            if (!std::regex_search(name, res, reg))
             {
-                if (pLogger)
-                    pLogger->warn(String("option alias ") + opt->alias + String(" already exists, Option: ") + opt->name + String("'s alias will forever be invalid."));
+                if (logger)
+                    logger->warn(String("invalid argument name: ") + name);
+                return nullptr;
             }
+            String argName = !res.str(1).empty() ? res.str(1) : !res.str(3).empty() ? res.str(3) : "";
+            if (logger)
+                logger->debug(String("create argument: ") + String("name: ") + argName + String(" isMultiValue: ") +
+                              std::to_string(!res.str(2).empty() || !res.str(4).empty()) +
+                              String(" valueIsRequired: ") +
+                              std::to_string(!res.str(1).empty() || !res.str(3).empty()));
 
-            if (existOpt->name == opt->name)
-            {
-                if (pLogger)
-                    pLogger->warn(String("option ") + flag + String(" already exists, skip add"));
-                delete opt;
-                return this;
-            }
+            Argument *arg = new Argument;
+            arg->name = argName;
+            arg->isMultiValue = !res.str(2).empty() || !res.str(4).empty();
+            arg->valueIsRequired = !res.str(3).empty();
+            return arg;
         }
 
-        opt->desc = desc;
-        opt->defaultValue = defaultValue;
-        options.push_back(opt);
+        String name;
+        bool isMultiValue = false;
+        bool valueIsRequired = false;
 
-        return this;
+        String desc;
+        Variant defaultValue;
+        ValueVisitor visitor;
     };
 
-    /**
-     * @brief 设置命令的动作回调函数
-     * @param cb 动作回调函数，参数为参数列表和选项列表
+    /*
+     * 从 schema 加载的命令树共享同一个映射文件
      */
-    virtual Command *action(const Action &cb)
+    struct SchemaLink
     {
-        if (!cb)
-        {
-            if (pLogger)
-                pLogger->debug(String("[error]:") + String("action callback is null"));
-        }
+        Schema schema;
+        CommandBuilder binder;
+    };
 
-        actionCallback = cb;
-        return this;
-    }
-    virtual Command *action(const Action2 &cb)
+    static Command *fromSchema(const std::shared_ptr<SchemaLink> &link, uint32_t index, Logger *logger)
     {
-        if (!cb)
+        COMMANDER_CPP_PHASE(Phase::Construct);
+        const Schema &schema = link->schema;
+        const Schema::CommandRecord &rec = schema.command(index);
+        String name(schema.string(rec.name));
+        Command *cmd = index == 0 ? new Command(name, logger) : new Command(name, logger, Detached());
+        cmd->commandDescription = String(schema.string(rec.description));
+        // 记录中的字段已经解析过，直接构造选项和参数，不再经过正则
+        for (uint32_t i = 0; i < rec.optionCount; ++i)
+            cmd->options.push_back(optionFromSchema(schema, rec.firstOption + i));
+        for (uint32_t i = 0; i < rec.argumentCount; ++i)
         {
-            if (pLogger)
-                pLogger->debug(String("[error]:") + String("action callback is null"));
+            const Schema::ArgumentRecord &a = schema.argument(rec.firstArgument + i);
+            Argument *arg = new Argument;
+            arg->name = String(schema.string(a.name));
+            arg->desc = String(schema.string(a.description));
+            arg->isMultiValue = a.isMultiValue;
+            arg->valueIsRequired = a.valueIsRequired;
+            arg->defaultValue = schema.value(a.defaultValue);
+            cmd->arguments.push_back(arg);
         }
-
-        actionCallback = [cb](class Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
-            (void)cmd;
-            cb(args, opts);
-        };
-        return this;
+        cmd->schemaLink = link;
+        cmd->schemaIndex = index;
+        return cmd;
     }
-    virtual Command *action(const Action3 &cb)
+    static Option *optionFromSchema(const Schema &schema, uint32_t index)
     {
-        if (!cb)
-        {
-            if (pLogger)
-                pLogger->debug(String("[error]:") + String("action callback is null"));
-        }
+        const Schema::OptionRecord &rec = schema.option(index);
+        Option *opt = new Option();
+        opt->name = schema.string(rec.name);
+        opt->alias = schema.string(rec.alias);
+        opt->valueName = String(schema.string(rec.valueName));
+        opt->desc = String(schema.string(rec.description));
+        opt->multiValue = rec.multiValue;
+        opt->valueIsRequired = rec.valueIsRequired;
+        opt->elementType = rec.elementType <= static_cast<uint8_t>(ValueType::StringView)
+                               ? static_cast<ValueType>(rec.elementType)
+                               : ValueType::Auto;
+        opt->defaultValue = schema.value(rec.defaultValue);
+        return opt;
+    }
 
-        actionCallback = [cb](class Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
-            cb(cmd, args, {opts});
-        };
-        return this;
+    /*
+     * 从 schema 构造一个子命令并挂到当前命令下，名称已经由 schema 保证唯一，不经过 addCommand 的查重
+     */
+    Command *attachFromSchema(uint32_t index)
+    {
+        Command *cmd = fromSchema(schemaLink, index, pLogger);
+        adopt(cmd);
+        indexCommand(cmd);
+        if (schemaLink->binder)
+            schemaLink->binder(cmd);
+        return cmd;
     }
 
-    /**
-     * @param argc
-     * @param argv
-     * @param index 开始解析的索引，默认从1开始，0为命令本身
+    /*
+     * 不创建自己的 version 和 help 选项，只用于随后通过 adopt 挂到父命令下的子命令
      */
-    void parse(int argc, char **argv, int index = 1)
+    struct Detached
     {
-        Vector<Variant> args;
-        Map<String, Variant> opts;
+    };
+    Command(const String &name, Logger *logger, Detached)
+        : commandName(name), actionCallback(nullptr), versionOption(nullptr), helpOption(nullptr),
+          parentCommand(nullptr), pLogger(logger)
+    {
+    }
 
-        int cur = index;
-        std::regex optionAliasReg(R"(^(?:-([a-zA-Z]+))(?:=(.+))?$)");
-        std::regex optionReg(R"(^(?:--([a-zA-Z][a-zA-Z-]*))(?:=(.+))?$)");
-        std::regex commandReg(R"(^(?!-)([a-zA-Z][a-zA-Z\d]*)$)");
+    /*
+     * 把新构造的子命令挂到当前命令下，共享根命令的 version 和 help 选项
+     */
+    void adopt(Command *cmd)
+    {
+        delete cmd->versionOption;
+        delete cmd->helpOption;
+        cmd->parentCommand = this;
+        cmd->versionOption = versionOption;
+        cmd->helpOption = helpOption;
+        subCommands.push_back(cmd);
+    }
 
-        std::regex intValueReg(R"(^-?\d+$)");
-        std::regex doubleValueReg(R"(^-?\d+\.\d+$)");
-        std::regex boolValueReg(R"(^(?:(true)|false)$)");
-        std::regex strValueReg(R"(^(?:"([^"]+)\"|'([^']+)')$)");
+    /*
+     * 是否已有同名的子命令，包括 schema 中尚未构造的子命令，不会触发延迟注册
+     */
+    bool hasCommand(const String &name) const
+    {
+        auto range = commandRange(name);
+        if (range.first != range.second && (*range.first)->commandName.str() == name)
+            return true;
+        return schemaLink && !schemaExpanded && schemaLink->schema.findChild(schemaIndex, name) != Schema::None;
+    }
 
-        enum LogType{D,W,E,P};
-        auto log = [this](LogType type, const String &msg) {
-            if (pLogger)
-                if (type == D) pLogger->debug(msg);
-                if (type == W) pLogger->warn(msg);
-                if (type == E) pLogger->error(msg);
-                if (type == P) pLogger->print(msg);
-        };
+    /*
+     * 按名称有序插入子命令索引，查找和前缀补全都在索引上二分
+     */
+    void indexCommand(Command *cmd)
+    {
+        auto it = std::lower_bound(sortedCommands.begin(), sortedCommands.end(), cmd->commandName.str(),
+                                   [](const Command *c, const String &name) { return c->commandName.str() < name; });
+        sortedCommands.insert(it, cmd);
+    }
+    /*
+     * 名称以 prefix 开头的子命令在索引中的区间
+     */
+    std::pair<Vector<Command *>::const_iterator, Vector<Command *>::const_iterator> commandRange(
+        std::string_view prefix) const
+    {
+        auto begin = std::lower_bound(
+            sortedCommands.begin(), sortedCommands.end(), prefix,
+            [](const Command *c, std::string_view key) { return std::string_view(c->commandName.str()) < key; });
+        auto end = begin;
+        while (end != sortedCommands.end() && std::string_view((*end)->commandName.str()).substr(0, prefix.size()) == prefix)
+            ++end;
+        return {begin, end};
+    }
 
-        auto findOption = [this](const String &name) -> Option * {
-            Vector<Option *> opts = options;
-            opts.push_back(versionOption);
-            opts.push_back(helpOption);
-            for (const auto opt : opts)
-            {
-                if (opt->name == name)
-                {
-                    return opt;
-                }
-            }
-            return nullptr;
-        };
-        auto findOptionByAlias = [this](const String &alias) -> Option * {
-            Vector<Option *> opts = options;
-            opts.push_back(versionOption);
-            opts.push_back(helpOption);
-            for (const auto opt : opts)
-            {
-                if (opt->alias == alias)
-                {
-                    return opt;
-                }
-            }
-            return nullptr;
+    /*
+     * 补全候选和缓存中的描述只保留第一行，制表符换成空格
+     */
+    static String summaryLine(const String &text)
+    {
+        String line = text.substr(0, text.find('\n'));
+        std::replace(line.begin(), line.end(), '\t', ' ');
+        return line;
+    }
+
+    /*
+     * 当前命令下与 current 前缀匹配的子命令或选项，按名称排序
+     */
+    Vector<CompletionCandidate> completionCandidates(const String &current)
+    {
+        Vector<CompletionCandidate> out;
+        Command *cmd = this;
+        auto isOption = [](const String &word) { return word.size() > 1 && word[0] == '-'; };
+        auto firstLine = summaryLine;
+        auto startsWith = [](const String &text, const String &prefix) {
+            return text.compare(0, prefix.size(), prefix) == 0;
         };
 
-        auto getBaseValue = [=](const String &text) {
-            if (text.empty())
+        if (isOption(current) || current == "-")
+        {
+            Vector<Option *> all = cmd->options;
+            all.push_back(cmd->versionOption);
+            all.push_back(cmd->helpOption);
+            if (rootCommand()->profileOption)
+                all.push_back(rootCommand()->profileOption);
+            for (const auto opt : all)
             {
-                return VariantBase();
+                String longName = "--" + opt->name.str();
+                if (startsWith(longName, current))
+                    out.push_back({longName, firstLine(opt->desc)});
+                if (!opt->alias.empty() && current.size() <= 2 && startsWith("-" + opt->alias.str(), current))
+                    out.push_back({"-" + opt->alias.str(), firstLine(opt->desc)});
             }
-            std::smatch res;
-            if (std::regex_search(text, res, intValueReg))
+        }
+        else
+        {
+            auto range = cmd->commandRange(current);
+            for (auto it = range.first; it != range.second; ++it)
+                out.push_back({(*it)->commandName.str(), firstLine((*it)->commandDescription)});
+            // 从 schema 加载的命令直接在映射的有序子命令表上查找，不构造子命令
+            if (cmd->schemaLink && !cmd->schemaExpanded)
             {
-                return VariantBase(std::stoi(text));
+                const Schema &schema = cmd->schemaLink->schema;
+                schema.forEachChild(cmd->schemaIndex, current, [&](uint32_t index) {
+                    String name(schema.string(schema.command(index).name));
+                    if (cmd->commandRange(name).first == cmd->commandRange(name).second)
+                        out.push_back({name, firstLine(String(schema.string(schema.command(index).description)))});
+                });
             }
+        }
+        std::sort(out.begin(), out.end(),
+                  [](const CompletionCandidate &a, const CompletionCandidate &b) { return a.value < b.value; });
+        return out;
+    }
 
-            if (std::regex_search(text, res, doubleValueReg))
-            {
-                return VariantBase(std::stod(text));
-            }
+    /*
+     * 补全时按拼写查找选项："--name" 或别名组合 "-abc" 中的最后一个别名
+     */
+    Option *completionOption(const String &word)
+    {
+        if (word.empty())
+            return nullptr;
+        bool isLong = word.size() > 2 && word[1] == '-';
+        return isLong ? matchOption(std::string_view(word).substr(2), false)
+                      : matchOption(std::string_view(&word.back(), 1), true);
+    }
 
-            if (std::regex_search(text, res, boolValueReg))
-            {
-                return VariantBase(res.str(1).empty());
-            }
+    /*
+     * 以下是 parse 和 PushParser 共用的规则，两者对同一串 token 的识别和绑定必须一致
+     */
 
-            // 如果有引号，去掉引号
-            if (std::regex_search(text, res, strValueReg))
-            {
-                return VariantBase(!res.str(1).empty() ? res.str(1) : (!res.str(2).empty() ? res.str(2) : text));
-            }
+    /*
+     * 按名称或单字母别名查找当前命令可用的选项，包括版本、帮助和全局的性能分析选项
+     * 驻留的名称存放在不会移动的 deque 中，直接读取比较，解析时不需要获取名称表的锁
+     */
+    Option *matchOption(std::string_view text, bool alias)
+    {
+        COMMANDER_CPP_PHASE(Phase::Lookup);
+        auto matches = [&](const Option *opt) { return (alias ? opt->alias : opt->name).str() == text; };
+        for (const auto opt : options)
+        {
+            if (matches(opt))
+                return opt;
+        }
+        if (matches(versionOption))
+            return versionOption;
+        if (matches(helpOption))
+            return helpOption;
+        Option *profile = rootCommand()->profileOption;
+        if (profile && matches(profile))
+            return profile;
+        return nullptr;
+    }
 
-            return VariantBase(text);
-        };
-        auto getValue = [=](const String &text) {
-            if (text.empty())
-            {
-                return Variant();
-            }
-            std::smatch res;
-            if (std::regex_search(text, res, intValueReg))
-            {
-                return Variant(std::stoi(text));
-            }
+    /*
+     * 选项如何取得它的值
+     */
+    enum class OptionBinding : uint8_t
+    {
+        // 全局的性能分析选项，输出文件只能通过 = 传入
+        Profile,
+        // 开关，通过 = 传入的值只产生警告
+        Switch,
+        // 值可选，只能通过 = 传入
+        Optional,
+        // 值必填但有默认值，不读取后面的 token
+        Default,
+        // 一个值，来自 = 之后或者下一个 token
+        Single,
+        // 多个值，来自 = 之后或者直到下一个选项之前的 token
+        List
+    };
 
-            if (std::regex_search(text, res, doubleValueReg))
-            {
-                return Variant(std::stod(text));
-            }
+    OptionBinding bindingOf(const Option *opt)
+    {
+        if (opt == rootCommand()->profileOption)
+            return OptionBinding::Profile;
+        if (opt->valueName.empty() && opt != versionOption && opt != helpOption)
+            return OptionBinding::Switch;
+        if (!opt->valueIsRequired)
+            return OptionBinding::Optional;
+        if (!std::holds_alternative<std::monostate>(opt->defaultValue))
+            return OptionBinding::Default;
+        return opt->multiValue ? OptionBinding::List : OptionBinding::Single;
+    }
 
-            if (std::regex_search(text, res, boolValueReg))
-            {
-                return Variant(res.str(1).empty());
-            }
+    /*
+     * 多值选项的 token 是否按元素类型直接转换：这时空字符串也是一个值，否则空字符串被跳过
+     */
+    static bool typedList(const Option *opt, bool dryRun)
+    {
+        return opt->elementType != ValueType::Auto && (!opt->visitor || dryRun);
+    }
 
-            // 如果有引号，去掉引号
-            if (std::regex_search(text, res, strValueReg))
+    /*
+     * 别名组合 -abc：未定义的别名只警告；不是最后一个的别名拿不到值，
+     * 需要后面 token 的选项只能放在组合的最后，否则报告 MissingValue
+     * @param visit 依次收到已定义的别名对应的选项和它是否是最后一个，返回 false 时停止
+     * @return 出错停止时返回 false
+     */
+    template <typename Report, typename Visit>
+    bool forEachAlias(std::string_view cluster, int index, Report &report, Visit &&visit)
+    {
+        for (size_t i = 0; i < cluster.size(); ++i)
+        {
+            Option *opt = matchOption(cluster.substr(i, 1), true);
+            if (!opt)
             {
-                return Variant(!res.str(1).empty() ? res.str(1) : (!res.str(2).empty() ? res.str(2) : text));
+                report(ErrorCode::UnknownAlias, Severity::Warning, index, nullptr, static_cast<int>(i));
+                continue;
             }
-
-            return Variant(text);
-        };
-
-        auto parseCommand = [&](const String &name) {
-            log(D, String("try parse command: ") + name);
-            Command *command = findCommand(name);
-            if (!command)
+            const bool last = i + 1 == cluster.size();
+            OptionBinding binding = bindingOf(opt);
+            if (!last && (binding == OptionBinding::Single || binding == OptionBinding::List))
             {
-                log(D, name + " is not a sub command");
+                report(ErrorCode::MissingValue, Severity::Error, index, opt->name.id(), static_cast<int>(i));
                 return false;
             }
+            if (!visit(opt, last))
+                return false;
+        }
+        return true;
+    }
 
-            log(D, "parse command: " + name + " success");
-            command->parse(argc, argv, ++cur);
-            return true;
-        };
-        auto parseOptionName = [&](const String &name, const String &value = String()) {
-            log(D, String("try parse option name: ") + name + String(", value: ") + value);
-            Option *opt = findOption(name);
-            if (!opt)
-            {
-                log(W, String("unknown option: ") + name);
-                ++cur;
-                return true;
-            }
-
-            Variant v;
-
-            if (!opt->valueName.empty() || opt == versionOption || opt == helpOption)
-            {
-                if (opt->valueIsRequired)
-                {
-                    if (!std::holds_alternative<std::monostate>(opt->defaultValue))
-                    {
-                        log(D, "option: " + opt->name + " use default value");
-                        v = opt->defaultValue;
-                    }
-                    else
-                    {
-                        if (opt->multiValue)
-                        {
-                            std::vector<VariantBase> mv;
-                            if (!value.empty())
-                            {
-                                mv.push_back(getBaseValue(value));
-                            }
-                            else
-                            {
-                                while (++cur < argc)
-                                {
-                                    String arg = argv[cur];
-                                    log(D, "try get value from identifier: " + arg);
-                                    std::smatch res;
-                                    if (std::regex_search(arg, res, optionAliasReg) ||
-                                        std::regex_search(arg, res, optionReg))
-                                    {
-                                        --cur;
-                                        break;
-                                    }
-                                    auto nv = getBaseValue(arg);
-                                    if (std::holds_alternative<std::monostate>(nv))
-                                        continue;
-
-                                    mv.push_back(nv);
-                                }
-                            }
-
-                            if (mv.size() == 0)
-                            {
-                                log(E, String("option: ") + opt->name + String(" need a value at lest, but got zero."));
-                                ++cur;
-                                return false;
-                            }
-
-                            v = mv;
-                        }
-                        else
-                        {
-                            String valueText = !value.empty() ? value : ++cur < argc ? argv[cur] : "";
-                            log(D, "try get value from identifier: " + valueText);
-                            std::smatch res;
-                            if (valueText.empty() || std::regex_search(valueText, res, optionAliasReg) ||
-                                std::regex_search(valueText, res, optionReg))
-                            {
-                                log(E, String("option: ") + opt->name + String(" need a value, but got zero."));
-                                ++cur;
-                                return false;
-                            }
+    /*
+     * 位置参数只产生警告的情况：命令没有定义参数，或者值是空字符串
+     */
+    ErrorCode argumentWarning(std::string_view token) const
+    {
+        if (arguments.empty())
+            return ErrorCode::UnexpectedArgument;
+        return token.empty() ? ErrorCode::ValueOutOfRange : ErrorCode::None;
+    }
 
-                            v = getValue(valueText);
-                        }
+    /*
+     * 按 schema 中的注册顺序构造全部子命令，已经构造的子命令和之后手动添加的子命令保持不变
+     */
+    void expandSchema()
+    {
+        if (!schemaLink || schemaExpanded)
+            return;
+        schemaExpanded = true;
 
-                        if (std::holds_alternative<std::monostate>(v))
-                        {
-                            log(E, String("option: ") + opt->name + String("got an invalid value."));
-                            return false;
-                        }
-                    }
-                }
-            }
-            else
+        const Schema &schema = schemaLink->schema;
+        const Schema::CommandRecord &rec = schema.command(schemaIndex);
+        Vector<Command *> loaded = std::move(subCommands);
+        subCommands.clear();
+        for (uint32_t i = 0; i < rec.childCount; ++i)
+        {
+            std::string_view name = schema.string(schema.command(rec.firstChild + i).name);
+            auto it = std::find_if(loaded.begin(), loaded.end(),
+                                   [name](Command *cmd) { return cmd && cmd->commandName.str() == name; });
+            if (it == loaded.end())
             {
-                if (!value.empty())
-                    log(W, String("option: ") + opt->name + String(" does not need a value, but got: ") + value);
+                attachFromSchema(rec.firstChild + i);
+                continue;
             }
+            subCommands.push_back(*it);
+            *it = nullptr;
+        }
+        for (const auto cmd : loaded)
+        {
+            if (cmd)
+                subCommands.push_back(cmd);
+        }
+    }
 
-            opts[opt->name] = v;
-            cur++;
-            return true;
-        };
-        auto parseMuiltOptionAlias = [&](const String &alias, const String &value = String()) {
-            log(D, String("try parse multi option alias: ") + alias);
-
-            for (auto it = alias.begin(); it != alias.end() - 1; it++)
+    static void writeValueJson(String &out, const Variant &v)
+    {
+        if (auto p = std::get_if<int>(&v))
+            out += std::to_string(*p);
+        else if (auto p = std::get_if<double>(&v))
+        {
+            std::stringstream text;
+            text.precision(17);
+            text << *p;
+            String number = text.str();
+            // 保留小数点，导入时仍然读为 double
+            if (number.find_first_of(".eE") == String::npos)
+                number += ".0";
+            out += std::isfinite(*p) ? number : "null";
+        }
+        else if (auto p = std::get_if<String>(&v))
+            TOOLS::appendJsonString(out, *p);
+        else if (auto p = std::get_if<bool>(&v))
+            out += *p ? "true" : "false";
+        else
+            out += "null";
+    }
+    static void writeOptionJson(String &out, const Option *opt)
+    {
+        static const char *elementTypes[] = {"auto", "int64", "double", "stringView"};
+        out += "{\"name\":";
+        TOOLS::appendJsonString(out, opt->name.str());
+        out += ",\"alias\":";
+        TOOLS::appendJsonString(out, opt->alias.str());
+        out += ",\"valueName\":";
+        TOOLS::appendJsonString(out, opt->valueName);
+        out += String(",\"multiValue\":") + (opt->multiValue ? "true" : "false");
+        out += String(",\"valueIsRequired\":") + (opt->valueIsRequired ? "true" : "false");
+        out += String(",\"elementType\":\"") + elementTypes[static_cast<size_t>(opt->elementType)] + "\"";
+        out += ",\"description\":";
+        TOOLS::appendJsonString(out, opt->desc);
+        out += ",\"default\":";
+        writeValueJson(out, opt->defaultValue);
+        out += "}";
+    }
+    void writeJson(String &out)
+    {
+        materialize();
+        expandSchema();
+        out += "{\"name\":";
+        TOOLS::appendJsonString(out, commandName.str());
+        out += ",\"description\":";
+        TOOLS::appendJsonString(out, commandDescription);
+        if (!parentCommand)
+        {
+            const std::pair<const char *, const Option *> shared[] = {
+                {"version", versionOption}, {"help", helpOption}, {"profile", profileOption}};
+            for (const auto &item : shared)
             {
-                char a[2];
-                a[0] = *it;
-                a[1] = '\0';
-                Option *opt = findOptionByAlias(a);
-                if (!opt)
-                {
-                    log(W, String("option alias ") + a + String(" not found"));
+                if (!item.second)
                     continue;
-                }
-                if (!parseOptionName(opt->name))
-                    return false;
+                out += String(",\"") + item.first + "\":";
+                writeOptionJson(out, item.second);
             }
+        }
+        out += ",\"options\":[";
+        for (size_t i = 0; i < options.size(); ++i)
+        {
+            if (i)
+                out += ",";
+            writeOptionJson(out, options[i]);
+        }
+        out += "],\"arguments\":[";
+        for (size_t i = 0; i < arguments.size(); ++i)
+        {
+            const Argument *arg = arguments[i];
+            out += i ? ",{\"name\":" : "{\"name\":";
+            TOOLS::appendJsonString(out, arg->name);
+            out += String(",\"multiValue\":") + (arg->isMultiValue ? "true" : "false");
+            out += String(",\"valueIsRequired\":") + (arg->valueIsRequired ? "true" : "false");
+            out += ",\"description\":";
+            TOOLS::appendJsonString(out, arg->desc);
+            out += ",\"default\":";
+            writeValueJson(out, arg->defaultValue);
+            out += "}";
+        }
+        out += "],\"commands\":[";
+        for (size_t i = 0; i < subCommands.size(); ++i)
+        {
+            if (i)
+                out += ",";
+            subCommands[i]->writeJson(out);
+        }
+        out += "]}";
+    }
 
-            // 最后一个别名特殊处理，因为它可以带参数
-            char a[2];
-            a[0] = alias.back();
-            a[1] = '\0';
-            Option *opt = findOptionByAlias(a);
-            if (!opt)
+    static bool readOptionJson(TOOLS::JsonReader &reader, Option &opt)
+    {
+        return reader.object([&](const String &key) {
+            String text;
+            if (key == "name" || key == "alias")
             {
-                log(W, String("option alias ") + a + String(" not founds"));
-                ++cur;
+                if (!reader.string(text))
+                    return false;
+                (key == "name" ? opt.name : opt.alias) = text;
                 return true;
             }
-
-            return parseOptionName(opt->name, value);
-        };
-        auto parseArgument = [&](const String &arg) {
-            log(D, String("try parse argument: ") + arg);
-
-            if (arguments.empty())
+            if (key == "valueName")
+                return reader.string(opt.valueName);
+            if (key == "description")
+                return reader.string(opt.desc);
+            if (key == "multiValue")
+                return reader.boolean(opt.multiValue);
+            if (key == "valueIsRequired")
+                return reader.boolean(opt.valueIsRequired);
+            if (key == "default")
+                return reader.value(opt.defaultValue);
+            if (key == "elementType")
             {
-                log(W, "unknown identifier: " + arg);
-                cur++;
+                if (!reader.string(text))
+                    return false;
+                if (text == "auto")
+                    opt.elementType = ValueType::Auto;
+                else if (text == "int64")
+                    opt.elementType = ValueType::Int64;
+                else if (text == "double")
+                    opt.elementType = ValueType::Double;
+                else if (text == "stringView")
+                    opt.elementType = ValueType::StringView;
+                else
+                    return reader.fail("unknown element type: " + text);
                 return true;
             }
-
-            Variant v = getValue(arg);
-            if (std::holds_alternative<std::monostate>(v))
+            return reader.skip();
+        });
+    }
+    /*
+     * 按 option() 的格式拼出标志字符串，再交给 Option::create 解析，导入的选项和构建器 API 接受的完全一致
+     */
+    static bool checkOptionJson(TOOLS::JsonReader &reader, const Option &opt)
+    {
+        if (opt.name.empty())
+            return reader.fail("option without name");
+
+        String flag = opt.alias.empty() ? String() : "-" + opt.alias.str() + " ";
+        flag += "--" + opt.name.str();
+        if (!opt.valueName.empty())
+            flag += String(opt.valueIsRequired ? " <" : " [") + opt.valueName + (opt.multiValue ? "..." : "") +
+                    (opt.valueIsRequired ? ">" : "]");
+
+        std::unique_ptr<Option> parsed(Option::create(flag, nullptr));
+        if (!parsed || parsed->name != opt.name || parsed->alias != opt.alias || parsed->valueName != opt.valueName ||
+            parsed->multiValue != opt.multiValue || parsed->valueIsRequired != opt.valueIsRequired)
+            return reader.fail("invalid option: " + opt.name.str());
+        if (opt.elementType != ValueType::Auto && !opt.multiValue)
+            return reader.fail("element type on single value option: " + opt.name.str());
+        return true;
+    }
+    static bool readArgumentJson(TOOLS::JsonReader &reader, Argument &arg)
+    {
+        return reader.object([&](const String &key) {
+            if (key == "name")
+                return reader.string(arg.name);
+            if (key == "description")
+                return reader.string(arg.desc);
+            if (key == "multiValue")
+                return reader.boolean(arg.isMultiValue);
+            if (key == "valueIsRequired")
+                return reader.boolean(arg.valueIsRequired);
+            if (key == "default")
+                return reader.value(arg.defaultValue);
+            return reader.skip();
+        });
+    }
+    bool readJson(TOOLS::JsonReader &reader, const CommandBuilder &binder)
+    {
+        bool ok = reader.object([&](const String &key) {
+            if (key == "name")
             {
-                if (pLogger)
-                    pLogger->warn(arg + String(" is not a valid argument value"));
-                ++cur;
+                String name;
+                if (!reader.string(name))
+                    return false;
+                if (commandName.empty())
+                    commandName = name;
+                return true;
+            }
+            if (key == "description")
+                return reader.string(commandDescription);
+            if (key == "version" || key == "help" || key == "profile")
+            {
+                Option opt;
+                if (!readOptionJson(reader, opt) || !checkOptionJson(reader, opt))
+                    return false;
+                if (parentCommand)
+                    return true;
+                // 子命令共享这些选项的指针，原地覆盖
+                Option *&target = key == "version" ? versionOption : key == "help" ? helpOption : profileOption;
+                if (target)
+                    *target = opt;
+                else
+                    target = new Option(opt);
                 return true;
             }
+            if (key == "options")
+                return reader.array([&]() {
+                    std::unique_ptr<Option> opt(new Option());
+                    if (!readOptionJson(reader, *opt) || !checkOptionJson(reader, *opt))
+                        return false;
+                    // option() 遇到重复的别名只是警告，插件提供的数据直接拒绝
+                    for (const auto exist : options)
+                    {
+                        if (exist->name == opt->name)
+                            return reader.fail("duplicate option: " + opt->name.str());
+                        if (!opt->alias.empty() && exist->alias == opt->alias)
+                            return reader.fail("duplicate option alias: " + opt->alias.str());
+                    }
+                    options.push_back(opt.release());
+                    return true;
+                });
+            if (key == "arguments")
+                return reader.array([&]() {
+                    std::unique_ptr<Argument> arg(new Argument());
+                    if (!readArgumentJson(reader, *arg))
+                        return false;
+                    if (arg->name.empty())
+                        return reader.fail("argument without name");
+                    // 和选项一样按 argument() 的格式校验名称
+                    String spec = String(arg->valueIsRequired ? "<" : "[") + arg->name + (arg->isMultiValue ? "..." : "") +
+                                  (arg->valueIsRequired ? ">" : "]");
+                    std::unique_ptr<Argument> parsed(Argument::create(spec, nullptr));
+                    if (!parsed || parsed->name != arg->name)
+                        return reader.fail("invalid argument: " + arg->name);
+                    arguments.push_back(arg.release());
+                    return true;
+                });
+            if (key == "commands")
+                return reader.array([&]() {
+                    Command *cmd = new Command(String(), pLogger, Detached());
+                    adopt(cmd);
+                    if (!cmd->readJson(reader, binder))
+                        return false;
+                    // 名称在读完子命令的定义之后才确定，和 command() 使用相同的名称规则，并且不能与已有的子命令重名
+                    static const std::regex nameReg(R"(^[a-zA-Z][a-zA-Z\d]+$)");
+                    const String &name = cmd->commandName.str();
+                    String reason;
+                    if (name.empty())
+                        reason = "command without name";
+                    else if (!std::regex_match(name, nameReg))
+                        reason = "invalid command name: " + name;
+                    else if (hasCommand(name))
+                        reason = "duplicate command: " + name;
+                    if (!reason.empty())
+                    {
+                        subCommands.pop_back();
+                        delete cmd;
+                        return reader.fail(reason);
+                    }
+                    indexCommand(cmd);
+                    return true;
+                });
+            return reader.skip();
+        });
+        if (ok && binder)
+            binder(this);
+        return ok;
+    }
+
+    Name commandName;
+    String commandDescription;
+    Action actionCallback;
+    CompactAction compactCallback;
+    Option *versionOption;
+    Option *helpOption;
+    Command *parentCommand;
+    // 全局选项，只由根命令持有
+    Option *profileOption = nullptr;
+    // 延迟注册时尚未执行的 builder
+    CommandBuilder pendingBuilder;
+    // 从 schema 加载时共享的映射文件和命令在其中的下标
+    std::shared_ptr<SchemaLink> schemaLink;
+    uint32_t schemaIndex = 0;
+    bool schemaExpanded = false;
 
-            log(D, "parse argument: " + arg + " success");
+    Vector<Option *> options;
+    Vector<Argument *> arguments;
+    Vector<Command *> subCommands;
+    // 按名称排序的子命令，不持有所有权
+    Vector<Command *> sortedCommands;
+    // 补全查询入口的名称，为空时不开启，只在根命令上设置
+    String completionName;
+    // 补全缓存文件，只在根命令上设置
+    String completionCacheFile;
+    // 调用记录，只在根命令上设置
+    std::shared_ptr<InvocationRecorder> recorder;
 
-            cur++;
-            args.push_back(v);
-            return true;
-        };
-        while (cur < argc)
+    Logger *pLogger;
+    Profiler *pProfiler = nullptr;
+
+    bool responseFileEnabled = false;
+    int responseFileMaxDepth = 8;
+
+    size_t parallelThreshold = 1 << 16;
+    unsigned parallelThreads = 0;
+    // 并行转换的线程池，只在根命令上创建
+    std::unique_ptr<TOOLS::WorkerPool> conversionPool;
+    std::mutex conversionPoolMutex;
+};
+
+/*
+ * @brief 逐个 token 输入的增量解析器，适用于交互式编辑、流式协议和很长的输入
+ *        每输入一个 token 只根据上一个状态前进，可以随时查询当前命令、是否在等待选项的值和已知的警告错误，
+ *        pop 撤销最后一个 token；finish 用累计的 token 调用 parse，结果和执行与一次性解析完全相同
+ */
+class Command::PushParser
+{
+  public:
+    /*
+     * @brief 下一个 token 的期望
+     */
+    enum class Expect : uint8_t
+    {
+        // 子命令、选项或参数
+        Any,
+        // 选项的值
+        Value,
+        // 多值选项的值，已经有值时也可以是新的选项
+        Values
+    };
+
+    explicit PushParser(Command &root) : root(root)
+    {
+        root.materialize();
+        states.push_back(State{&root});
+    }
+
+    /*
+     * @brief 输入下一个 token
+     * @return 出现会让 parse 终止的错误时返回 false，之后的 token 不再影响结果
+     */
+    bool push(const String &token)
+    {
+        State state = states.back();
+        const int index = static_cast<int>(tokens.size()) + 1;
+        tokens.push_back(token);
+        if (state.stopped)
         {
-            String arg = argv[cur];
-            log(D, String("try parse identifier: ") + arg);
-            std::smatch res;
+            states.push_back(state);
+            return false;
+        }
 
-            // 尝试解析子命令
-            if (std::regex_search(arg, res, commandReg))
-            {
-                // 如果解析到子命令直接就使用子命令的解析了，不再继续当前的解析了
-                if (parseCommand(res.str(1)))
-                    return;
-                // 否则继续解析
-            }
-            // 尝试解析选项
-            if (std::regex_search(arg, res, optionReg))
+        auto report = [&](ErrorCode code, Severity severity, int at, const String *name = nullptr, int element = -1) {
+            Diagnostic d;
+            d.code = code;
+            d.severity = severity;
+            d.index = at;
+            d.command = state.command->commandName.id();
+            d.name = name;
+            d.element = element;
+            found.push_back(d);
+            if (severity == Severity::Error)
+                state.stopped = true;
+        };
+        // token 的识别和 parse 使用相同的规则
+        TOOLS::OptionToken option;
+        const bool commandLike = TOOLS::isCommandToken(token.c_str());
+        const bool optionLike = !commandLike && TOOLS::splitOptionToken(token.c_str(), option);
+        const bool inlineValue = optionLike && !option.value.empty();
+
+        if (state.expect == Expect::Value)
+        {
+            if (token.empty() || optionLike)
+                report(ErrorCode::MissingValue, Severity::Error, state.optionIndex, state.option->name.id());
+            state.expect = Expect::Any;
+            state.option = nullptr;
+            return commit(state);
+        }
+        if (state.expect == Expect::Values)
+        {
+            if (!optionLike)
             {
-                if (parseOptionName(res.str(1), !res.str(2).empty() ? res.str(2) : String()))
-                    continue;
-                return;
+                // 按类型转换时空字符串也是一个值，否则空字符串被跳过，不计入值的个数
+                if (!token.empty() || typedList(state.option, false))
+                    ++state.values;
+                return commit(state);
             }
-            // 尝试解析选项别名
-            if (std::regex_search(arg, res, optionAliasReg))
+            if (state.values == 0)
             {
-                if (parseMuiltOptionAlias(res.str(1), !res.str(2).empty() ? res.str(2) : String()))
-                    continue;
-                return;
+                report(ErrorCode::MissingValue, Severity::Error, state.optionIndex, state.option->name.id());
+                return commit(state);
             }
-            // 尝试解析参数
-            if (parseArgument(arg))
-                continue;
-            
-            // 非法标识符，直接结束
-            log(E, "invalid identifier: " + arg);
-            return;
+            state.expect = Expect::Any;
+            state.option = nullptr;
         }
 
-        if (opts.find(versionOption->name) != opts.end())
+        if (commandLike)
         {
-            log(P, version());
-            return;
+            if (Command *sub = state.command->findCommand(token))
+            {
+                state.command = sub;
+                state.positional = 0;
+                return commit(state);
+            }
         }
-
-        if (opts.find(helpOption->name) != opts.end())
+        if (optionLike && option.isLong)
         {
-            log(P, helpText());
-            return;
+            Option *opt = state.command->matchOption(option.name, false);
+            if (!opt)
+                report(ErrorCode::UnknownOption, Severity::Warning, index);
+            else
+                expectValue(state, opt, index, inlineValue, report);
+            return commit(state);
         }
-
-        bool argsEmpty = args.empty();
-        for (const auto arg : arguments)
+        if (optionLike)
         {
-            if (arg->valueIsRequired)
-            {
-                if (argsEmpty)
-                {
-                    log(E, "Command: " + commandName + String("'s argument: ") + arg->name + String(" is required, but got empty."));
-                    return;
-                }
-                break;
-            }
+            state.command->forEachAlias(option.name, index, report, [&](Option *opt, bool last) {
+                if (last)
+                    expectValue(state, opt, index, inlineValue, report);
+                return true;
+            });
+            return commit(state);
         }
 
-        if (actionCallback)
-            actionCallback(this, args, opts);
+        ErrorCode warning = state.command->argumentWarning(token);
+        if (warning != ErrorCode::None)
+            report(warning, Severity::Warning, index);
+        else
+            ++state.positional;
+        return commit(state);
     }
 
-  public:
     /*
-     * 通过名称查找子命令
+     * @brief 撤销最后一个 token
      */
-    Command *findCommand(const String &name)
+    void pop()
     {
-        for (const auto cmd : subCommands)
-        {
-            if (cmd->commandName == name)
-            {
-                return cmd;
-            }
-        }
-        return nullptr;
+        if (tokens.empty())
+            return;
+        tokens.pop_back();
+        states.pop_back();
+        found.resize(states.back().diagnostics);
     }
-    /**
-     * 获取日志操作对象指针
+
+    /*
+     * @brief 当前所在的子命令
      */
-    Logger *logger()
+    Command *command() const
     {
-        return pLogger;
+        return states.back().command;
     }
-
-  private:
-    class Option
+    Expect expecting() const
     {
-      public:
-        static Option *create(const String &flag, Logger *logger)
-        {
-            std::regex reg(
-                R"(^\s*(?:(?:-([a-zA-Z])(?:(?:\s+)|(?:\s*,\s*))\-\-([a-zA-Z-]+)\s+(?:\[([a-zA-Z]+)(\.\.\.)?\]|<([a-zA-Z]+)(\.\.\.)?>))|(?:-([a-zA-Z])(?:(?:\s+)|(?:\s*,\s*))\-\-([a-zA-Z-]+))|(?:\-\-([a-zA-Z-]+)\s+(?:(?:\[([a-zA-Z]+)(\.\.\.)?\])|(?:\<([a-zA-Z]+)(\.\.\.)?\>)))|(?:\-\-([a-zA-Z-]+)))\s*$)");
-            std::smatch res;
-            if (!std::regex_search(flag, res, reg))
-            {
-                return nullptr;
-            }
-            std::string alias = !res.str(1).empty() ? res.str(1) : !res.str(7).empty() ? res.str(7) : "";
-            std::string name = !res.str(2).empty()    ? res.str(2)
-                               : !res.str(8).empty()  ? res.str(8)
-                               : !res.str(9).empty()  ? res.str(9)
-                               : !res.str(14).empty() ? res.str(14)
-                                                      : "";
-            std::string valueName = !res.str(3).empty()    ? res.str(3)
-                                    : !res.str(5).empty()  ? res.str(5)
-                                    : !res.str(10).empty() ? res.str(10)
-                                    : !res.str(12).empty() ? res.str(12)
-                                                           : "";
-
-            bool multiValue =
-                !res.str(4).empty() || !res.str(6).empty() || !res.str(11).empty() || !res.str(13).empty();
-            bool valueIsRequired = !res.str(5).empty() || !res.str(12).empty();
-
-            if (logger)
-                logger->debug(String("create option: ") + String("alias: ") + alias + String(" name: ") + name +
-                              String(" valueName: ") + valueName + String(" multiValue: ") +
-                              std::to_string(multiValue) + String(" valueIsRequired: ") +
-                              std::to_string(valueIsRequired));
-
-            Option *opt = new Option();
-            opt->name = name;
-            opt->alias = alias;
-            opt->valueName = valueName;
-            opt->multiValue = multiValue;
-            opt->valueIsRequired = valueIsRequired;
-            return opt;
-        }
-
-        String name;
-        String alias;
-        String valueName;
-        bool multiValue = false;
-        bool valueIsRequired = false;
-
-        String desc;
-        Variant defaultValue;
-    };
-    class Argument
+        return states.back().expect;
+    }
+    /*
+     * @brief 正在等待值的选项名称，没有时为空
+     */
+    String pendingOption() const
     {
-      public:
-        static Argument *create(const String &name, Logger *logger)
-        {
-            std::regex reg(
-                R"(^\s*(?:(?:\[([a-zA-Z][a-zA-Z\d]+)(\.\.\.)?\])|(?:<([a-zA-Z][a-zA-Z\d]+)(\.\.\.)?>))\s*$)");
-            std::smatch res;
-            if (!std::regex_search(name, res, reg))
-            {
-                if (logger)
-                    logger->warn(String("invalid argument name: ") + name);
-                return nullptr;
-            }
-            String argName = !res.str(1).empty() ? res.str(1) : !res.str(3).empty() ? res.str(3) : "";
-            if (logger)
-                logger->debug(String("create argument: ") + String("name: ") + argName + String(" isMultiValue: ") +
-                              std::to_string(!res.str(2).empty() || !res.str(4).empty()) +
-                              String(" valueIsRequired: ") +
-                              std::to_string(!res.str(1).empty() || !res.str(3).empty()));
+        return states.back().option ? states.back().option->name.str() : String();
+    }
+    /*
+     * @brief 多值选项已经收到的值的个数
+     */
+    size_t pendingValues() const
+    {
+        return states.back().values;
+    }
+    /*
+     * @brief 当前命令已经收到的位置参数个数
+     */
+    size_t positional() const
+    {
+        return states.back().positional;
+    }
+    /*
+     * @brief 已经出现了会让 parse 终止的错误
+     */
+    bool stopped() const
+    {
+        return states.back().stopped;
+    }
+    /*
+     * @brief 到目前为止发现的警告和错误，下标与 finish 时的 argv 一致；
+     *        值的转换和必填参数检查在 finish 中完成
+     */
+    const Vector<Diagnostic> &diagnostics() const
+    {
+        return found;
+    }
+    const Vector<String> &tokenList() const
+    {
+        return tokens;
+    }
 
-            Argument *arg = new Argument;
-            arg->name = argName;
-            arg->isMultiValue = !res.str(2).empty() || !res.str(4).empty();
-            arg->valueIsRequired = !res.str(3).empty();
-            return arg;
-        }
+    /*
+     * @brief 在当前位置补全 prefix，正在等待选项的值时没有候选
+     */
+    Vector<CompletionCandidate> complete(const String &prefix) const
+    {
+        const State &state = states.back();
+        if (state.expect == Expect::Value ||
+            (state.expect == Expect::Values && (prefix.size() < 2 || prefix[0] != '-')))
+            return {};
+        return state.command->completionCandidates(prefix);
+    }
 
-        String name;
-        bool isMultiValue = false;
-        bool valueIsRequired = false;
+    /*
+     * @brief 用累计的 token 调用 parse，结果和执行与一次性解析相同
+     */
+    ParseResult finish()
+    {
+        String program = root.commandName.str();
+        Vector<char *> argv{&program[0]};
+        for (auto &token : tokens)
+            argv.push_back(&token[0]);
+        int argc = static_cast<int>(argv.size());
+        argv.push_back(nullptr);
+        return root.parse(argc, argv.data());
+    }
 
-        String desc;
-        Variant defaultValue;
+  private:
+    struct State
+    {
+        Command *command = nullptr;
+        Option *option = nullptr;
+        Expect expect = Expect::Any;
+        int optionIndex = -1;
+        size_t values = 0;
+        size_t positional = 0;
+        size_t diagnostics = 0;
+        bool stopped = false;
     };
 
-    String commandName;
-    String commandDescription;
-    Action actionCallback;
-    Option *versionOption;
-    Option *helpOption;
-    Command *parentCommand;
+    bool commit(State &state)
+    {
+        state.diagnostics = found.size();
+        states.push_back(state);
+        return !state.stopped;
+    }
 
-    Vector<Option *> options;
-    Vector<Argument *> arguments;
-    Vector<Command *> subCommands;
+    /*
+     * 与 parse 相同：带默认值的必填选项不读取后面的 token，--opt=value 直接带上了值
+     */
+    template <typename Report>
+    static void expectValue(State &state, Option *opt, int index, bool inlineValue, Report &report)
+    {
+        OptionBinding binding = state.command->bindingOf(opt);
+        if (binding == OptionBinding::Switch && inlineValue)
+            report(ErrorCode::UnexpectedValue, Severity::Warning, index, opt->name.id());
+        if ((binding != OptionBinding::Single && binding != OptionBinding::List) || inlineValue)
+            return;
+        state.option = opt;
+        state.optionIndex = index;
+        state.values = 0;
+        state.expect = binding == OptionBinding::List ? Expect::Values : Expect::Value;
+    }
 
-    Logger *pLogger;
+    Command &root;
+    Vector<String> tokens;
+    Vector<State> states;
+    Vector<Diagnostic> found;
 };
 } // namespace COMMANDER_CPP
 
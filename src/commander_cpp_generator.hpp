@@ -0,0 +1,248 @@
+/*
+MIT License
+
+Copyright (c) 2026 doyoung
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef COMMANDER_CPP_GENERATOR_HPP
+#define COMMANDER_CPP_GENERATOR_HPP
+
+#include "commander_cpp.hpp"
+
+namespace COMMANDER_CPP
+{
+/*
+ * 随机但可复现的命令树生成器，只使用公开的 command/option/argument 接口，
+ * 用于规模测试和性能基准
+ */
+namespace GENERATOR
+{
+struct TreeSpec
+{
+    uint64_t seed = 1;
+    // 子命令的最大层数，0 表示只有根命令
+    int depth = 3;
+    // 每个命令的子命令个数
+    int fanOut = 4;
+    int optionsPerCommand = 4;
+    // 选项带单字母别名的概率
+    double aliasDensity = 0.5;
+    // 选项带值的概率
+    double valueRatio = 0.5;
+    // 带值选项中多值选项的比例
+    double multiValueRatio = 0.25;
+    // 所有选项名称从这个大小的名称池中选取，池越小，命令之间共享的名称越多
+    size_t namePool = 64;
+    // 节点总数上限（包括根命令）
+    size_t maxNodes = 100000;
+};
+
+/*
+ * @brief splitmix64，结果只取决于种子，不依赖标准库分布的实现
+ */
+class Random
+{
+  public:
+    explicit Random(uint64_t seed) : state(seed)
+    {
+    }
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    uint64_t below(uint64_t n)
+    {
+        return n ? next() % n : 0;
+    }
+    bool chance(double p)
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0) < p;
+    }
+
+  private:
+    uint64_t state;
+};
+
+struct OptionSpec
+{
+    String name;
+    String alias;
+    bool hasValue = false;
+    bool multiValue = false;
+};
+
+struct NodeSpec
+{
+    String name;
+    Command *command = nullptr;
+    Vector<OptionSpec> options;
+    Vector<size_t> children;
+    bool hasArgument = false;
+};
+
+/*
+ * @brief 生成结果，nodes[0] 是根命令，root 释放时整棵树一起释放
+ */
+struct GeneratedTree
+{
+    std::unique_ptr<Command> root;
+    Vector<NodeSpec> nodes;
+};
+
+/*
+ * @brief 由小写字母组成的名称，选项名称不允许包含数字
+ */
+inline String letters(size_t index)
+{
+    String name;
+    do
+    {
+        name.push_back(static_cast<char>('a' + index % 26));
+        index /= 26;
+    } while (index);
+    return name;
+}
+
+inline GeneratedTree generateTree(const TreeSpec &spec, Logger *logger)
+{
+    Random random(spec.seed);
+    GeneratedTree tree;
+    tree.root.reset(new Command("root", logger));
+    NodeSpec rootNode;
+    rootNode.name = "root";
+    rootNode.command = tree.root.get();
+    tree.nodes.push_back(std::move(rootNode));
+
+    auto addOptions = [&](NodeSpec &node) {
+        // 版本和帮助选项占用了 V 和 h
+        String aliases = "abcdefgijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUWXYZ";
+        size_t first = random.below(std::max<size_t>(spec.namePool, 1));
+        for (int i = 0; i < spec.optionsPerCommand; ++i)
+        {
+            OptionSpec opt;
+            opt.name = "opt" + letters((first + i) % std::max<size_t>(spec.namePool, spec.optionsPerCommand));
+            if (!aliases.empty() && random.chance(spec.aliasDensity))
+            {
+                size_t at = random.below(aliases.size());
+                opt.alias = aliases.substr(at, 1);
+                aliases.erase(at, 1);
+            }
+            opt.hasValue = random.chance(spec.valueRatio);
+            opt.multiValue = opt.hasValue && random.chance(spec.multiValueRatio);
+
+            String flag = (opt.alias.empty() ? "" : "-" + opt.alias + " ") + "--" + opt.name;
+            if (opt.hasValue)
+                flag += opt.multiValue ? " <values...>" : " <value>";
+            node.command->option(flag, "generated option " + opt.name);
+            node.options.push_back(opt);
+        }
+    };
+
+    addOptions(tree.nodes[0]);
+
+    // 按层生成，保证节点数达到上限时树仍然是均衡的
+    Vector<std::pair<size_t, int>> queue = {{0, 0}};
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        size_t parent = queue[head].first;
+        int level = queue[head].second;
+        if (level >= spec.depth)
+            continue;
+
+        for (int i = 0; i < spec.fanOut && tree.nodes.size() < spec.maxNodes; ++i)
+        {
+            NodeSpec node;
+            node.name = "c" + std::to_string(tree.nodes.size());
+            node.hasArgument = random.chance(0.5);
+            node.command =
+                tree.nodes[parent].command->command(node.name + (node.hasArgument ? " [items...]" : ""),
+                                                    "generated command " + node.name);
+            addOptions(node);
+
+            tree.nodes[parent].children.push_back(tree.nodes.size());
+            queue.push_back({tree.nodes.size(), level + 1});
+            tree.nodes.push_back(std::move(node));
+        }
+    }
+    return tree;
+}
+
+/*
+ * @brief 为生成的树生成合法的命令行语料，每条以程序名开头
+ */
+inline Vector<Vector<String>> generateArgv(const GeneratedTree &tree, uint64_t seed, size_t count)
+{
+    Random random(seed);
+    Vector<Vector<String>> corpus;
+    corpus.reserve(count);
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        Vector<String> argv = {"root"};
+        size_t node = 0;
+        while (!tree.nodes[node].children.empty() && random.chance(0.8))
+        {
+            const auto &children = tree.nodes[node].children;
+            node = children[random.below(children.size())];
+            argv.push_back(tree.nodes[node].name);
+        }
+
+        const NodeSpec &spec = tree.nodes[node];
+        if (spec.hasArgument)
+        {
+            for (uint64_t i = random.below(3); i > 0; --i)
+                argv.push_back("item" + std::to_string(random.below(1000)));
+        }
+
+        String cluster;
+        for (const auto &opt : spec.options)
+        {
+            if (!random.chance(0.6))
+                continue;
+
+            // 不带值的别名组合成 -abc
+            if (!opt.hasValue && !opt.alias.empty() && random.chance(0.5))
+            {
+                cluster += opt.alias;
+                continue;
+            }
+
+            argv.push_back(!opt.alias.empty() && random.chance(0.5) ? "-" + opt.alias : "--" + opt.name);
+            if (!opt.hasValue)
+                continue;
+
+            uint64_t values = opt.multiValue ? 1 + random.below(4) : 1;
+            for (uint64_t i = 0; i < values; ++i)
+                argv.push_back(std::to_string(random.below(100000)));
+        }
+        if (!cluster.empty())
+            argv.push_back("-" + cluster);
+
+        corpus.push_back(std::move(argv));
+    }
+    return corpus;
+}
+} // namespace GENERATOR
+} // namespace COMMANDER_CPP
+
+#endif // COMMANDER_CPP_GENERATOR_HPP
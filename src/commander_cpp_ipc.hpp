@@ -0,0 +1,1097 @@
+/*
+MIT License
+
+Copyright (c) 2026 doyoung
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef COMMANDER_CPP_IPC_HPP
+#define COMMANDER_CPP_IPC_HPP
+
+#include <array>
+
+#include "commander_cpp.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <condition_variable>
+#include <deque>
+#define COMMANDER_CPP_HAS_UNIX_SOCKET 1
+extern char **environ;
+// 对端关闭时 send 返回错误，不产生 SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define COMMANDER_CPP_MSG_NOSIGNAL MSG_NOSIGNAL
+#else
+#define COMMANDER_CPP_MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace COMMANDER_CPP
+{
+/*
+ * 进程间调用：通过 Unix 域套接字把命令行转发给常驻进程
+ */
+namespace IPC
+{
+/*
+ * @brief 处理一次转发来的调用，返回值作为客户端进程的退出码
+ */
+using Handler = std::function<int(int argc, char **argv)>;
+
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+/*
+ * @brief 离开作用域时关闭的文件描述符
+ */
+class FileDescriptor
+{
+  public:
+    explicit FileDescriptor(int fd = -1) : fd(fd)
+    {
+    }
+    FileDescriptor(const FileDescriptor &) = delete;
+    FileDescriptor &operator=(const FileDescriptor &) = delete;
+    ~FileDescriptor()
+    {
+        reset();
+    }
+
+    int get() const
+    {
+        return fd;
+    }
+    void reset(int value = -1)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = value;
+    }
+
+  private:
+    int fd;
+};
+
+/*
+ * @brief 管道没有 MSG_NOSIGNAL：对端已关闭时只返回 EPIPE，不让 SIGPIPE 结束进程
+ */
+inline ssize_t writeNoSignal(int fd, const void *data, size_t size)
+{
+#ifdef F_SETNOSIGPIPE
+    ::fcntl(fd, F_SETNOSIGPIPE, 1);
+    return ::write(fd, data, size);
+#else
+    // 写入期间在当前线程屏蔽 SIGPIPE，再把这次写入产生的信号取走
+    sigset_t pipeSet, pending, previous;
+    sigemptyset(&pipeSet);
+    sigaddset(&pipeSet, SIGPIPE);
+    sigpending(&pending);
+    bool alreadyPending = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSet, &previous);
+    ssize_t n = ::write(fd, data, size);
+    int error = errno;
+    if (n < 0 && error == EPIPE && !alreadyPending)
+    {
+        struct timespec zero = {0, 0};
+        while (sigtimedwait(&pipeSet, nullptr, &zero) < 0 && errno == EINTR)
+        {
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    errno = error;
+    return n;
+#endif
+}
+
+/*
+ * @brief 写入全部数据，套接字和管道都可以使用
+ */
+inline bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *p = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t n = ::send(fd, p, size, COMMANDER_CPP_MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = writeNoSignal(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool readAll(int fd, void *data, size_t size)
+{
+    char *p = static_cast<char *>(data);
+    while (size > 0)
+    {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/*
+ * @brief 发送一段数据，同时通过 SCM_RIGHTS 附带文件描述符
+ */
+inline bool sendWithDescriptors(int fd, const void *data, size_t size, const int *fds, size_t count)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(data);
+    iov.iov_len = size;
+    Vector<char> control(CMSG_SPACE(sizeof(int) * count));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    ssize_t n;
+    do
+        n = ::sendmsg(fd, &msg, COMMANDER_CPP_MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    return n == static_cast<ssize_t>(size);
+}
+
+/*
+ * @brief 接收一段数据和附带的文件描述符，没有收到的位置填 -1
+ */
+inline bool receiveWithDescriptors(int fd, void *data, size_t size, int *fds, size_t count)
+{
+    std::fill(fds, fds + count, -1);
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = size;
+    Vector<char> control(CMSG_SPACE(sizeof(int) * count));
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n;
+    do
+        n = ::recvmsg(fd, &msg, 0);
+    while (n < 0 && errno == EINTR);
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        std::memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * std::min(received, count));
+        // 多余的描述符也要关闭，否则会泄漏到常驻进程中
+        for (size_t i = count; i < received; ++i)
+        {
+            int extra;
+            std::memcpy(&extra, CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+            ::close(extra);
+        }
+    }
+    if (n != static_cast<ssize_t>(size))
+        return n > 0 && readAll(fd, static_cast<char *>(data) + n, size - static_cast<size_t>(n));
+    return true;
+}
+
+// 一帧请求或响应的最大字节数，长度前缀来自对端，超过时直接断开而不是按它分配内存
+constexpr uint32_t maxFrameSize = 64u << 20;
+
+/*
+ * @brief 长度前缀的字符串序列，用于请求的编码和解码
+ */
+class Frame
+{
+  public:
+    Frame() = default;
+    explicit Frame(String bytes) : bytes(std::move(bytes))
+    {
+    }
+
+    void put(uint32_t value)
+    {
+        bytes.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+    void put(std::string_view text)
+    {
+        put(static_cast<uint32_t>(text.size()));
+        bytes.append(text.data(), text.size());
+    }
+
+    bool get(uint32_t &value)
+    {
+        if (bytes.size() - offset < sizeof(value))
+            return false;
+        std::memcpy(&value, bytes.data() + offset, sizeof(value));
+        offset += sizeof(value);
+        return true;
+    }
+    bool get(String &text)
+    {
+        uint32_t size = 0;
+        if (!get(size) || bytes.size() - offset < size)
+            return false;
+        text.assign(bytes.data() + offset, size);
+        offset += size;
+        return true;
+    }
+
+    const String &data() const
+    {
+        return bytes;
+    }
+    // 直接读入帧的缓冲区，避免再拷贝一次
+    char *buffer()
+    {
+        return &bytes[0];
+    }
+
+  private:
+    String bytes;
+    size_t offset = 0;
+};
+
+/*
+ * @brief 套接字对端进程是否属于当前用户；连接双方在交换数据之前都要检查，
+ *        不能只依赖套接字文件的权限，路径可能被其它用户抢先绑定
+ */
+inline bool peerIsCurrentUser(int fd)
+{
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t size = sizeof(cred);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) != 0)
+        return false;
+    return cred.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (::getpeereid(fd, &uid, &gid) != 0)
+        return false;
+    return uid == ::geteuid();
+#endif
+}
+
+/*
+ * @brief 确保 dir 是当前用户独占的目录（0700），不存在时创建；符号链接、其它用户的目录或权限过宽时返回 false
+ */
+inline bool privateDirectory(const String &dir)
+{
+    if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+        return false;
+    struct stat st;
+    if (::lstat(dir.c_str(), &st) != 0)
+        return false;
+    return S_ISDIR(st.st_mode) && st.st_uid == ::geteuid() && (st.st_mode & 077) == 0;
+}
+
+/*
+ * @brief 连接 path 上的套接字，监听的进程不属于当前用户时失败
+ */
+inline bool connectTo(const String &path, FileDescriptor &out)
+{
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    out.reset(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (out.get() < 0)
+        return false;
+    int r;
+    do
+        r = ::connect(out.get(), reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    while (r < 0 && errno == EINTR);
+    return r == 0 && peerIsCurrentUser(out.get());
+}
+
+/*
+ * @brief 在 path 上监听，路径上残留的套接字文件没有进程监听时会被替换；已经有进程在监听时失败
+ */
+inline bool listenOn(const String &path, FileDescriptor &out)
+{
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path))
+        return false;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        out.reset(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (out.get() < 0)
+            return false;
+        // 只有同一用户可以连接
+        mode_t mask = ::umask(0077);
+        int r = ::bind(out.get(), reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+        ::umask(mask);
+        if (r == 0)
+            return ::listen(out.get(), 64) == 0;
+        FileDescriptor probe;
+        if (errno != EADDRINUSE || connectTo(path, probe))
+            return false;
+        ::unlink(path.c_str());
+    }
+    return false;
+}
+#endif
+
+/*
+ * @brief 常驻进程模式：第一次调用在本进程执行后启动一个保存着已构建命令树的后台进程，
+ *        之后的调用把 argv、工作目录、环境变量和标准输入输出的文件描述符转发给后台进程执行，
+ *        只等待退出码，省去进程启动、命令树构建和应用初始化的开销
+ *        后台进程逐个串行处理请求，执行期间会切换进程的工作目录、环境变量和标准输入输出；
+ *        空闲超时或可执行文件发生变化后自动退出
+ */
+class Daemon
+{
+  public:
+    /*
+     * @param requestMilliseconds 接受连接后等待客户端发送请求的最长时间，超时丢弃连接
+     */
+    explicit Daemon(const String &socketPath, int idleSeconds = 600, int requestMilliseconds = 2000)
+        : path(socketPath), idleSeconds(idleSeconds), requestMilliseconds(requestMilliseconds)
+    {
+    }
+
+    /*
+     * @brief 默认的套接字路径，优先放在 $XDG_RUNTIME_DIR 中，否则放在临时目录下当前用户独占的 0700 目录中
+     * @return 临时目录下的目录属于其它用户或权限过宽时返回空字符串，此时 forward 和 listen 都会失败
+     */
+    static String defaultPath(const String &program)
+    {
+        const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+        if (runtime && *runtime)
+            return String(runtime) + "/" + program + ".sock";
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        // 共享的临时目录中可预测的路径可能被其它用户抢先创建，只使用检查过所有者和权限的目录
+        String dir = "/tmp/" + program + "-" + std::to_string(::geteuid());
+        if (!privateDirectory(dir))
+            return String();
+        return dir + "/" + program + ".sock";
+#else
+        return "/tmp/" + program + ".sock";
+#endif
+    }
+
+    /*
+     * @brief 默认的请求处理：用命令树解析并执行，解析出错时退出码为 1
+     */
+    static Handler parseHandler(Command &root)
+    {
+        return [&root](int argc, char **argv) { return root.parse(argc, argv).ok() ? 0 : 1; };
+    }
+
+    const String &socketPath() const
+    {
+        return path;
+    }
+
+    /*
+     * @brief 把本次调用转发给后台进程
+     * @param fds 转发的标准输入、输出和错误输出
+     * @return 没有可用的后台进程，或者后台进程属于另一个版本的可执行文件时返回 false，调用方应在本进程执行
+     */
+    bool forward(int argc, char **argv, int &status, const int (&fds)[3] = standardDescriptors())
+    {
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        FileDescriptor socket;
+        if (!connectTo(path, socket))
+            return false;
+
+        Frame request;
+        request.put(TOOLS::ExecutableIdentity::current().header());
+        char cwd[4096];
+        request.put(::getcwd(cwd, sizeof(cwd)) ? std::string_view(cwd) : std::string_view());
+        request.put(static_cast<uint32_t>(argc));
+        for (int i = 0; i < argc; ++i)
+            request.put(argv[i]);
+        uint32_t envCount = 0;
+        for (char **env = environ; env && *env; ++env)
+            ++envCount;
+        request.put(envCount);
+        for (char **env = environ; env && *env; ++env)
+            request.put(*env);
+
+        uint32_t size = static_cast<uint32_t>(request.data().size());
+        if (!sendWithDescriptors(socket.get(), &size, sizeof(size), fds, 3) ||
+            !writeAll(socket.get(), request.data().data(), size))
+            return false;
+
+        int32_t reply;
+        if (!readAll(socket.get(), &reply, sizeof(reply)))
+        {
+            // 请求已经送达，后台进程可能已经执行了一部分，不能再在本进程重新执行
+            status = 1;
+            return true;
+        }
+        if (reply == identityMismatch)
+            return false;
+        status = reply;
+        return true;
+#else
+        (void)argc;
+        (void)argv;
+        (void)status;
+        (void)fds;
+        return false;
+#endif
+    }
+
+    /*
+     * @brief 在后台启动常驻进程，继承当前进程中已经构建好的命令树和应用状态，当前进程立即返回
+     *        应当在单线程时调用：fork 出的进程中只有调用线程
+     * @return fork 失败或当前平台不支持时返回 false
+     */
+    bool start(const Handler &handler)
+    {
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        pid_t child = ::fork();
+        if (child < 0)
+            return false;
+        if (child > 0)
+        {
+            int ignored;
+            while (::waitpid(child, &ignored, 0) < 0 && errno == EINTR)
+            {
+            }
+            return true;
+        }
+
+        // 两次 fork，常驻进程脱离当前进程和终端，不会留下僵尸进程
+        ::setsid();
+        if (::fork() != 0)
+            ::_exit(0);
+        int null = ::open("/dev/null", O_RDWR);
+        if (null >= 0)
+        {
+            for (int fd = 0; fd < 3; ++fd)
+                ::dup2(null, fd);
+            if (null > 2)
+                ::close(null);
+        }
+        if (listen())
+            serve(handler);
+        ::_exit(0);
+#else
+        (void)handler;
+        return false;
+#endif
+    }
+
+    /*
+     * @brief 在套接字路径上开始监听，已经有后台进程在监听时返回 false
+     */
+    bool listen()
+    {
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        identity = TOOLS::ExecutableIdentity::current().header();
+        struct stat st;
+        if (!listenOn(path, listener) || ::stat(path.c_str(), &st) != 0)
+            return false;
+        boundInode = st.st_ino;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /*
+     * @brief 在当前线程中逐个处理请求，直到空闲超时、收到另一个版本的客户端或调用 stop
+     * @return 处理的请求数
+     */
+    size_t serve(const Handler &handler)
+    {
+        size_t served = 0;
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        if (listener.get() < 0)
+            return served;
+        auto idleSince = std::chrono::steady_clock::now();
+        while (!stopped.load(std::memory_order_relaxed))
+        {
+            // 分段等待，stop 最迟在一个周期后生效
+            struct pollfd pfd = {listener.get(), POLLIN, 0};
+            int ready = ::poll(&pfd, 1, 100);
+            if (ready < 0 && errno != EINTR)
+                break;
+            if (ready <= 0)
+            {
+                if (std::chrono::steady_clock::now() - idleSince > std::chrono::seconds(idleSeconds))
+                    break;
+                continue;
+            }
+            FileDescriptor connection(::accept(listener.get(), nullptr, nullptr));
+            // 只为同一用户执行，否则会把环境变量和标准输入输出交给其它用户
+            if (connection.get() < 0 || !peerIsCurrentUser(connection.get()))
+                continue;
+            if (handle(connection.get(), handler))
+                ++served;
+            idleSince = std::chrono::steady_clock::now();
+        }
+        // 只删除仍然属于自己的套接字文件
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0 && st.st_ino == boundInode)
+            ::unlink(path.c_str());
+        listener.reset();
+#else
+        (void)handler;
+#endif
+        return served;
+    }
+
+    void stop()
+    {
+        stopped.store(true, std::memory_order_relaxed);
+    }
+
+  private:
+    // 后台进程属于另一个版本的可执行文件，客户端应当自己执行
+    static constexpr int32_t identityMismatch = INT32_MIN;
+
+    static const int (&standardDescriptors())[3]
+    {
+        static const int fds[3] = {0, 1, 2};
+        return fds;
+    }
+
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+    bool handle(int connection, const Handler &handler)
+    {
+        // 连接逐个处理，停顿的客户端不能阻塞后面的调用：每次读取超时都会丢弃连接
+        struct timeval timeout;
+        timeout.tv_sec = requestMilliseconds / 1000;
+        timeout.tv_usec = (requestMilliseconds % 1000) * 1000;
+        ::setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        uint32_t size = 0;
+        int fds[3];
+        if (!receiveWithDescriptors(connection, &size, sizeof(size), fds, 3))
+        {
+            for (int fd : fds)
+                if (fd >= 0)
+                    ::close(fd);
+            return false;
+        }
+        FileDescriptor in(fds[0]), out(fds[1]), err(fds[2]);
+        // 长度来自客户端，先检查上限再分配
+        if (size == 0 || size > maxFrameSize)
+            return false;
+        Frame request(String(size, '\0'));
+        if (!readAll(connection, request.buffer(), size))
+            return false;
+
+        String clientIdentity, cwd;
+        uint32_t argc = 0, envCount = 0;
+        Vector<String> args, env;
+        bool valid = request.get(clientIdentity) && request.get(cwd) && request.get(argc);
+        for (uint32_t i = 0; valid && i < argc; ++i)
+            valid = request.get(args.emplace_back());
+        valid = valid && request.get(envCount);
+        for (uint32_t i = 0; valid && i < envCount; ++i)
+            valid = request.get(env.emplace_back());
+        if (!valid || in.get() < 0 || out.get() < 0 || err.get() < 0)
+            return false;
+
+        if (clientIdentity != identity)
+        {
+            // 可执行文件已经更新，让出套接字路径，由客户端在本进程执行并启动新的后台进程
+            ::unlink(path.c_str());
+            int32_t reply = identityMismatch;
+            writeAll(connection, &reply, sizeof(reply));
+            stop();
+            return false;
+        }
+
+        int32_t status = run(args, cwd, env, {in.get(), out.get(), err.get()}, handler);
+        writeAll(connection, &status, sizeof(status));
+        return true;
+    }
+
+    int32_t run(Vector<String> &args, const String &cwd, const Vector<String> &env, const std::array<int, 3> &fds,
+                const Handler &handler)
+    {
+        // 切换到客户端的工作目录和环境变量
+        if (!cwd.empty() && ::chdir(cwd.c_str()) != 0)
+            return 1;
+        Vector<String> names;
+        for (char **e = environ; e && *e; ++e)
+            names.emplace_back(*e, std::strcspn(*e, "="));
+        for (const auto &name : names)
+            ::unsetenv(name.c_str());
+        for (const auto &entry : env)
+        {
+            size_t eq = entry.find('=');
+            if (eq != String::npos && eq > 0)
+                ::setenv(entry.substr(0, eq).c_str(), entry.c_str() + eq + 1, 1);
+        }
+
+        // 标准输入输出换成客户端的，执行完成后恢复
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        int saved[3];
+        for (int fd = 0; fd < 3; ++fd)
+        {
+            saved[fd] = ::dup(fd);
+            ::dup2(fds[fd], fd);
+        }
+
+        Vector<char *> argv;
+        for (auto &arg : args)
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        int32_t status = 1;
+#if defined(__cpp_exceptions)
+        try
+        {
+            status = handler(static_cast<int>(args.size()), argv.data());
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+        }
+        catch (...)
+        {
+        }
+#else
+        status = handler(static_cast<int>(args.size()), argv.data());
+#endif
+
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush(nullptr);
+        // 上一个请求读到文件末尾后 std::cin 处于失败状态，下一个请求重新开始
+        std::cin.clear();
+        std::clearerr(stdin);
+        for (int fd = 0; fd < 3; ++fd)
+        {
+            if (saved[fd] >= 0)
+            {
+                ::dup2(saved[fd], fd);
+                ::close(saved[fd]);
+            }
+        }
+        return status;
+    }
+
+    FileDescriptor listener;
+    ino_t boundInode = 0;
+    String identity;
+#endif
+    String path;
+    int idleSeconds;
+    int requestMilliseconds;
+    std::atomic<bool> stopped{false};
+};
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+/*
+ * @brief 请求执行期间收集输出：action 通过 Service::output() 写入，CaptureLogger 转发日志
+ */
+struct Capture
+{
+    std::ostringstream output;
+    String errors;
+
+    static Capture *&current()
+    {
+        thread_local Capture *capture = nullptr;
+        return capture;
+    }
+};
+
+/*
+ * @brief 请求执行期间把 print 写入请求的输出、warn 和 error 写入请求的错误信息，其它时候交给 inner
+ *        解析诊断由 Service 从 ParseResult 格式化，这里不重复记录
+ */
+class CaptureLogger : public Logger
+{
+  public:
+    explicit CaptureLogger(Logger *inner = nullptr) : inner(inner)
+    {
+    }
+
+    virtual Logger *debug(const String &msg) override
+    {
+        if (!Capture::current() && inner)
+            inner->debug(msg);
+        return this;
+    }
+    virtual Logger *warn(const String &msg) override
+    {
+        if (Capture *capture = Capture::current())
+            capture->errors += "warning: " + msg + "\n";
+        else if (inner)
+            inner->warn(msg);
+        return this;
+    }
+    virtual Logger *error(const String &msg) override
+    {
+        if (Capture *capture = Capture::current())
+            capture->errors += "error: " + msg + "\n";
+        else if (inner)
+            inner->error(msg);
+        return this;
+    }
+    virtual Logger *print(const String &msg) override
+    {
+        if (Capture *capture = Capture::current())
+            capture->output << msg << "\n";
+        else if (inner)
+            inner->print(msg);
+        return this;
+    }
+    virtual Logger *diagnostic(const Diagnostic &d, const char *token) override
+    {
+        if (!Capture::current() && inner)
+            inner->diagnostic(d, token);
+        return this;
+    }
+
+  private:
+    Logger *inner;
+};
+#endif
+
+/*
+ * @brief 把命令树作为请求/响应服务，通过 Unix 域套接字或者管道（例如标准输入输出）接收命令行
+ *        请求：4 字节长度 + 命令行文本，按响应文件的规则切分（空白分隔、引号和反斜杠转义），不包括程序名
+ *        响应：4 字节长度 + 退出码、输出和错误信息（各自以 4 字节长度为前缀）
+ *        同一个连接上的请求可以连续发送，在线程池中并行解析和执行，响应由连接自己的线程按请求的顺序写出
+ *        命令树在构造时被冻结；action 会被并发调用，应当是线程安全的，输出写入 output() 或者使用 CaptureLogger
+ */
+class Service
+{
+  public:
+    struct Response
+    {
+        int32_t status = 0;
+        String output;
+        String errors;
+    };
+
+    explicit Service(Command &root, size_t threads = 0, size_t maxInFlight = 1024)
+        : root(root.freeze())
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+          ,
+          pool(threads)
+#endif
+          ,
+          maxInFlight(std::max<size_t>(1, maxInFlight))
+    {
+        (void)threads;
+    }
+
+    /*
+     * @brief 当前请求的输出，只能在 action 中使用；不在请求中时写入 std::cout
+     */
+    static std::ostream &output()
+    {
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        if (Capture *capture = Capture::current())
+            return capture->output;
+#endif
+        return std::cout;
+    }
+
+    /*
+     * @brief 在当前线程中执行一条命令行，不经过网络，Service 内部和测试使用
+     */
+    Response execute(const String &line)
+    {
+        Response response;
+        String buffer = line;
+        buffer.push_back('\0');
+        Vector<char *> argv;
+        String program = root->name();
+        argv.push_back(&program[0]);
+        if (!TOOLS::tokenize(&buffer[0], &buffer[0] + line.size(), argv))
+        {
+            response.status = 1;
+            response.errors = "error: unterminated quote\n";
+            return response;
+        }
+        int argc = static_cast<int>(argv.size());
+        argv.push_back(nullptr);
+
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        Capture capture;
+        Capture *previous = Capture::current();
+        Capture::current() = &capture;
+#endif
+        ParseResult result = root->parse(argc, argv.data());
+        response.status = result.ok() ? 0 : 1;
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+        Capture::current() = previous;
+        response.output = capture.output.str();
+        response.errors = capture.errors;
+#endif
+        response.errors += result.format(argc, argv.data());
+        return response;
+    }
+
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+    /*
+     * @brief 处理一个连接上的全部请求，直到输入结束；in 和 out 可以是同一个套接字，也可以是标准输入输出
+     * @return 处理的请求数
+     */
+    size_t serve(int in, int out)
+    {
+        Stream stream;
+        stream.out = out;
+        // 响应由这个连接自己的线程按顺序写出，不读取响应的客户端只会阻塞它自己，不会占住线程池
+        std::thread writer([this, &stream] { writeResponses(stream); });
+        uint64_t sequence = 0;
+        while (true)
+        {
+            uint32_t size = 0;
+            if (!readAll(in, &size, sizeof(size)) || size > maxFrameSize)
+                break;
+            String line(size, '\0');
+            if (size && !readAll(in, &line[0], size))
+                break;
+            {
+                // 未返回的响应过多时等待，避免客户端只发送不读取时占用无限的内存
+                std::unique_lock<std::mutex> lock(stream.mutex);
+                stream.changed.wait(lock, [&] { return stream.inFlight < maxInFlight; });
+                ++stream.inFlight;
+            }
+            pool.submit([this, &stream, sequence, line = std::move(line)] { finish(stream, sequence, execute(line)); });
+            ++sequence;
+        }
+        {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            stream.closed = true;
+        }
+        stream.changed.notify_all();
+        writer.join();
+        return sequence;
+    }
+
+    /*
+     * @brief 在 path 上监听，已经有进程在监听时返回 false
+     */
+    bool listen(const String &path)
+    {
+        socketPath = path;
+        return listenOn(path, listener);
+    }
+
+    /*
+     * @brief 接受连接，每个连接在自己的线程中读取请求，直到调用 stop
+     *
+     * 连接结束的线程在下一轮循环中回收，线程数只随同时存在的连接数增长
+     */
+    void run()
+    {
+        Map<std::thread::id, std::thread> readers;
+        while (!stopped.load(std::memory_order_relaxed) && listener.get() >= 0)
+        {
+            reap(readers);
+            struct pollfd pfd = {listener.get(), POLLIN, 0};
+            int ready = ::poll(&pfd, 1, 100);
+            if (ready < 0 && errno != EINTR)
+                break;
+            if (ready <= 0)
+                continue;
+            int connection = ::accept(listener.get(), nullptr, nullptr);
+            if (connection < 0)
+                continue;
+            if (!peerIsCurrentUser(connection))
+            {
+                ::close(connection);
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.push_back(connection);
+            // 持有锁时创建线程，线程结束前登记的 id 一定已经在 readers 中
+            std::thread reader([this, connection] {
+                serve(connection, connection);
+                std::lock_guard<std::mutex> lock(connectionsMutex);
+                connections.erase(std::find(connections.begin(), connections.end(), connection));
+                ::close(connection);
+                finishedReaders.push_back(std::this_thread::get_id());
+            });
+            readers.emplace(reader.get_id(), std::move(reader));
+        }
+        {
+            // 停止读取新的请求，已经收到的请求仍然会返回响应
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            for (int connection : connections)
+                ::shutdown(connection, SHUT_RD);
+        }
+        for (auto &reader : readers)
+            reader.second.join();
+        finishedReaders.clear();
+        if (listener.get() >= 0)
+        {
+            ::unlink(socketPath.c_str());
+            listener.reset();
+        }
+    }
+
+    void stop()
+    {
+        stopped.store(true, std::memory_order_relaxed);
+    }
+
+    /*
+     * @brief 客户端：发送一条请求，可以连续发送多条后再依次读取响应
+     */
+    static bool send(int fd, std::string_view line)
+    {
+        uint32_t size = static_cast<uint32_t>(line.size());
+        return writeAll(fd, &size, sizeof(size)) && writeAll(fd, line.data(), line.size());
+    }
+
+    /*
+     * @brief 客户端：按发送顺序读取下一条响应
+     */
+    static bool receive(int fd, Response &response)
+    {
+        uint32_t size = 0;
+        // 响应至少包含状态码和两个长度前缀，长度来自对端，先检查上限再分配
+        if (!readAll(fd, &size, sizeof(size)) || size < 3 * sizeof(uint32_t) || size > maxFrameSize)
+            return false;
+        Frame frame(String(size, '\0'));
+        if (!readAll(fd, frame.buffer(), size))
+            return false;
+        uint32_t status = 0;
+        if (!frame.get(status) || !frame.get(response.output) || !frame.get(response.errors))
+            return false;
+        response.status = static_cast<int32_t>(status);
+        return true;
+    }
+#endif
+
+  private:
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+    /*
+     * 一个连接的输出端，响应按请求的顺序写出
+     */
+    struct Stream
+    {
+        int out = -1;
+        std::mutex mutex;
+        std::condition_variable changed;
+        Map<uint64_t, String> done;
+        uint64_t next = 0;
+        size_t inFlight = 0;
+        // 不再读取新的请求
+        bool closed = false;
+    };
+
+    void finish(Stream &stream, uint64_t sequence, const Response &response)
+    {
+        Frame frame;
+        frame.put(0u);
+        frame.put(static_cast<uint32_t>(response.status));
+        frame.put(response.output);
+        frame.put(response.errors);
+        String bytes = frame.data();
+        uint32_t size = static_cast<uint32_t>(bytes.size() - sizeof(uint32_t));
+        std::memcpy(&bytes[0], &size, sizeof(size));
+
+        // 持有锁时通知，serve 在全部响应写出之前不会返回，stream 在这里一定有效
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.done.emplace(sequence, std::move(bytes));
+        stream.changed.notify_all();
+    }
+
+    /*
+     * @brief 按请求的顺序写出已完成的响应，直到连接不再读取请求并且全部响应都已写出
+     *        写入时不持有锁，工作线程可以继续放入后面的响应
+     */
+    void writeResponses(Stream &stream)
+    {
+        bool failed = false;
+        std::unique_lock<std::mutex> lock(stream.mutex);
+        while (true)
+        {
+            stream.changed.wait(lock, [&] {
+                return stream.done.count(stream.next) || (stream.closed && stream.inFlight == 0);
+            });
+            auto it = stream.done.find(stream.next);
+            if (it == stream.done.end())
+                return;
+            String bytes = std::move(it->second);
+            stream.done.erase(it);
+            lock.unlock();
+            // 客户端断开后丢弃剩余的响应，但仍然要等到全部请求执行完毕
+            if (!failed)
+                failed = !writeAll(stream.out, bytes.data(), bytes.size());
+            lock.lock();
+            ++stream.next;
+            --stream.inFlight;
+            stream.changed.notify_all();
+        }
+    }
+
+    void reap(Map<std::thread::id, std::thread> &readers)
+    {
+        Vector<std::thread::id> finished;
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            finished.swap(finishedReaders);
+        }
+        for (auto id : finished)
+        {
+            auto it = readers.find(id);
+            if (it == readers.end())
+                continue;
+            it->second.join();
+            readers.erase(it);
+        }
+    }
+#endif
+
+    Command *root;
+#ifdef COMMANDER_CPP_HAS_UNIX_SOCKET
+    TOOLS::WorkerPool pool;
+    FileDescriptor listener;
+    String socketPath;
+    std::mutex connectionsMutex;
+    Vector<int> connections;
+    Vector<std::thread::id> finishedReaders;
+#endif
+    size_t maxInFlight;
+    std::atomic<bool> stopped{false};
+};
+} // namespace IPC
+} // namespace COMMANDER_CPP
+
+#endif // COMMANDER_CPP_IPC_HPP
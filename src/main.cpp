@@ -1,7 +1,17 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
 
+// 测试程序统计内存分配，用于断言热路径上没有分配
+#define COMMANDER_CPP_ALLOC_TRACKING
+#define COMMANDER_CPP_ENABLE_PROFILER
 #include "commander_cpp.hpp"
+#include "commander_cpp_generator.hpp"
+#include "commander_cpp_ipc.hpp"
+
+COMMANDER_CPP_DEFINE_ALLOC_HOOKS()
 
 using namespace COMMANDER_CPP;
 
@@ -902,23 +912,1930 @@ class IntegratedTest : public Command, public Test
     }
 };
 
+class ResponseFileTest : public Command, public Test
+{
+  public:
+    ResponseFileTest() : Command("", new TestLogger())
+    {
+        this->name(id())
+            ->description("测试响应文件")
+            ->responseFile(true, 2)
+            ->option("-f --files <files...>", "文件列表")
+            ->option("-n --name <name>", "名称");
+    }
+    virtual std::string id() override
+    {
+        return "ResponseFileTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger *logger = static_cast<TestLogger *>(this->logger());
+
+        std::filesystem::path dir = std::filesystem::temp_directory_path();
+        String outer = (dir / "commander_cpp_rsp_outer.txt").string();
+        String inner = (dir / "commander_cpp_rsp_inner.txt").string();
+        String loop = (dir / "commander_cpp_rsp_loop.txt").string();
+        std::ofstream(inner) << "file2.txt \"file 3.txt\"\n'file\\4.txt' long_file_name_\\ with_escape.txt";
+        std::ofstream(outer) << "-f file1.txt @" << inner << "\n  --name\tdemo";
+        std::ofstream(loop) << "@" << loop;
+
+        do
+        {
+            bool called = false;
+            this->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                called = true;
+                auto files = std::get_if<std::vector<VariantBase>>(&opts["files"]);
+                std::vector<std::string> expected = {"file1.txt", "file2.txt", "file 3.txt", "file\\4.txt",
+                                                     "long_file_name_ with_escape.txt"};
+                if (!files || files->size() != expected.size())
+                {
+                    results.push_back(TestResult{false, "响应文件展开的文件数量不正确"});
+                    return;
+                }
+                for (size_t i = 0; i < expected.size(); i++)
+                {
+                    auto file = std::get_if<String>(&(*files)[i]);
+                    if (!file || *file != expected[i])
+                        results.push_back(TestResult{false, "响应文件展开的值不匹配: " + expected[i]});
+                }
+                auto name = std::get_if<String>(&opts["name"]);
+                if (!name || *name != "demo")
+                    results.push_back(TestResult{false, "响应文件中的 --name 未正确解析"});
+            });
+
+            String arg = "@" + outer;
+            char *argv[] = {(char *)"testCommand", (char *)arg.c_str()};
+            this->parse(2, argv);
+
+            if (!called)
+                results.push_back(TestResult{false, "响应文件展开后 action 未执行"});
+        } while (false);
+
+        do
+        {
+            this->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+            bool hasError = false;
+            logger->checkError = [&](const std::string &msg) {
+                if (msg.find("exceeds max depth") != std::string::npos)
+                    hasError = true;
+            };
+            String arg = "@" + loop;
+            char *argv[] = {(char *)"testCommand", (char *)arg.c_str()};
+            this->parse(2, argv);
+            logger->checkError = nullptr;
+
+            results.push_back(hasError ? TestResult{true, ""} : TestResult{false, "未正确报告响应文件嵌套过深"});
+        } while (false);
+
+        std::filesystem::remove(outer);
+        std::filesystem::remove(inner);
+        std::filesystem::remove(loop);
+        return mergeAll(results);
+    }
+};
+
+class VisitorTest : public Command, public Test
+{
+  public:
+    VisitorTest() : Command("", new TestLogger())
+    {
+        this->name(id())
+            ->description("测试流式多值选项和参数")
+            ->option("-i --ids <ids...>", "编号列表")
+            ->option("-n --name <name>", "名称")
+            ->argument("<first>", "第一个参数")
+            ->argument("[rest...]", "其余参数")
+            ->visitOption("ids", [this](size_t index, const VariantBase &value) {
+                auto id = std::get_if<int>(&value);
+                if (!id || *id != static_cast<int>(index + 1) || actionCalled)
+                    badValue = true;
+                idSum += id ? *id : 0;
+            })
+            ->visitArgument("rest", [this](size_t index, const VariantBase &value) {
+                auto v = std::get_if<String>(&value);
+                rest.push_back(v ? *v : String());
+            });
+    }
+    virtual std::string id() override
+    {
+        return "VisitorTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+
+        this->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+            actionCalled = true;
+            auto ids = std::get_if<std::vector<VariantBase>>(&opts["ids"]);
+            if (!ids || !ids->empty())
+                results.push_back(TestResult{false, "流式选项的值不应再收集到 opts 中"});
+            if (args.size() != 1 || !std::holds_alternative<String>(args[0]) || std::get<String>(args[0]) != "head")
+                results.push_back(TestResult{false, "非流式参数解析不正确"});
+            auto name = std::get_if<String>(&opts["name"]);
+            if (!name || *name != "demo")
+                results.push_back(TestResult{false, "流式选项之后的选项解析不正确"});
+        });
+
+        char *argv[] = {(char *)"testCommand", (char *)"head", (char *)"a", (char *)"b", (char *)"-i",
+                        (char *)"1",           (char *)"2",    (char *)"3", (char *)"4", (char *)"--name",
+                        (char *)"demo",        (char *)"c"};
+        this->parse(12, argv);
+
+        if (!actionCalled)
+            results.push_back(TestResult{false, "action 未执行"});
+        if (badValue || idSum != 10)
+            results.push_back(TestResult{false, "流式选项的值或序号不正确"});
+        if (rest != std::vector<String>{"a", "b", "c"})
+            results.push_back(TestResult{false, "流式参数的值不正确"});
+
+        return mergeAll(results);
+    }
+
+  private:
+    bool actionCalled = false;
+    bool badValue = false;
+    int idSum = 0;
+    std::vector<String> rest;
+};
+
+class TypedOptionTest : public Command, public Test
+{
+  public:
+    TypedOptionTest() : Command("", new TestLogger())
+    {
+        this->name(id())
+            ->description("测试带元素类型的多值选项")
+            ->option("-i --ids <ids...>", "编号列表", ValueType::Int64)
+            ->option("-r --ratios <ratios...>", "比例列表", ValueType::Double)
+            ->option("-n --names <names...>", "名称列表", ValueType::StringView);
+    }
+    virtual std::string id() override
+    {
+        return "TypedOptionTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger *logger = static_cast<TestLogger *>(this->logger());
+
+        do
+        {
+            bool called = false;
+            this->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                called = true;
+                auto ids = std::get_if<Int64List>(&opts["ids"]);
+                if (!ids || *ids != Int64List{1, -2, 3000000000})
+                    results.push_back(TestResult{false, "ids 的值不正确"});
+                auto ratios = std::get_if<DoubleList>(&opts["ratios"]);
+                if (!ratios || *ratios != DoubleList{0.5, 2})
+                    results.push_back(TestResult{false, "ratios 的值不正确"});
+                auto names = std::get_if<StringViewList>(&opts["names"]);
+                if (!names || names->size() != 2 || (*names)[0] != "a b" || (*names)[1] != "c")
+                    results.push_back(TestResult{false, "names 的值不正确"});
+            });
+
+            char *argv[] = {(char *)"testCommand", (char *)"--ids",  (char *)"1",   (char *)"-2",
+                            (char *)"3000000000",  (char *)"-r",     (char *)"0.5", (char *)"2",
+                            (char *)"--names",     (char *)"'a b'", (char *)"c"};
+            this->parse(11, argv);
+            if (!called)
+                results.push_back(TestResult{false, "action 未执行"});
+        } while (false);
+
+        do
+        {
+            bool hasError = false;
+            logger->checkError = [&](const std::string &msg) {
+                if (msg == "option: ids got an invalid value at index 2: x3")
+                    hasError = true;
+            };
+            this->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                results.push_back(TestResult{false, "转换失败时不应执行 action"});
+            });
+            char *argv[] = {(char *)"testCommand", (char *)"--ids", (char *)"1", (char *)"2", (char *)"x3", (char *)"y"};
+            this->parse(6, argv);
+            logger->checkError = nullptr;
+
+            results.push_back(hasError ? TestResult{true, ""} : TestResult{false, "未正确报告第一个非法元素的位置"});
+        } while (false);
+
+        return mergeAll(results);
+    }
+};
+
+class ParallelConversionTest : public Command, public Test
+{
+  public:
+    ParallelConversionTest() : Command("", new TestLogger())
+    {
+        this->name(id())
+            ->description("测试多值选项的并行转换")
+            ->parallelConversion(8, 4)
+            ->option("-i --ids <ids...>", "编号列表", ValueType::Int64);
+    }
+    virtual std::string id() override
+    {
+        return "ParallelConversionTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger *logger = static_cast<TestLogger *>(this->logger());
+
+        std::vector<std::string> values;
+        for (int i = 0; i < 100; i++)
+            values.push_back(std::to_string(i));
+        std::vector<char *> argv = {(char *)"testCommand", (char *)"--ids"};
+        for (auto &v : values)
+            argv.push_back(&v[0]);
+
+        do
+        {
+            bool called = false;
+            this->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                called = true;
+                auto ids = std::get_if<Int64List>(&opts["ids"]);
+                if (!ids || ids->size() != 100)
+                {
+                    results.push_back(TestResult{false, "并行转换的值数量不正确"});
+                    return;
+                }
+                for (int64_t i = 0; i < 100; i++)
+                {
+                    if ((*ids)[i] != i)
+                    {
+                        results.push_back(TestResult{false, "并行转换的值不正确"});
+                        return;
+                    }
+                }
+            });
+            this->parse(static_cast<int>(argv.size()), argv.data());
+            if (!called)
+                results.push_back(TestResult{false, "action 未执行"});
+        } while (false);
+
+        do
+        {
+            // 多个分块都有非法值时，必须报告下标最小的那个
+            values[80] = "bad80";
+            values[57] = "bad57";
+            values[99] = "bad99";
+            bool hasError = false;
+            logger->checkError = [&](const std::string &msg) {
+                if (msg == "option: ids got an invalid value at index 57: bad57")
+                    hasError = true;
+            };
+            this->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+            argv.resize(2);
+            for (auto &v : values)
+                argv.push_back(&v[0]);
+            this->parse(static_cast<int>(argv.size()), argv.data());
+            logger->checkError = nullptr;
+
+            results.push_back(hasError ? TestResult{true, ""} : TestResult{false, "并行转换未报告第一个非法元素"});
+        } while (false);
+
+        return mergeAll(results);
+    }
+};
+
+class CompactValueTest : public Test
+{
+  public:
+    virtual std::string id() override
+    {
+        return "CompactValueTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+
+        if (sizeof(CompactValue) != 16)
+            results.push_back(TestResult{false, "CompactValue 不是 16 字节"});
+
+        std::vector<Variant> values = {Variant(),
+                                       Variant(42),
+                                       Variant(3.5),
+                                       Variant(true),
+                                       Variant(String("short")),
+                                       Variant(String("a string that does not fit inline")),
+                                       Variant(std::vector<VariantBase>{1, 2.5, String("x"), false}),
+                                       Variant(Int64List{1, -2, 3000000000}),
+                                       Variant(DoubleList{0.25, 4}),
+                                       Variant(StringViewList{"a", "longer than fifteen bytes"})};
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            CompactValue value = CompactValue::fromVariant(values[i]);
+            CompactValue copied = value;
+            CompactValue moved = std::move(value);
+            if (copied.toVariant() != values[i] || moved.toVariant() != values[i])
+                results.push_back(TestResult{false, "CompactValue 与 Variant 相互转换不一致, 下标: " + std::to_string(i)});
+        }
+
+        CompactValue inlined("fifteen bytes!!");
+        CompactValue view = CompactValue::view("viewed text");
+        if (inlined.toStringView() != "fifteen bytes!!" || view.toStringView() != "viewed text" ||
+            view.kind() != CompactValue::Kind::String)
+            results.push_back(TestResult{false, "CompactValue 字符串存储不正确"});
+
+        CompactValue list = CompactValue::fromVariant(Variant(Int64List{7, 8}));
+        if (list.kind() != CompactValue::Kind::List || list.size() != 2 || list.at(1).toInt() != 8)
+            results.push_back(TestResult{false, "CompactValue 列表访问不正确"});
+
+        TestLogger logger;
+        Command cmd("compact", &logger);
+        bool called = false;
+        cmd.option("-n --name <name>", "名称")
+            ->option("--ids <ids...>", "编号列表", ValueType::Int64)
+            ->option("--tags <tags...>", "标签")
+            ->argument("<file>", "文件")
+            ->compactAction([&](Command *, Vector<CompactValue> args, Map<String, CompactValue> opts) {
+                called = true;
+                if (args.size() != 1 || args[0].toStringView() != "input-file-with-a-long-name.txt")
+                    results.push_back(TestResult{false, "compactAction 的参数值不正确"});
+                if (opts["name"].toStringView() != "demo" || opts["ids"].size() != 3 || opts["ids"].at(2).toInt() != 3)
+                    results.push_back(TestResult{false, "compactAction 的选项值不正确"});
+                const CompactValue &tags = opts["tags"];
+                if (tags.size() != 2 || tags.at(0).toInt() != 7 || tags.at(1).toStringView() != "quoted" ||
+                    tags.toVariant() != Variant(std::vector<VariantBase>{7, String("quoted")}))
+                    results.push_back(TestResult{false, "compactAction 的多值选项不正确"});
+            });
+        char *argv[] = {(char *)"compact", (char *)"input-file-with-a-long-name.txt",
+                        (char *)"--name",  (char *)"demo",
+                        (char *)"--ids",   (char *)"1",
+                        (char *)"2",       (char *)"3",
+                        (char *)"--tags",  (char *)"7",
+                        (char *)"'quoted'"};
+        cmd.parse(11, argv);
+        if (!called)
+            results.push_back(TestResult{false, "compactAction 未执行"});
+
+        return mergeAll(results);
+    }
+};
+
+class NameTableTest : public Command, public Test
+{
+  public:
+    NameTableTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试名称驻留");
+        this->command("first", "第一个子命令")->option("-v --verbose", "详细输出");
+        this->command("second", "第二个子命令")->option("-v --verbose", "详细输出");
+    }
+    virtual std::string id() override
+    {
+        return "NameTableTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+
+        Name a(String("verbose"));
+        Name b("verbose");
+        if (a != b || a.id() != NameTable::find("verbose") || &a.str() != &b.str())
+            results.push_back(TestResult{false, "相同名称未驻留为同一个 Id"});
+        if (Name("first") == Name("second") || !Name().empty() || !Name("").empty())
+            results.push_back(TestResult{false, "不同名称或空名称比较结果不正确"});
+        if (NameTable::find("a-name-that-was-never-interned"))
+            results.push_back(TestResult{false, "未驻留的名称不应被找到"});
+
+        Command *second = this->findCommand("second");
+        if (!second || second->name() != "second" || this->findCommand("third"))
+            results.push_back(TestResult{false, "通过驻留名称查找子命令不正确"});
+
+        bool verbose = false;
+        second->action([&](Vector<Variant> args, Map<String, Variant> opts) { verbose = opts.count("verbose") > 0; });
+        char *argv[] = {(char *)"testCommand", (char *)"second", (char *)"-v"};
+        this->parse(3, argv);
+        if (!verbose)
+            results.push_back(TestResult{false, "通过驻留名称查找选项别名不正确"});
+
+        return mergeAll(results);
+    }
+};
+
+class AllocationTest : public Command, public Test
+{
+  public:
+    AllocationTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试内存分配统计");
+        this->command("serve", "子命令")
+            ->option("-p --port <port>", "端口")
+            ->option("-v --verbose", "详细输出")
+            ->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+    }
+    virtual std::string id() override
+    {
+        return "AllocationTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        char *argv[] = {(char *)"testCommand", (char *)"serve", (char *)"--verbose", (char *)"-p", (char *)"80"};
+
+        // 预热：名称驻留和正则编译只发生一次
+        this->parse(5, argv);
+        AllocStats::reset();
+        this->parse(5, argv);
+        // token 识别、查找、数值转换、校验和分发都是零分配的快速路径
+        for (Phase phase : {Phase::Tokenize, Phase::Lookup, Phase::Convert, Phase::Validate, Phase::Dispatch})
+        {
+            if (AllocStats::get(phase).count != 0)
+                results.push_back(TestResult{false, String("预热后 ") + phaseName(phase) + " 阶段不应分配内存: " +
+                                                        std::to_string(AllocStats::get(phase).count)});
+        }
+        // 交给 action 的 opts 容器仍然需要分配，它们计入外层的阶段
+        if (AllocStats::total().count == 0)
+            results.push_back(TestResult{false, "解析过程中的分配没有被统计"});
+
+        String name = "serve";
+        AllocStats::reset();
+        Command *serve = this->findCommand(name);
+        CompactValue small = CompactValue::fromVariant(Variant(String("short")));
+        if (!serve || small.toStringView() != "short" || AllocStats::total().count != 0)
+            results.push_back(TestResult{false, "查找子命令和短字符串紧凑值不应分配内存"});
+
+        AllocStats::reset();
+        String help = serve->helpText();
+        if (AllocStats::get(Phase::Help).count == 0 || AllocStats::get(Phase::Help).bytes < help.size())
+            results.push_back(TestResult{false, "帮助文本的分配没有计入 Help 阶段"});
+
+        AllocStats::reset();
+        this->command("extra <file>", "额外的子命令")->option("-x --extra", "额外选项");
+        if (AllocStats::get(Phase::Construct).count == 0)
+            results.push_back(TestResult{false, "构造命令的分配没有计入 Construct 阶段"});
+
+        return mergeAll(results);
+    }
+};
+
+class ProfilerTest : public Command, public Test
+{
+  public:
+    class RecordingProfiler : public Profiler
+    {
+      public:
+        virtual void record(Phase phase, uint64_t beginNs, uint64_t endNs) override
+        {
+            phases.push_back(phase);
+            if (endNs < beginNs)
+                ordered = false;
+        }
+        Vector<Phase> phases;
+        bool ordered = true;
+    };
+
+    ProfilerTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试解析阶段计时");
+        this->command("copy <files...>", "复制文件")
+            ->option("-n --count <count>", "次数")
+            ->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+    }
+    virtual std::string id() override
+    {
+        return "ProfilerTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        char *argv[] = {(char *)"testCommand", (char *)"copy", (char *)"a.txt", (char *)"-n", (char *)"3"};
+
+        RecordingProfiler recording;
+        this->profiler(&recording)->parse(5, argv);
+        auto has = [&](Phase phase) {
+            return std::find(recording.phases.begin(), recording.phases.end(), phase) != recording.phases.end();
+        };
+        if (!recording.ordered || !has(Phase::Tokenize) || !has(Phase::Lookup) || !has(Phase::Convert) ||
+            !has(Phase::Validate) || !has(Phase::Dispatch) || recording.phases.back() != Phase::Action)
+            results.push_back(TestResult{false, "没有记录到全部解析阶段"});
+        if (Profiler::active())
+            results.push_back(TestResult{false, "parse 结束后没有恢复 Profiler"});
+
+        HistogramProfiler histogram;
+        this->profiler(&histogram);
+        for (int i = 0; i < 100; ++i)
+            this->parse(5, argv);
+        this->profiler(nullptr);
+        if (histogram.count(Phase::Action) != 100 || histogram.count(Phase::Validate) != 100)
+            results.push_back(TestResult{false, "直方图的阶段次数不正确"});
+        if (histogram.percentile(Phase::Lookup, 50) > histogram.percentile(Phase::Lookup, 99) ||
+            histogram.percentile(Phase::Lookup, 99) > histogram.maxNs(Phase::Lookup))
+            results.push_back(TestResult{false, "直方图的百分位不是单调的"});
+        if (histogram.report().find("validate") == String::npos)
+            results.push_back(TestResult{false, "直方图报告缺少阶段"});
+
+        for (uint64_t ns : {0ULL, 7ULL, 8ULL, 15ULL, 16ULL, 1000ULL, 123456789ULL})
+        {
+            size_t index = HistogramProfiler::bucketIndex(ns);
+            if (ns > HistogramProfiler::bucketUpper(index) || (index > 0 && ns <= HistogramProfiler::bucketUpper(index - 1)))
+                results.push_back(TestResult{false, "直方图分桶不正确: " + std::to_string(ns)});
+        }
+
+        this->parse(5, argv);
+        if (histogram.count(Phase::Action) != 100)
+            results.push_back(TestResult{false, "移除 Profiler 后仍在记录"});
+
+        return mergeAll(results);
+    }
+};
+
+class TraceTest : public Command, public Test
+{
+  public:
+    TraceTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试 trace_event 导出");
+        this->command("remote", "远程仓库")
+            ->command("add <name>", "添加远程仓库")
+            ->option("-f --fetch", "添加后立即拉取")
+            ->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+    }
+    virtual std::string id() override
+    {
+        return "TraceTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        char *argv[] = {(char *)"testCommand", (char *)"remote", (char *)"add", (char *)"origin", (char *)"-f"};
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "commander_cpp_trace_test.json";
+
+        {
+            TraceRecorder trace(path.string());
+            this->profiler(&trace);
+            for (int i = 0; i < 3; ++i)
+                this->parse(5, argv);
+            this->profiler(nullptr);
+
+            String json = trace.json();
+            auto count = [&](const String &text) {
+                size_t n = 0;
+                for (size_t at = json.find(text); at != String::npos; at = json.find(text, at + 1))
+                    ++n;
+                return n;
+            };
+            if (count("\"ph\":\"X\"") != trace.size() || trace.dropped() != 0)
+                results.push_back(TestResult{false, "trace 事件数量不正确"});
+            if (count("\"name\":\"remote\",\"cat\":\"command\"") != 3 ||
+                count("\"name\":\"add\",\"cat\":\"command\"") != 3 || count("\"name\":\"action\"") != 3)
+                results.push_back(TestResult{false, "trace 缺少子命令或 action 区间"});
+        }
+
+        std::ifstream file(path);
+        String written((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (written.rfind("{\"displayTimeUnit\"", 0) != 0 || written.find("\"cat\":\"phase\"") == String::npos)
+            results.push_back(TestResult{false, "析构时没有写出 trace 文件"});
+        file.close();
+        std::filesystem::remove(path);
+
+        TraceRecorder small(String(), 2);
+        this->profiler(&small)->parse(5, argv);
+        this->profiler(nullptr);
+        if (small.size() != 2 || small.dropped() == 0)
+            results.push_back(TestResult{false, "缓冲区满后没有丢弃事件"});
+
+        return mergeAll(results);
+    }
+};
+
+class ProfileOptionTest : public Command, public Test
+{
+  public:
+    ProfileOptionTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试全局性能分析选项")->profile();
+        this->command("build [targets...]", "构建")
+            ->option("-j --jobs [count]", "并行任务数")
+            ->action([this](Vector<Variant> args, Map<String, Variant> opts) {
+                ++runs;
+                sawProfile = sawProfile || opts.count("profile") > 0;
+                jobs = opts.count("jobs") ? opts["jobs"] : Variant();
+                targets = args.empty() ? Variant() : args[0];
+            });
+    }
+    virtual std::string id() override
+    {
+        return "ProfileOptionTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "commander_cpp_profile_test.json";
+        String fileOption = "--profile=" + path.string();
+
+        char *argv1[] = {(char *)"testCommand", &fileOption[0], (char *)"build", (char *)"app"};
+        this->parse(4, argv1);
+        std::ifstream file(path);
+        String json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+        std::filesystem::remove(path);
+        if (runs != 1 || json.find("\"command\": \"ProfileOptionTest build\"") == String::npos ||
+            json.find("\"wall_ms\"") == String::npos || json.find("\"max_rss_kb\"") == String::npos)
+            results.push_back(TestResult{false, "--profile=file 没有写出 JSON: " + json});
+
+        // 不带文件名时输出到 stderr，选项后面的子命令不会被当作文件名
+        std::stringstream err;
+        std::streambuf *old = std::cerr.rdbuf(err.rdbuf());
+        char *argv2[] = {(char *)"testCommand", (char *)"--profile", (char *)"build", (char *)"-j=4"};
+        this->parse(4, argv2);
+        std::cerr.rdbuf(old);
+        if (runs != 2 || err.str().find("profile: ProfileOptionTest build") == String::npos ||
+            err.str().find("page faults:") == String::npos)
+            results.push_back(TestResult{false, "--profile 没有输出到 stderr: " + err.str()});
+        if (!std::holds_alternative<int>(jobs) || std::get<int>(jobs) != 4)
+            results.push_back(TestResult{false, "可选值没有通过 = 传入"});
+
+        char *argv3[] = {(char *)"testCommand", (char *)"build", (char *)"--profile", (char *)"lib"};
+        err.str("");
+        old = std::cerr.rdbuf(err.rdbuf());
+        this->parse(4, argv3);
+        std::cerr.rdbuf(old);
+        if (runs != 3 || err.str().empty() || !std::holds_alternative<String>(targets))
+            results.push_back(TestResult{false, "子命令上使用全局 --profile 失败"});
+
+        if (sawProfile)
+            results.push_back(TestResult{false, "profile 选项不应传给 action"});
+        if (this->findCommand("build")->helpText().find("--profile [file]") == String::npos)
+            results.push_back(TestResult{false, "帮助文本缺少 --profile"});
+
+        return mergeAll(results);
+    }
+
+  private:
+    int runs = 0;
+    bool sawProfile = false;
+    Variant jobs;
+    Variant targets;
+};
+
+class ParseResultTest : public Command, public Test
+{
+  public:
+    ParseResultTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试不依赖异常的解析结果");
+        this->command("run <script>", "运行脚本")
+            ->option("-n --count <count>", "次数")
+            ->option("--ids <ids...>", "编号", ValueType::Int64)
+            ->option("--vals <v...>", "自动类型的值")
+            ->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+    }
+    virtual std::string id() override
+    {
+        return "ParseResultTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        auto check = [&](std::vector<const char *> list, ErrorCode code, int index) {
+            std::vector<char *> argv;
+            for (auto arg : list)
+                argv.push_back(const_cast<char *>(arg));
+            ParseResult result = this->parse(static_cast<int>(argv.size()), argv.data());
+            if (result.code != code || result.index != index || static_cast<bool>(result) != (code == ErrorCode::None))
+                results.push_back(TestResult{false, String("解析结果不正确: ") + list.back() + ", code " +
+                                                        std::to_string(static_cast<int>(result.code)) + ", index " +
+                                                        std::to_string(result.index)});
+        };
+
+        check({"testCommand", "run", "a.sh", "-n", "3"}, ErrorCode::None, -1);
+        // 超出 int 范围的值不再抛出异常
+        check({"testCommand", "run", "a.sh", "-n", "99999999999999999999"}, ErrorCode::ValueOutOfRange, 4);
+        // 多值选项和位置参数中超出范围的元素同样是错误，不会被悄悄丢弃
+        check({"testCommand", "run", "a.sh", "--vals", "1", "99999999999", "3"}, ErrorCode::ValueOutOfRange, 5);
+        check({"testCommand", "run", "99999999999"}, ErrorCode::ValueOutOfRange, 2);
+        do
+        {
+            char *argv[] = {(char *)"testCommand", (char *)"run", (char *)"a.sh", (char *)"--vals=99999999999"};
+            ParseResult result = this->parse(4, argv);
+            if (result.diagnostics.empty() || result.diagnostics.back().element != 0 ||
+                result.diagnostics.back().severity != Severity::Error)
+                results.push_back(TestResult{false, "超出范围的多值元素没有报告元素下标"});
+        } while (false);
+        check({"testCommand", "run", "a.sh", "--count"}, ErrorCode::MissingValue, 3);
+        check({"testCommand", "run", "a.sh", "--ids", "1", "x", "3"}, ErrorCode::InvalidValue, 5);
+        check({"testCommand", "run", "-n", "1"}, ErrorCode::MissingArgument, -1);
+        check({"testCommand", "run", "a.sh", "@/nonexistent/commander_cpp_args.txt"}, ErrorCode::None, -1);
+
+        this->responseFile();
+        check({"testCommand", "run", "a.sh", "@/nonexistent/commander_cpp_args.txt"}, ErrorCode::ResponseFile, -1);
+        this->responseFile(false);
+
+        // 帮助文本的列对齐不再依赖异常
+        String help = this->findCommand("run")->helpText();
+        if (help.find("  -n, --count <count>  次数") == String::npos)
+            results.push_back(TestResult{false, "帮助文本列对齐不正确: " + help});
+
+        return mergeAll(results);
+    }
+};
+
+class DiagnosticTest : public Command, public Test
+{
+  public:
+    // 只统计错误码，不格式化任何文本
+    class CountingLogger : public Logger
+    {
+      public:
+        virtual Logger *warn(const String &msg) override
+        {
+            ++formatted;
+            return this;
+        }
+        virtual Logger *error(const String &msg) override
+        {
+            ++formatted;
+            return this;
+        }
+        virtual Logger *print(const String &msg) override
+        {
+            return this;
+        }
+        virtual Logger *diagnostic(const Diagnostic &d, const char *token) override
+        {
+            ++counts[static_cast<size_t>(d.code)];
+            return this;
+        }
+        size_t counts[16] = {};
+        int formatted = 0;
+    };
+
+    DiagnosticTest() : Command("", logger = new CountingLogger())
+    {
+        this->name(id())->description("测试结构化诊断");
+        this->command("deploy <env>", "部署")
+            ->option("-f --force", "强制")
+            ->option("-r --replicas <count>", "副本数")
+            ->action([](Vector<Variant> args, Map<String, Variant> opts) {});
+    }
+    virtual std::string id() override
+    {
+        return "DiagnosticTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        char *argv[] = {(char *)"testCommand", (char *)"deploy", (char *)"--unknown=1", (char *)"-fz",
+                        (char *)"--force=yes", (char *)"prod", (char *)"-r"};
+        ParseResult result = this->parse(7, argv);
+
+        const Vector<ErrorCode> expected = {ErrorCode::UnknownOption, ErrorCode::UnknownAlias,
+                                            ErrorCode::UnexpectedValue, ErrorCode::MissingValue};
+        bool same = result.diagnostics.size() == expected.size();
+        for (size_t i = 0; same && i < expected.size(); ++i)
+            same = result.diagnostics[i].code == expected[i];
+        if (!same)
+            results.push_back(TestResult{false, "诊断记录不正确: " + result.format(7, argv)});
+        if (result.code != ErrorCode::MissingValue || result.index != 6 || result.count(ErrorCode::UnknownAlias) != 1)
+            results.push_back(TestResult{false, "第一个错误或计数不正确"});
+
+        if (same)
+        {
+            const Diagnostic &missing = result.diagnostics.back();
+            if (missing.command != Name("deploy").id() || missing.name != Name("replicas").id() ||
+                missing.severity != Severity::Error || result.diagnostics[0].severity != Severity::Warning)
+                results.push_back(TestResult{false, "诊断中的名称 Id 或级别不正确"});
+        }
+
+        // 重写 diagnostic 后不会格式化文本
+        if (logger->formatted != 0 || logger->counts[static_cast<size_t>(ErrorCode::UnknownOption)] != 1)
+            results.push_back(TestResult{false, "诊断被格式化或没有交给日志对象"});
+
+        String text = result.format(7, argv);
+        for (const char *line : {"warning: unknown option: unknown\n", "warning: option alias z not found\n",
+                                 "warning: option: force does not need a value, but got: yes\n",
+                                 "error: option: replicas need a value, but got zero.\n"})
+        {
+            if (text.find(line) == String::npos)
+                results.push_back(TestResult{false, String("格式化结果缺少: ") + line});
+        }
+
+        // 别名组合中必须带值的选项只能放在最后，放在中间时不会把后面的 token 同时当作值和参数
+        do
+        {
+            size_t argCount = 0;
+            Variant replicas;
+            this->findCommand("deploy")->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                argCount = args.size();
+                replicas = opts["replicas"];
+            });
+            char *last[] = {(char *)"testCommand", (char *)"deploy", (char *)"prod", (char *)"-fr", (char *)"80"};
+            ParseResult ok = this->parse(5, last);
+            if (!ok || argCount != 1 || replicas != Variant(80))
+                results.push_back(TestResult{false, "别名组合最后一个选项的值解析不正确: " + ok.format(5, last)});
+
+            argCount = 0;
+            char *middle[] = {(char *)"testCommand", (char *)"deploy", (char *)"prod", (char *)"-rf", (char *)"80"};
+            ParseResult bad = this->parse(5, middle);
+            if (bad.code != ErrorCode::MissingValue || bad.index != 3 || bad.diagnostics.back().element != 0 ||
+                argCount != 0)
+                results.push_back(TestResult{false, "别名组合中间带值的选项没有报告缺少值: " + bad.format(5, middle)});
+
+            PushParser push(*this);
+            for (const char *token : {"deploy", "prod", "-rf", "80"})
+                push.push(token);
+            if (!push.stopped() || push.diagnostics().empty() ||
+                push.diagnostics().back().code != ErrorCode::MissingValue || push.diagnostics().back().index != 3)
+                results.push_back(TestResult{false, "增量解析与 parse 对别名组合的处理不一致"});
+        } while (false);
+
+        return mergeAll(results);
+    }
+
+  private:
+    CountingLogger *logger;
+};
+
+class LazyCommandTest : public Command, public Test
+{
+  public:
+    LazyCommandTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试延迟注册子命令");
+        this->command("add <todo>", "添加",
+                      [this](Command *cmd) {
+                          ++addBuilt;
+                          cmd->option("-d --done", "完成")->action([this](Vector<Variant> args, Map<String, Variant> opts) {
+                              done = opts.count("done") > 0;
+                          });
+                      })
+            ->command("conf", "配置", [this](Command *cmd) {
+                ++confBuilt;
+                cmd->command("init", "初始化", [this](Command *init) { ++initBuilt; });
+            });
+    }
+    virtual std::string id() override
+    {
+        return "LazyCommandTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        char *argv[] = {(char *)"testCommand", (char *)"add", (char *)"todo", (char *)"-d"};
+        ParseResult result = this->parse(4, argv);
+        if (!result || !done)
+            results.push_back(TestResult{false, "延迟构建的子命令解析失败: " + result.format()});
+        // 只有被选中的子命令会构建
+        if (addBuilt != 1 || confBuilt != 0 || initBuilt != 0)
+            results.push_back(TestResult{false, "未选中的子命令不应构建"});
+
+        this->parse(4, argv);
+        if (addBuilt != 1)
+            results.push_back(TestResult{false, "builder 不应重复执行"});
+
+        Command *conf = this->findCommand("conf");
+        if (!conf || confBuilt != 1 || initBuilt != 0)
+            results.push_back(TestResult{false, "findCommand 应只构建选中的子命令"});
+
+        // 完整帮助需要子命令的定义
+        String help = conf ? conf->helpText() : String();
+        if (initBuilt != 1 || help.find("init") == String::npos)
+            results.push_back(TestResult{false, "帮助文本应构建全部子命令: " + help});
+
+        return mergeAll(results);
+    }
+
+  private:
+    int addBuilt = 0;
+    int confBuilt = 0;
+    int initBuilt = 0;
+    bool done = false;
+};
+
+class SchemaTest : public Test
+{
+  public:
+    virtual std::string id() override
+    {
+        return "SchemaTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger logger;
+        std::filesystem::path path = std::filesystem::temp_directory_path() / "commander_cpp_schema_test.bin";
+
+        Command source("todo", &logger);
+        source.version("1.2.3", "-V --version", "显示版本号。")
+            ->description("待办。")
+            ->option("-v --verbose", "详细输出")
+            ->command("add <todo...>", "添加", [](Command *cmd) {
+                cmd->option("-d --done", "完成")
+                    ->option("-p --priority <level>", "优先级", 3)
+                    ->option("--ids <ids...>", "编号", ValueType::Int64);
+            });
+        source.command("conf", "配置")->command("init [name]", "初始化")->option("--ratio [ratio]", "比例", 0.5);
+        if (!source.saveSchema(path.string()))
+            return {false, "schema 写入失败"};
+
+        Vector<String> built;
+        bool added = false;
+        Command *loaded = Command::loadSchema(path.string(), &logger, [&](Command *cmd) {
+            built.push_back(cmd->name());
+            if (cmd->name() == "add")
+                cmd->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                    added = args.size() == 1 && std::holds_alternative<Int64List>(opts["ids"]) &&
+                            std::get<int>(opts["priority"]) == 3;
+                });
+        });
+        if (!loaded)
+            return {false, "schema 加载失败"};
+
+        char *argv[] = {(char *)"todo", (char *)"add", (char *)"milk", (char *)"-p", (char *)"--ids", (char *)"1",
+                        (char *)"2"};
+        ParseResult result = loaded->parse(7, argv);
+        if (!result || !added)
+            results.push_back(TestResult{false, "按 schema 解析失败: " + result.format()});
+        // 只构造了根命令和被选中的子命令
+        if (built != Vector<String>{"todo", "add"})
+            results.push_back(TestResult{false, "schema 中未选中的子命令不应构造"});
+
+        if (loaded->helpText() != source.helpText() ||
+            loaded->findCommand("add")->helpText() != source.findCommand("add")->helpText() ||
+            loaded->findCommand("conf")->findCommand("init")->helpText() !=
+                source.findCommand("conf")->findCommand("init")->helpText())
+            results.push_back(TestResult{false, "schema 还原的帮助文本不一致: " + loaded->helpText()});
+        if (loaded->version() != "1.2.3")
+            results.push_back(TestResult{false, "schema 还原的版本号不正确"});
+        delete loaded;
+
+        // 损坏的文件在要求校验时通过校验和拒绝
+        {
+            std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+            file.seekp(-3, std::ios::end);
+            file.put('#');
+        }
+        if (Command *broken = Command::loadSchema(path.string(), &logger, nullptr, true))
+        {
+            delete broken;
+            results.push_back(TestResult{false, "损坏的 schema 应加载失败"});
+        }
+        std::filesystem::remove(path);
+        if (Command::loadSchema(path.string(), &logger))
+            results.push_back(TestResult{false, "不存在的 schema 应加载失败"});
+
+        return mergeAll(results);
+    }
+};
+
+class JsonSchemaTest : public Test
+{
+  public:
+    virtual std::string id() override
+    {
+        return "JsonSchemaTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger logger;
+
+        Command source("todo", &logger);
+        source.version("1.2.3", "-V --version", "显示版本号。")
+            ->description("待办 \"todo\"\n第二行\t\x01")
+            ->profile()
+            ->option("-v --verbose", "详细输出")
+            ->option("-r --ratio [ratio]", "比例", 0.5)
+            ->command("add <todo...>", "添加", [](Command *cmd) {
+                cmd->option("-d --done", "完成", false)
+                    ->option("-p --priority <level>", "优先级", 3)
+                    ->option("--ids <ids...>", "编号", ValueType::Int64)
+                    ->option("--scale <scale>", "缩放", 2.0);
+            });
+        source.command("conf", "配置")->command("init [name]", "初始化")->option("--table <table>", "表名", "default");
+
+        String json = source.toJson();
+        Vector<String> built;
+        bool added = false;
+        Command imported("", &logger);
+        bool ok = imported.importJson(json, [&](Command *cmd) {
+            built.push_back(cmd->name());
+            if (cmd->name() == "add")
+                cmd->action([&](Vector<Variant> args, Map<String, Variant> opts) {
+                    added = args.size() == 1 && std::holds_alternative<Int64List>(opts["ids"]);
+                });
+        });
+        if (!ok)
+            return {false, "JSON 导入失败: " + json};
+        // 子命令先于父命令完成
+        if (built != Vector<String>{"add", "init", "conf", "todo"})
+            results.push_back(TestResult{false, "binder 调用顺序不正确"});
+        if (imported.toJson() != json)
+            results.push_back(TestResult{false, "JSON 往返后不一致: " + imported.toJson()});
+        if (imported.helpText() != source.helpText() ||
+            imported.findCommand("add")->helpText() != source.findCommand("add")->helpText() ||
+            imported.findCommand("conf")->findCommand("init")->helpText() !=
+                source.findCommand("conf")->findCommand("init")->helpText())
+            results.push_back(TestResult{false, "JSON 还原的帮助文本不一致: " + imported.helpText()});
+
+        char *argv[] = {(char *)"todo", (char *)"add", (char *)"milk", (char *)"--ids", (char *)"1", (char *)"2"};
+        if (!imported.parse(6, argv) || !added)
+            results.push_back(TestResult{false, "按导入的定义解析失败"});
+
+        // 未知的键被忽略，转义字符正确还原
+        Command extra("", &logger);
+        if (!extra.importJson(R"({"name":"x","future":{"a":[1,{"b":null}]},"description":"\u4e2d\ud83d\ude00\/",)"
+                              R"("options":[{"name":"level","valueName":"n","valueIsRequired":true,"default":-7}]})") ||
+            extra.description() != "\xe4\xb8\xad\xf0\x9f\x98\x80/" || extra.name() != "x")
+            results.push_back(TestResult{false, "JSON 转义或未知键处理不正确: " + extra.description()});
+
+        for (const char *bad : {R"({"name":"x",)", R"({"options":[{"alias":"a"}]})", R"({"name":"x"} [])",
+                                R"({"name":"\q"})", R"({"commands":[{"description":"no name"}]})",
+                                // 与构建器 API 相同的校验
+                                R"({"options":[{"name":"level"},{"name":"level"}]})",
+                                R"({"options":[{"name":"a","alias":"x"},{"name":"b","alias":"x"}]})",
+                                R"({"options":[{"name":"level","alias":"lv"}]})",
+                                R"({"options":[{"name":"9lives"}]})",
+                                R"({"options":[{"name":"ids","multiValue":true}]})",
+                                R"({"options":[{"name":"ids","valueName":"n","multiValue":true,"elementType":"int128"}]})",
+                                R"({"arguments":[{"name":"bad name"}]})",
+                                R"({"commands":[{"name":"add"},{"name":"add"}]})",
+                                R"({"commands":[{"name":"-x"}]})"})
+        {
+            Command broken("", &logger);
+            if (broken.importJson(bad))
+                results.push_back(TestResult{false, String("错误的 JSON 应导入失败: ") + bad});
+        }
+
+        // 子命令不能与已有的子命令重名
+        Command existing("", &logger);
+        existing.command("add", "添加");
+        if (existing.importJson(R"({"commands":[{"name":"add"}]})") || existing.findCommand("add")->description() != "添加")
+            results.push_back(TestResult{false, "导入的子命令覆盖了已有的子命令"});
+
+        return mergeAll(results);
+    }
+};
+
+class CompletionTest : public Command, public Test
+{
+  public:
+    CompletionTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试补全查询")->completion();
+        this->option("-v --verbose", "详细输出")
+            ->command("add <todo...>", "添加\n第二行",
+                      [this](Command *cmd) {
+                          ++addBuilt;
+                          cmd->option("-d --done", "完成")
+                              ->option("-p --priority <level>", "优先级")
+                              ->option("--ids <ids...>", "编号")
+                              ->action([this](Vector<Variant> args, Map<String, Variant> opts) { ran = true; });
+                      })
+            ->command("conf", "配置", [](Command *cmd) { cmd->command("init [name]", "初始化"); })
+            ->command("config", "配置别名", [this](Command *cmd) { ++configBuilt; });
+    }
+    virtual std::string id() override
+    {
+        return "CompletionTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        auto check = [&](const Vector<String> &words, const String &expected) {
+            String got;
+            for (const auto &c : this->complete(words))
+                got += c.value + (c.description.empty() ? "" : ":" + c.description) + " ";
+            if (got != expected)
+                results.push_back(TestResult{false, "补全结果不正确: " + words.back() + " -> " + got});
+        };
+
+        check({""}, "add:添加 conf:配置 config:配置别名 ");
+        check({"co"}, "conf:配置 config:配置别名 ");
+        check({"conf", "i"}, "init:初始化 ");
+        check({"add", "--p"}, "--priority:优先级 ");
+        check({"add", "-"}, "--done:完成 --help --ids:编号 --priority:优先级 --version:out put version number. -V:out put "
+                            "version number. -d:完成 -h -p:优先级 ");
+        // 光标处是选项的值
+        check({"add", "-p", ""}, "");
+        check({"add", "--ids", "1", "2"}, "");
+        check({"add", "--ids", "1", "--d"}, "--done:完成 ");
+        check({"-v", "c"}, "conf:配置 config:配置别名 ");
+
+        // 只构造了补全路径上的子命令
+        if (addBuilt != 1 || configBuilt != 0)
+            results.push_back(TestResult{false, "补全不应构造路径以外的子命令"});
+
+        String printed;
+        static_cast<TestLogger *>(this->logger())->checkPrint = [&](const std::string &msg) { printed += msg; };
+        char *argv[] = {(char *)"testCommand", (char *)"__complete", (char *)"add", (char *)"--"};
+        ParseResult result = this->parse(4, argv);
+        static_cast<TestLogger *>(this->logger())->checkPrint = nullptr;
+        if (!result || ran || printed.find("--done\t完成\n--help\n") == String::npos)
+            results.push_back(TestResult{false, "__complete 输出不正确: " + printed});
+
+        for (const char *shell : {"bash", "zsh", "fish"})
+        {
+            if (this->completionScript(shell).find("CompletionTest __complete") == String::npos)
+                results.push_back(TestResult{false, String("补全脚本不正确: ") + shell});
+        }
+        return mergeAll(results);
+    }
+
+  private:
+    int addBuilt = 0;
+    int configBuilt = 0;
+    bool ran = false;
+};
+
+class CompletionCacheTest : public Command, public Test
+{
+  public:
+    CompletionCacheTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试补全缓存")->completion()->completionCache(cacheFile);
+        this->option("-v --verbose", "详细输出")
+            ->command("add <todo...>", "添加",
+                      [](Command *cmd) {
+                          cmd->option("-d --done", "完成")
+                              ->option("-p --priority <level>", "优先级")
+                              ->option("--ids <ids...>", "编号");
+                      })
+            ->command("conf", "配置", [](Command *cmd) { cmd->command("init [name]", "初始化"); })
+            ->command("config", "配置别名");
+    }
+    ~CompletionCacheTest()
+    {
+        std::remove(cacheFile.c_str());
+        std::filesystem::remove_all(binDir);
+    }
+    virtual std::string id() override
+    {
+        return "CompletionCacheTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        std::remove(cacheFile.c_str());
+        if (this->completionCacheFresh(cacheFile))
+            results.push_back(TestResult{false, "不存在的缓存不应有效"});
+
+        // 第一次补全查询时写入缓存
+        static_cast<TestLogger *>(this->logger())->checkPrint = [](const std::string &) {};
+        char *argv[] = {(char *)"testCommand", (char *)"__complete", (char *)""};
+        this->parse(3, argv);
+        static_cast<TestLogger *>(this->logger())->checkPrint = nullptr;
+        if (!this->completionCacheFresh(cacheFile))
+            return TestResult{false, "补全查询后缓存应当有效"};
+
+        std::ifstream in(cacheFile);
+        std::stringstream content;
+        content << in.rdbuf();
+        String text = content.str();
+        if (text.find("\nadd\tm\t--ids\t编号\n") == String::npos || text.find("\nconf\tc\tinit\t初始化\n") == String::npos ||
+            text.find("\n*\tf\t-V\t") == String::npos || text.find("#build-id ") == String::npos)
+            results.push_back(TestResult{false, "缓存内容不正确"});
+
+        // 缓存头部与可执行文件不一致时视为过期
+        std::ofstream(cacheFile + ".stale") << "#commander-cpp-completion 1\n#binary /nonexistent\n";
+        if (this->completionCacheFresh(cacheFile + ".stale"))
+            results.push_back(TestResult{false, "过期的缓存不应有效"});
+        std::remove((cacheFile + ".stale").c_str());
+
+        if (this->completionScript("fish").find("set -l cache '" + std::filesystem::temp_directory_path().string() +
+                                                "/commander_cpp_completion_it\\'s_test'\n") == String::npos)
+            results.push_back(TestResult{false, "fish 脚本中的缓存路径没有转义"});
+
+        // 用生成的 bash 脚本查询缓存，结果应与 complete 一致
+        if (std::system("command -v bash >/dev/null 2>&1 && command -v awk >/dev/null 2>&1") != 0)
+            return mergeAll(results);
+        std::filesystem::remove_all(binDir);
+        std::filesystem::create_directories(binDir);
+        std::filesystem::create_symlink(TOOLS::ExecutableIdentity::current().path, binDir + "/" + id());
+        std::ofstream(binDir + "/script.bash") << this->completionScript("bash");
+        for (const Vector<String> &words : Vector<Vector<String>>{{""},
+                                                                  {"co"},
+                                                                  {"conf", "i"},
+                                                                  {"add", "-"},
+                                                                  {"add", "-p", ""},
+                                                                  {"add", "--ids", "1", "2"},
+                                                                  {"add", "--ids", "1", "--d"},
+                                                                  {"-v", "c"},
+                                                                  {"add", "-dp", "x", "--h"}})
+        {
+            String expected;
+            for (const auto &c : this->complete(words))
+                expected += c.value + (c.description.empty() ? "" : "\t" + c.description) + "\n";
+            String command = "PATH='" + binDir + "':$PATH bash -c '. " + binDir + "/script.bash; _" + id() +
+                             "_query \"$@\" | LC_ALL=C sort' _";
+            for (const auto &word : words)
+                command += " '" + word + "'";
+            String got;
+            if (FILE *pipe = popen(command.c_str(), "r"))
+            {
+                char buffer[256];
+                size_t n;
+                while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+                    got.append(buffer, n);
+                pclose(pipe);
+            }
+            if (got != expected)
+                results.push_back(TestResult{false, "缓存查询结果不正确: " + words.back() + " -> " + got});
+        }
+        return mergeAll(results);
+    }
+
+  private:
+    // 路径中带单引号，生成的脚本必须正确转义
+    String cacheFile = std::filesystem::temp_directory_path().string() + "/commander_cpp_completion_it's_test";
+    String binDir = std::filesystem::temp_directory_path().string() + "/commander_cpp_completion_bin";
+};
+
+class DaemonTest : public Command, public Test
+{
+  public:
+    DaemonTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试常驻进程模式");
+        this->command("echo <first>")->argument("<second>")->action([](Vector<Variant> args, Map<String, Variant> opts) {
+            const char *value = std::getenv("COMMANDER_CPP_DAEMON_TEST");
+            std::cout << "cwd=" << std::filesystem::current_path().filename().string()
+                      << " env=" << (value ? value : "") << " args=";
+            for (const auto &word : args)
+                std::cout << std::get<String>(word) << ",";
+            std::cout << std::endl;
+        });
+    }
+    virtual std::string id() override
+    {
+        return "DaemonTest";
+    }
+    virtual TestResult test() override
+    {
+#ifndef COMMANDER_CPP_HAS_UNIX_SOCKET
+        return TestResult{true, ""};
+#else
+        std::vector<TestResult> results;
+        String dir = std::filesystem::temp_directory_path().string() + "/commander_cpp_daemon_test";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir + "/work");
+        IPC::Daemon daemon(dir + "/daemon.sock", 600, 200);
+
+        int status = -1;
+        char *argv[] = {(char *)"testCommand", (char *)"echo", (char *)"a", (char *)"b"};
+        if (daemon.forward(4, argv, status))
+            results.push_back(TestResult{false, "没有后台进程时不应转发成功"});
+        if (!daemon.listen() || IPC::Daemon(dir + "/daemon.sock").listen())
+            return TestResult{false, "监听套接字失败或重复监听"};
+
+        std::thread server([&] { daemon.serve(IPC::Daemon::parseHandler(*this)); });
+        auto previous = std::filesystem::current_path();
+        std::filesystem::current_path(dir + "/work");
+        setenv("COMMANDER_CPP_DAEMON_TEST", "warm", 1);
+        int out = ::open((dir + "/out").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        int null = ::open("/dev/null", O_RDWR);
+        const int fds[3] = {null, out, null};
+        // 发送长度前缀后停顿的客户端在超时后被丢弃，不影响后面的调用
+        IPC::FileDescriptor stalled;
+        uint32_t stalledSize = 64;
+        if (!IPC::connectTo(dir + "/daemon.sock", stalled) ||
+            !IPC::sendWithDescriptors(stalled.get(), &stalledSize, sizeof(stalledSize), fds, 3))
+            results.push_back(TestResult{false, "连接后台进程失败"});
+        bool forwarded = daemon.forward(4, argv, status, fds);
+        char *bad[] = {(char *)"testCommand", (char *)"echo"};
+        int badStatus = -1;
+        forwarded = daemon.forward(2, bad, badStatus, fds) && forwarded;
+        ::close(out);
+        ::close(null);
+        unsetenv("COMMANDER_CPP_DAEMON_TEST");
+        std::filesystem::current_path(previous);
+        daemon.stop();
+        server.join();
+
+        std::ifstream in(dir + "/out");
+        std::stringstream content;
+        content << in.rdbuf();
+        if (!forwarded || status != 0 || badStatus != 1)
+            results.push_back(TestResult{false, "转发或退出码不正确"});
+        if (content.str() != "cwd=work env=warm args=a,b,\n")
+            results.push_back(TestResult{false, "后台进程的输出不正确: " + content.str()});
+        if (std::filesystem::exists(dir + "/daemon.sock"))
+            results.push_back(TestResult{false, "停止后应删除套接字文件"});
+        std::filesystem::remove_all(dir);
+
+        // 没有 XDG_RUNTIME_DIR 时使用临时目录下当前用户独占的目录，权限过宽时拒绝
+        do
+        {
+            const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+            String savedRuntime = runtime ? runtime : "";
+            unsetenv("XDG_RUNTIME_DIR");
+            String privateDir = "/tmp/commander_cpp_daemon_test-" + std::to_string(::geteuid());
+            std::filesystem::remove_all(privateDir);
+            String path = IPC::Daemon::defaultPath("commander_cpp_daemon_test");
+            struct stat st;
+            if (path != privateDir + "/commander_cpp_daemon_test.sock" || ::stat(privateDir.c_str(), &st) != 0 ||
+                (st.st_mode & 0777) != 0700)
+                results.push_back(TestResult{false, "默认套接字路径不在 0700 的私有目录中: " + path});
+            ::chmod(privateDir.c_str(), 0755);
+            if (!IPC::Daemon::defaultPath("commander_cpp_daemon_test").empty())
+                results.push_back(TestResult{false, "权限过宽的目录不应作为套接字目录"});
+            std::filesystem::remove_all(privateDir);
+            if (runtime)
+                setenv("XDG_RUNTIME_DIR", savedRuntime.c_str(), 1);
+        } while (false);
+        return mergeAll(results);
+#endif
+    }
+};
+
+class ServiceTest : public Test
+{
+  public:
+    virtual std::string id() override
+    {
+        return "ServiceTest";
+    }
+    virtual TestResult test() override
+    {
+#ifndef COMMANDER_CPP_HAS_UNIX_SOCKET
+        return TestResult{true, ""};
+#else
+        std::vector<TestResult> results;
+        IPC::CaptureLogger logger;
+        Command root(id(), &logger);
+        root.command("echo", "回显", [](Command *cmd) {
+            cmd->argument("<first>")->argument("[second]")->action(
+                [](Command *cmd, Vector<Variant> args, Map<String, Variant> opts) {
+                    IPC::Service::output() << std::get<String>(args[0]);
+                    if (args.size() > 1 && std::holds_alternative<String>(args[1]))
+                        IPC::Service::output() << "|" << std::get<String>(args[1]);
+                    cmd->logger()->print("");
+                });
+        });
+        root.command("big", "大量输出", [](Command *cmd) {
+            cmd->action([](Vector<Variant>, Map<String, Variant>) { IPC::Service::output() << String(1 << 18, 'x'); });
+        });
+        IPC::Service service(root, 4);
+
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            return TestResult{false, "socketpair 失败"};
+        std::thread server([&] {
+            service.serve(fds[1], fds[1]);
+            ::close(fds[1]);
+        });
+
+        // 先连续发送全部请求，再按顺序读取响应
+        const int count = 200;
+        for (int i = 0; i < count; ++i)
+            IPC::Service::send(fds[0], "echo item" + std::to_string(i) + " 'two words'");
+        IPC::Service::send(fds[0], "echo");
+        IPC::Service::send(fds[0], "--unknown echo \"a\\\"b\"");
+        ::shutdown(fds[0], SHUT_WR);
+
+        for (int i = 0; i < count; ++i)
+        {
+            IPC::Service::Response response;
+            if (!IPC::Service::receive(fds[0], response) || response.status != 0 ||
+                response.output != "item" + std::to_string(i) + "|two words\n" || !response.errors.empty())
+            {
+                results.push_back(TestResult{false, "第 " + std::to_string(i) + " 个响应不正确: " + response.output});
+                break;
+            }
+        }
+        IPC::Service::Response missing, warned, end;
+        if (!IPC::Service::receive(fds[0], missing) || missing.status != 1 ||
+            missing.errors.find("is required") == String::npos)
+            results.push_back(TestResult{false, "缺少参数的响应不正确: " + missing.errors});
+        if (!IPC::Service::receive(fds[0], warned) || warned.status != 0 || warned.output != "a\"b\n" ||
+            warned.errors.find("warning: unknown option: unknown") == String::npos)
+            results.push_back(TestResult{false, "带警告的响应不正确: " + warned.output + warned.errors});
+        if (IPC::Service::receive(fds[0], end))
+            results.push_back(TestResult{false, "输入结束后不应再有响应"});
+        server.join();
+        ::close(fds[0]);
+
+        // 只发送不读取的客户端填满套接字缓冲区后，其它连接仍然能得到响应
+        int stalled[2], other[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM, 0, stalled) == 0 && ::socketpair(AF_UNIX, SOCK_STREAM, 0, other) == 0)
+        {
+            std::thread stalledServer([&] { service.serve(stalled[1], stalled[1]); });
+            for (int i = 0; i < 32; ++i)
+                IPC::Service::send(stalled[0], "big");
+            ::shutdown(stalled[0], SHUT_WR);
+            // 等到第一条响应开始写出，这时前面的请求已经交给线程池
+            struct pollfd pfd = {stalled[0], POLLIN, 0};
+            ::poll(&pfd, 1, 5000);
+            std::thread otherServer([&] { service.serve(other[1], other[1]); });
+            IPC::Service::send(other[0], "echo x");
+            ::shutdown(other[0], SHUT_WR);
+            IPC::Service::Response response;
+            if (!IPC::Service::receive(other[0], response) || response.output != "x\n")
+                results.push_back(TestResult{false, "其它连接没有得到响应: " + response.output});
+            otherServer.join();
+            // 客户端断开后剩余的响应被丢弃
+            ::close(stalled[0]);
+            stalledServer.join();
+            for (int fd : {stalled[1], other[0], other[1]})
+                ::close(fd);
+        }
+
+        // 读端已关闭的管道：写入失败，但进程不能被 SIGPIPE 结束
+        int closed[2];
+        if (::pipe(closed) == 0)
+        {
+            ::close(closed[0]);
+            if (IPC::Service::send(closed[1], "echo x"))
+                results.push_back(TestResult{false, "向已关闭的管道发送不应成功"});
+            ::close(closed[1]);
+        }
+
+        // 不经过网络直接执行，结果与 parse 相同
+        IPC::Service::Response direct = service.execute("echo 'x y'");
+        if (direct.status != 0 || direct.output != "x y\n")
+            results.push_back(TestResult{false, "execute 结果不正确: " + direct.output});
+        return mergeAll(results);
+#endif
+    }
+};
+
+class PushParserTest : public Command, public Test
+{
+  public:
+    PushParserTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试增量解析");
+        this->option("-v --verbose", "详细输出")
+            ->command("add", "添加", [this](Command *cmd) {
+                cmd->argument("<todo...>")
+                    ->option("-d --done", "完成")
+                    ->option("-p --priority <level>", "优先级")
+                    ->option("--ids <ids...>", "编号")
+                    ->action([this](Vector<Variant> args, Map<String, Variant> opts) {
+                        ran = args.size() == 2 && opts.count("priority") && opts.count("ids");
+                    });
+            });
+    }
+    virtual std::string id() override
+    {
+        return "PushParserTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        auto expect = [&](bool ok, const String &message) {
+            if (!ok)
+                results.push_back(TestResult{false, message});
+        };
+        using Expect = Command::PushParser::Expect;
+
+        Command::PushParser parser(*this);
+        parser.push("-v");
+        expect(parser.command() == this && parser.expecting() == Expect::Any, "根命令的状态不正确");
+        parser.push("add");
+        expect(parser.command()->name() == "add", "没有进入子命令");
+        parser.push("-p");
+        expect(parser.expecting() == Expect::Value && parser.pendingOption() == "priority", "应当等待选项的值");
+        expect(parser.complete("").empty(), "等待值时不应有补全候选");
+        parser.push("high");
+        parser.push("--ids");
+        parser.push("1");
+        parser.push("2");
+        expect(parser.expecting() == Expect::Values && parser.pendingValues() == 2, "多值选项的状态不正确");
+        expect(parser.complete("--d").size() == 1 && parser.complete("--d")[0].value == "--done", "补全候选不正确");
+        parser.push("--unknown");
+        expect(parser.diagnostics().size() == 1 && parser.diagnostics()[0].code == ErrorCode::UnknownOption &&
+                   parser.diagnostics()[0].index == 8,
+               "未知选项的诊断不正确");
+        parser.pop();
+        expect(parser.diagnostics().empty() && parser.pendingValues() == 2, "pop 没有恢复状态");
+        parser.push("-d");
+        parser.push("first");
+        parser.push("second");
+        expect(parser.positional() == 2 && !parser.stopped(), "位置参数个数不正确");
+
+        ParseResult result = parser.finish();
+        expect(result.ok() && ran, "finish 没有得到与 parse 相同的结果");
+
+        // 错误与 parse 一致
+        Command::PushParser broken(*this);
+        expect(broken.push("add") && broken.push("-p") && !broken.push("--done"), "缺少值时应当终止");
+        expect(broken.stopped() && broken.diagnostics().back().code == ErrorCode::MissingValue &&
+                   broken.diagnostics().back().index == 2,
+               "缺少值的诊断不正确");
+        ParseResult brokenResult = broken.finish();
+        expect(brokenResult.code == ErrorCode::MissingValue && brokenResult.index == 2, "finish 的错误与增量状态不一致");
+        return mergeAll(results);
+    }
+
+  private:
+    bool ran = false;
+};
+
+/*
+ * 生成的语料逐个 token 输入 PushParser，每个前缀的状态都应当与 validate 的结果一致
+ */
+class PushParserCorpusTest : public Test
+{
+  public:
+    virtual std::string id() override
+    {
+        return "PushParserCorpusTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger logger;
+        GENERATOR::TreeSpec spec;
+        spec.seed = 5;
+        spec.depth = 2;
+        spec.fanOut = 3;
+        GENERATOR::GeneratedTree tree = GENERATOR::generateTree(spec, &logger);
+        // 生成器不产生带元素类型和默认值的选项，补上这两种绑定方式
+        tree.root->option("-N --names <names...>", "名称列表", ValueType::StringView)
+            ->option("--level <level>", "级别", Variant(3));
+        Map<String, size_t> nodeOf;
+        for (size_t i = 0; i < tree.nodes.size(); ++i)
+            nodeOf[tree.nodes[i].name] = i;
+
+        // 在合法的语料中插入未定义的选项和别名、空字符串、带值的开关，以及放在组合中间的带值别名
+        GENERATOR::Random random(9);
+        Vector<Vector<String>> corpus;
+        for (auto &line : GENERATOR::generateArgv(tree, 3, 300))
+        {
+            corpus.push_back(line);
+            const GENERATOR::NodeSpec *node = &tree.nodes[0];
+            for (const auto &word : line)
+                node = nodeOf.count(word) ? &tree.nodes[nodeOf[word]] : node;
+            String switches, values;
+            for (const auto &opt : node->options)
+                (opt.hasValue ? values : switches) += opt.alias;
+            Vector<String> pool = {"--nope", "-Q", "", "x", "-N", "--level", "--names=a"};
+            if (!switches.empty() && !values.empty())
+            {
+                pool.push_back("-" + values.substr(0, 1) + switches.substr(0, 1));
+                pool.push_back("-" + switches.substr(0, 1) + values.substr(0, 1));
+            }
+            for (const auto &opt : node->options)
+                pool.push_back("--" + opt.name + "=1");
+            for (int variant = 0; variant < 3; ++variant)
+            {
+                Vector<String> mutated = line;
+                for (uint64_t n = 1 + random.below(2); n > 0; --n)
+                    mutated.insert(mutated.begin() + 1 + random.below(mutated.size()), pool[random.below(pool.size())]);
+                corpus.push_back(std::move(mutated));
+            }
+        }
+
+        // 两种解析曾经不一致的写法：按类型转换的列表中的空字符串、= 之后带换行的值
+        corpus.push_back({"root", "-N", "", "--nope"});
+        corpus.push_back({"root", "-N", "a", "", "-Q"});
+        corpus.push_back({"root", "--nope=a\nb", "x"});
+        corpus.push_back({"root", "--level=1\r", "--names=a\nb"});
+
+        // PushParser 不做值的转换和必填参数检查，输入结束时还在等待的值也只在 finish 中报告
+        auto pushable = [](const Diagnostic &d, const Command::PushParser &parser) {
+            if (d.code == ErrorCode::MissingArgument || d.code == ErrorCode::InvalidValue ||
+                (d.code == ErrorCode::ValueOutOfRange && d.severity == Severity::Error))
+                return false;
+            bool pending = !parser.stopped() &&
+                           (parser.expecting() == Command::PushParser::Expect::Value ||
+                            (parser.expecting() == Command::PushParser::Expect::Values && parser.pendingValues() == 0));
+            return !(pending && d.code == ErrorCode::MissingValue && d.name && *d.name == parser.pendingOption());
+        };
+        auto same = [](const Diagnostic &a, const Diagnostic &b) {
+            return a.code == b.code && a.severity == b.severity && a.index == b.index && a.element == b.element &&
+                   a.command == b.command && a.name == b.name;
+        };
+
+        size_t compared = 0;
+        for (auto &line : corpus)
+        {
+            Command::PushParser parser(*tree.root);
+            for (size_t k = 1; k < line.size(); ++k)
+            {
+                parser.push(line[k]);
+                Vector<String> prefix(line.begin(), line.begin() + k + 1);
+                std::vector<char *> argv;
+                for (auto &arg : prefix)
+                    argv.push_back(&arg[0]);
+                ParseResult result = tree.root->validate(static_cast<int>(argv.size()), argv.data());
+
+                Vector<Diagnostic> expected;
+                for (const auto &d : result.diagnostics)
+                {
+                    if (pushable(d, parser))
+                        expected.push_back(d);
+                }
+                const auto &found = parser.diagnostics();
+                bool equal = expected.size() == found.size() &&
+                             std::equal(expected.begin(), expected.end(), found.begin(), same);
+                ++compared;
+                if (!equal)
+                {
+                    String words;
+                    for (size_t i = 1; i < prefix.size(); ++i)
+                        words += " '" + prefix[i] + "'";
+                    auto describe = [](const Vector<Diagnostic> &list) {
+                        String out;
+                        for (const auto &d : list)
+                            out += String(" ") + errorCodeName(d.code) + "@" + std::to_string(d.index) + "/" +
+                                   std::to_string(d.element);
+                        return out;
+                    };
+                    return TestResult{false, "增量解析与 validate 的诊断不一致:" + words + "\n  validate:" +
+                                                 describe(expected) + "\n  push:" + describe(found)};
+                }
+            }
+        }
+        if (compared < corpus.size())
+            results.push_back(TestResult{false, "语料没有被完整比较"});
+        return mergeAll(results);
+    }
+};
+
+class LintTest : public Command, public Test
+{
+  public:
+    LintTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试只检查不执行和批量检查");
+        this->command("add", "添加", [this](Command *cmd) {
+            cmd->argument("<todo...>")
+                ->option("-p --priority <level>", "优先级")
+                ->option("--ids <ids...>", "编号", ValueType::Int64)
+                ->visitArgument("todo", [this](size_t, const VariantBase &) { visited = true; })
+                ->action([this](Vector<Variant> args, Map<String, Variant> opts) { ran = true; });
+        });
+    }
+    virtual std::string id() override
+    {
+        return "LintTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        String printed;
+        static_cast<TestLogger *>(this->logger())->checkPrint = [&](const std::string &msg) { printed += msg; };
+        char *ok[] = {(char *)"todo", (char *)"add", (char *)"milk", (char *)"--ids", (char *)"1", (char *)"2"};
+        char *bad[] = {(char *)"todo", (char *)"add", (char *)"--ids", (char *)"x"};
+        char *help[] = {(char *)"todo", (char *)"add", (char *)"--help"};
+        ParseResult okResult = this->validate(6, ok);
+        ParseResult badResult = this->validate(4, bad);
+        ParseResult helpResult = this->validate(3, help);
+        static_cast<TestLogger *>(this->logger())->checkPrint = nullptr;
+        if (!okResult || badResult.code != ErrorCode::InvalidValue || !helpResult)
+            results.push_back(TestResult{false, "validate 的结果与 parse 不一致"});
+        if (ran || visited || !printed.empty())
+            results.push_back(TestResult{false, "validate 不应执行 action、visitor 或输出: " + printed});
+
+        // 足够大的文件才会切分成多个分片
+        String file = std::filesystem::temp_directory_path().string() + "/commander_cpp_lint_test";
+        {
+            std::ofstream out(file);
+            for (int i = 1; i <= 20000; ++i)
+            {
+                if (i % 1000 == 0)
+                    out << "todo add --ids 1 x" << i << "\n";
+                else if (i % 1001 == 0)
+                    out << "todo add task --unknown\n";
+                else if (i % 997 == 0)
+                    out << "# comment\n\n";
+                else
+                    out << "todo add \"task number " << i << "\" -p high --ids 1 2 3\n";
+            }
+        }
+        LintReport parallel = this->lint(file, 4);
+        LintReport serial = this->lint(file, 1);
+        std::remove(file.c_str());
+        if (parallel.summary() != serial.summary())
+            results.push_back(TestResult{false, "并行和串行检查的结果不一致"});
+        if (parallel.errors != 20 || parallel.warnings != 19 || parallel.counts[ErrorCode::UnknownOption] != 19 ||
+            parallel.lines != 20000 - 20)
+            results.push_back(TestResult{false, "批量检查的统计不正确: " + parallel.summary().substr(0, 200)});
+        // 第 997 个命令位置的注释和空行多占一行
+        if (parallel.details.size() < 2 || parallel.details[0].line != 1001 ||
+            parallel.details[0].code != ErrorCode::InvalidValue || parallel.details[1].line != 1002 ||
+            parallel.details[1].code != ErrorCode::None)
+            results.push_back(TestResult{false, "诊断的行号不正确"});
+        if (ran || visited)
+            results.push_back(TestResult{false, "批量检查不应执行 action"});
+
+        // 响应文件打不开时只记录诊断，不输出日志；lint 可以不展开 "@file"
+        String logged;
+        this->responseFile(true);
+        static_cast<TestLogger *>(this->logger())->checkError = [&](const std::string &msg) { logged += msg; };
+        char *missing[] = {(char *)"todo", (char *)"add", (char *)"@/nonexistent/commander_cpp_lint"};
+        ParseResult missingResult = this->validate(3, missing);
+        {
+            std::ofstream out(file);
+            out << "todo add @/nonexistent/commander_cpp_lint\n";
+        }
+        LintReport expanded = this->lint(file, 1);
+        LintReport literal = this->lint(file, 1, 1000, false);
+        std::remove(file.c_str());
+        static_cast<TestLogger *>(this->logger())->checkError = nullptr;
+        this->responseFile(false);
+        if (missingResult.code != ErrorCode::ResponseFile || expanded.counts[ErrorCode::ResponseFile] != 1)
+            results.push_back(TestResult{false, "打不开的响应文件应该记录为诊断"});
+        if (!logged.empty())
+            results.push_back(TestResult{false, "validate 和 lint 不应输出日志: " + logged});
+        if (!literal.ok() || literal.lines != 1)
+            results.push_back(TestResult{false, "不展开响应文件时 \"@file\" 应按普通参数检查"});
+
+        // 引号不匹配的行和其它诊断一样计入统计
+        {
+            std::ofstream out(file);
+            out << "todo add \"task\ntodo add task\n";
+        }
+        LintReport unterminated = this->lint(file, 1);
+        std::remove(file.c_str());
+        if (unterminated.errors != 1 || unterminated.counts.size() != 1 ||
+            unterminated.counts[ErrorCode::ResponseFile] != 1 || unterminated.details.size() != 1 ||
+            unterminated.details[0].code != ErrorCode::ResponseFile ||
+            unterminated.summary().find("response-file: 1\n1: error: unterminated quote\n") == String::npos)
+            results.push_back(TestResult{false, "引号不匹配的统计不正确: " + unterminated.summary()});
+        return mergeAll(results);
+    }
+
+  private:
+    bool ran = false;
+    bool visited = false;
+};
+
+class RecorderTest : public Command, public Test
+{
+  public:
+    RecorderTest() : Command("", new TestLogger())
+    {
+        this->name(id())->description("测试调用记录和回放");
+        this->command("add", "添加", [this](Command *cmd) {
+            cmd->argument("<todo...>")
+                ->option("--ids <ids...>", "编号", ValueType::Int64)
+                ->action([this](Vector<Variant> args, Map<String, Variant> opts) { ++ran; });
+        });
+    }
+    virtual std::string id() override
+    {
+        return "RecorderTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        String file = std::filesystem::temp_directory_path().string() + "/commander_cpp_recorder_test";
+        std::remove(file.c_str());
+        char *ok[] = {(char *)"todo", (char *)"add", (char *)"buy milk", (char *)"--ids", (char *)"1", (char *)"2"};
+        char *bad[] = {(char *)"todo", (char *)"add", (char *)"--ids", (char *)"x"};
+        this->record(file);
+        this->parse(6, ok);
+        this->parse(4, bad);
+        this->validate(6, ok);
+        this->record(String());
+        this->parse(6, ok);
+        if (ran != 2)
+            results.push_back(TestResult{false, "记录不应改变 parse 的行为"});
+
+        // 进程在写入时退出留下的半条记录
+        {
+            std::ofstream out(file, std::ios::binary | std::ios::app);
+            out << String("\x40\0\0\0\x02\0\0\0garbage", 15);
+        }
+        InvocationLog log;
+        Vector<Invocation> records;
+        Vector<Vector<String>> argvs;
+        if (!log.open(file))
+            results.push_back(TestResult{false, "打开记录文件失败: " + log.error()});
+        log.forEach([&](const Invocation &record) {
+            records.push_back(record);
+            argvs.emplace_back(record.argv.begin(), record.argv.end());
+        });
+        if (records.size() != 2 || argvs[0] != Vector<String>(ok, ok + 6) || argvs[1] != Vector<String>(bad, bad + 4))
+            results.push_back(TestResult{false, "记录的 argv 不正确"});
+        else if (records[0].code != ErrorCode::None || records[1].code != ErrorCode::InvalidValue ||
+                 records[0].index != 1 || records[0].startNs == 0 || records[0].durationNs == 0)
+            results.push_back(TestResult{false, "记录的结果或时间不正确"});
+
+        ran = 0;
+        ReplayReport dry = this->replay(file);
+        if (dry.records != 2 || dry.mismatches != 0 || ran != 0)
+            results.push_back(TestResult{false, "只检查的回放结果不正确: " + dry.summary()});
+        ReplayReport full = this->replay(file, true);
+        if (full.records != 2 || full.mismatches != 0 || ran != 1 || full.maxNs < full.p50Ns)
+            results.push_back(TestResult{false, "执行 action 的回放结果不正确: " + full.summary()});
+        if (this->replay(file + ".missing").failure.empty())
+            results.push_back(TestResult{false, "回放不存在的文件应返回错误"});
+        std::remove(file.c_str());
+
+        // 超过 stdio 缓冲区的记录也要完整地写入
+        Vector<String> items(4096, String(32, 'x'));
+        Vector<char *> big{(char *)"todo", (char *)"add"};
+        for (auto &item : items)
+            big.push_back(&item[0]);
+        this->record(file);
+        for (int i = 0; i < 3; ++i)
+            this->parse(static_cast<int>(big.size()), big.data());
+        this->record(String());
+        size_t intact = 0;
+        InvocationLog bigLog;
+        if (bigLog.open(file))
+            bigLog.forEach([&](const Invocation &record) {
+                intact += record.argv.size() == big.size() && record.argv.back() == items.back();
+            });
+        std::remove(file.c_str());
+        if (intact != 3)
+            results.push_back(TestResult{false, "大记录没有完整写入: " + std::to_string(intact)});
+
+        // 只能在根命令上开启记录
+        String warned;
+        static_cast<TestLogger *>(this->logger())->checkWarn = [&](const std::string &msg) { warned += msg; };
+        this->findCommand("add")->record(file);
+        static_cast<TestLogger *>(this->logger())->checkWarn = nullptr;
+        if (warned.find("root command") == String::npos || std::filesystem::exists(file))
+            results.push_back(TestResult{false, "子命令上开启记录应该给出警告"});
+        return mergeAll(results);
+    }
+
+  private:
+    int ran = 0;
+};
+
+class GeneratorTest : public Test
+{
+  public:
+    virtual std::string id() override
+    {
+        return "GeneratorTest";
+    }
+    virtual TestResult test() override
+    {
+        std::vector<TestResult> results;
+        TestLogger logger;
+
+        GENERATOR::TreeSpec spec;
+        spec.seed = 7;
+        spec.depth = 3;
+        spec.fanOut = 3;
+        GENERATOR::GeneratedTree tree = GENERATOR::generateTree(spec, &logger);
+        if (tree.nodes.size() != 1 + 3 + 9 + 27)
+            results.push_back(TestResult{false, "生成的节点数量不正确"});
+
+        auto corpus = GENERATOR::generateArgv(tree, 11, 200);
+        if (corpus != GENERATOR::generateArgv(tree, 11, 200))
+            results.push_back(TestResult{false, "相同种子生成的语料不一致"});
+        if (corpus != GENERATOR::generateArgv(GENERATOR::generateTree(spec, &logger), 11, 200))
+            results.push_back(TestResult{false, "相同种子生成的命令树不一致"});
+
+        size_t actions = 0;
+        size_t problems = 0;
+        for (auto &node : tree.nodes)
+            node.command->action([&](Vector<Variant> args, Map<String, Variant> opts) { ++actions; });
+        logger.checkWarn = [&](const std::string &msg) { ++problems; };
+        logger.checkError = [&](const std::string &msg) { ++problems; };
+
+        for (auto &line : corpus)
+        {
+            std::vector<char *> argv;
+            for (auto &arg : line)
+                argv.push_back(&arg[0]);
+            tree.root->parse(static_cast<int>(argv.size()), argv.data());
+        }
+
+        if (actions != corpus.size() || problems != 0)
+            results.push_back(TestResult{false, "生成的语料未能全部正确解析"});
+
+        Command *node = tree.root.get();
+        for (size_t index : {tree.nodes[0].children[1], tree.nodes[tree.nodes[0].children[1]].children[0]})
+        {
+            node = node ? node->findCommand(tree.nodes[index].name) : nullptr;
+            if (node != tree.nodes[index].command)
+                results.push_back(TestResult{false, "findCommand 未找到生成的子命令"});
+        }
+
+        return mergeAll(results);
+    }
+};
+
 int main(int argc, char **argv)
 {
     TestLogger logger;
     // logger.stdOut = true;
+    int failed = 0;
     Command("test", &logger)
         .option("-i --display-success-info", "显示信息")
-        ->action([](Vector<Variant> args, Map<String, Variant> opts) {
+        ->action([&failed](Vector<Variant> args, Map<String, Variant> opts) {
             Test *tests[] = {new VersionTest(),          new DescriptionTest(),   new OptionTest(),
                              new ArgumentTest(),         new SubCommandTest(),    new DefaultValueTest(),
                              new MultiValueOptionTest(), new ErrorHandlingTest(), new ComplexOptionTest(),
-                             new IntegratedTest()};
+                             new IntegratedTest(),       new ResponseFileTest(),  new VisitorTest(),
+                             new TypedOptionTest(),      new ParallelConversionTest(),
+                             new CompactValueTest(),     new NameTableTest(),     new GeneratorTest(),
+                             new AllocationTest(),       new ProfilerTest(),      new TraceTest(),
+                             new ProfileOptionTest(),    new ParseResultTest(),   new DiagnosticTest(),
+                             new LazyCommandTest(),      new SchemaTest(),        new JsonSchemaTest(),
+                             new CompletionTest(),    new CompletionCacheTest(),
+                             new DaemonTest(),        new ServiceTest(),       new PushParserTest(),
+                             new PushParserCorpusTest(), new LintTest(),          new RecorderTest()};
 
             for (int i = 0; i < std::size(tests); i++)
             {
                 TestResult res = tests[i]->test();
                 if (!res.result)
                 {
+                    ++failed;
                     std::cout << "测试 :" << tests[i]->id() << " 失败: " << res.errMsg << std::endl;
                 }
                 else
@@ -929,5 +2846,5 @@ int main(int argc, char **argv)
             }
         })
         ->parse(argc, argv);
-    return 0;
+    return failed ? 1 : 0;
 }
@@ -1,9 +1,47 @@
 add_rules("mode.debug", "mode.release")
 
+option("usdt")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Enable USDT probes in parse and dispatch (requires sys/sdt.h)")
+    add_defines("COMMANDER_CPP_ENABLE_USDT")
+option_end()
+
+option("no-exceptions")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Build the library, tests and benchmarks with exceptions disabled")
+option_end()
+
+-- 关闭异常时库的解析和帮助路径不依赖异常，错误通过 ParseResult 返回
+function disable_exceptions()
+    if has_config("no-exceptions") then
+        add_cxxflags("-fno-exceptions", {tools = {"gcc", "clang"}})
+        add_cxxflags("/EHs-c-", "/D_HAS_EXCEPTIONS=0", {tools = "cl"})
+    end
+end
+
 target("commander-cpp")
     set_kind("binary")
     set_languages("cxx17")
     add_files("src/*.cpp")
+    add_options("usdt")
+    disable_exceptions()
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
+
+target("commander-bench")
+    set_kind("binary")
+    set_languages("cxx17")
+    set_optimize("fastest")
+    add_includedirs("src")
+    add_files("bench/*.cpp")
+    add_options("usdt")
+    disable_exceptions()
+    if is_plat("linux") then
+        add_syslinks("pthread")
+    end
 
 --
 -- If you want to known more usage about xmake, please see https://xmake.io